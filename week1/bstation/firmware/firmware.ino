@@ -10,6 +10,7 @@
 #include "lora_config.h"
 #include "packet.h"
 #include "model.h"
+#include "spsc_ring.h"
 #include <Arduino.h>
 #include <HTTPClient.h>
 #include <LoRaWan_APP.h>
@@ -33,9 +34,17 @@ static RadioEvents_t radioEvents;
 
 static LoRaPacket rxPacket;
 static AnalogPacket rxAnalog; // Cache for analog data
-static uint8_t rxBuffer[PACKET_SIZE + 10];
-static uint16_t rxSize = 0;
-static bool packetReceived = false;
+
+// A received packet, handed from the radio callback to loop()
+struct RxPacket {
+  uint8_t data[PACKET_SIZE + 10];
+  uint16_t size;
+  int16_t rssi;
+  int8_t snr;
+};
+
+// Packets arriving while loop() is busy wait here instead of being dropped
+static SpscRing<RxPacket, 8> rxRing;
 
 static int16_t lastRssi = 0;
 static int8_t lastSnr = 0;
@@ -59,20 +68,19 @@ static void onTxTimeout() {}
 
 static void onRxDone(uint8_t *payload, uint16_t size, int16_t rssi,
                      int8_t snr) {
-  // Prevent buffer overwrite if previous packet not processed
-  if (packetReceived) {
+  // Copied straight into the ring slot, published once complete
+  RxPacket *rx = rxRing.reserve();
+  if (rx == nullptr || size > sizeof(rx->data)) {
+    packetsError++; // Lost like a corrupted one
     Radio.Rx(0); // Re-enable RX immediately
     return;      // Discard current packet
   }
 
-  lastRssi = rssi;
-  lastSnr = snr;
-  rxSize = size;
-
-  if (size <= sizeof(rxBuffer)) {
-    memcpy(rxBuffer, payload, size);
-    packetReceived = true; // Signal that a new packet is ready for processing
-  }
+  memcpy(rx->data, payload, size);
+  rx->size = size;
+  rx->rssi = rssi;
+  rx->snr = snr;
+  rxRing.commit();
   Radio.Rx(0); // Re-enable RX
 }
 
@@ -322,7 +330,12 @@ void setup() {
 void loop() {
   Radio.IrqProcess();
 
-  if (packetReceived) {
+  if (RxPacket *rx = rxRing.front()) {
+    const uint8_t *rxBuffer = rx->data;
+    const uint16_t rxSize = rx->size;
+    lastRssi = rx->rssi;
+    lastSnr = rx->snr;
+
     // Check Packet Type (Byte 1)
     uint8_t packetType = rxBuffer[1];
 
@@ -377,8 +390,8 @@ void loop() {
       Serial.printf("[ERR] Unknown Packet Type: 0x%02X\n", packetType);
     }
 
-    // Release buffer lock after processing
-    packetReceived = false;
+    // Hand the slot back to the radio callback after processing
+    rxRing.release();
   } else {
     static uint32_t lastUpdate = 0;
     if (millis() - lastUpdate > 1000) {
@@ -1,23 +1,9 @@
 #include "packet.h"
+#include "crc.h"
 
-// CRC-16/CCITT polynomial (0x1021) - commonly used in LoRa/LoRaWAN
-static const uint16_t CRC16_POLY = 0x1021;
-static const uint16_t CRC16_INIT = 0xFFFF;
-
+// CRC-16/CCITT-FALSE (0x1021, init 0xFFFF), see crc.h
 uint16_t bsecCRC16(const uint8_t *data, uint8_t length) {
-  uint16_t crc = CRC16_INIT;
-
-  for (uint8_t i = 0; i < length; i++) {
-    crc ^= ((uint16_t)data[i] << 8);
-    for (uint8_t j = 0; j < 8; j++) {
-      if (crc & 0x8000) {
-        crc = (crc << 1) ^ CRC16_POLY;
-      } else {
-        crc <<= 1;
-      }
-    }
-  }
-  return crc;
+  return crc::CcittFalse::compute(data, length);
 }
 
 void initPacket(LoRaPacket *pkt, uint16_t deviceId) {
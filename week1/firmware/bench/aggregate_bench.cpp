@@ -0,0 +1,210 @@
+/**
+ *  @file aggregate_bench.cpp
+ *  @brief Radio time on air per sample with the queued frames packed into
+ *  shared packets (Aggregator, subsystems/aggregator.h) against a packet per
+ *  frame, replaying the captures through the node loop (Queue, Framing,
+ *  Aggregator) and the gateway (Splitter, Decoder), then batches of the
+ *  longest records there are, each of which must still fit a packet
+ *  */
+
+#include "../subsystems/aggregator.h"
+#include "../subsystems/decoder.h"
+#include "../subsystems/encoder.h"
+#include "dataset.h"
+#include <stdio.h>
+
+#define BENCH_WORST_SAMPLES 1000
+
+/* a frame the node queued */
+struct Queued {
+  size_t first; // sample
+  uint8_t count;
+  size_t slot; // transmission slot it was queued in
+};
+
+struct PolicyReport {
+  size_t packets;
+  size_t frames;
+  uint64_t bytes;
+  uint64_t airtime_us;
+  uint64_t waited; // slots, summed over the frames
+  size_t samples;  // in the frames that came out at the gateway
+  size_t intact;
+  size_t queued;
+  uint16_t longest; // packet
+};
+
+/* checks a deframed frame against the samples it was encoded from */
+static size_t check(Decoder &decoder, const DeframedFrame &f,
+                    const Queued &q, const std::vector<SensorData> &samples) {
+  if (!(f.header.flags & FLAG_BATCH)) {
+    EncoderResult result;
+    result.status = ENCODER_OK;
+    result.flag = f.header.flags;
+    result.len = f.header.len;
+    memcpy(result.data, f.payload, f.header.len);
+    const DecoderResult r =
+        decoder.decode(result, f.header.sequence, sequence_bits(f.header));
+    return r.status == DECODER_OK && dataset::same(r.data, samples[q.first]);
+  }
+  EncoderBatch batch;
+  batch.status = ENCODER_OK;
+  batch.flag = f.header.flags;
+  batch.len = f.header.len;
+  memcpy(batch.data, f.payload, f.header.len);
+  const DecoderBatch b =
+      decoder.decode_batch(batch, f.header.sequence, sequence_bits(f.header));
+  size_t intact = 0;
+  for (uint8_t i = 0; b.status == DECODER_OK && i < b.count && i < q.count;
+       i++) {
+    intact += schema::within_bands(b.data[i], samples[q.first + i],
+                                   schema::Fields{});
+  }
+  return b.count == q.count ? intact : 0;
+}
+
+/* one transmission slot after the other: a frame is queued (a varint
+ * sample or a dead band batch), then the aggregator decides */
+static PolicyReport run_policy(const std::vector<SensorData> &samples,
+                               bool batches, uint16_t bytes,
+                               uint32_t airtime_us, uint8_t wait) {
+  Encoder encoder;
+  Framing framing;
+  static Queue queue;
+  static Aggregator aggregator;
+  Splitter splitter;
+  Decoder decoder;
+  encoder.setup();
+  framing.setup();
+  queue.setup();
+  aggregator.setup();
+  aggregator.set_budget(bytes, airtime_us, wait);
+  splitter.setup();
+  decoder.setup();
+
+  PolicyReport report = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+  std::vector<Queued> queued;
+  size_t next = 0; // first queued frame not out at the gateway yet
+  uint16_t sequence = 0;
+  for (size_t slot = 0, i = 0; i < samples.size() || !queue.isEmpty();
+       slot++) {
+    if (i < samples.size()) {
+      const uint8_t count =
+          batches ? (uint8_t)std::min<size_t>(BATCH_MAX_SAMPLES,
+                                              samples.size() - i)
+                  : 1;
+      // NOTE: as in the sketch, a frame given up is lost at the gateway
+      while (queue.isFull()) {
+        queue.drop();
+      }
+      Frame &frame = *queue.reserve();
+      EncoderOutput out = {frame.payload(), 0, 0};
+      const uint8_t status =
+          batches ? encoder.encode_batch(&samples[i], count,
+                                         (uint32_t)(i * 1000), 1000,
+                                         ENCODE_DEADBAND, out)
+                  : encoder.encode(samples[i], ENCODE_VARINT, out);
+      if (status == ENCODER_OK) {
+        frame.flag = out.flag;
+        frame.len = out.len;
+        queue.commit();
+        queued.push_back({i, out.count, slot});
+        report.queued += out.count;
+      }
+      i += out.count;
+    }
+    // NOTE: the last frames go out once the captures are done
+    if (!aggregator.ready(queue) &&
+        (i < samples.size() || queue.isEmpty())) {
+      continue;
+    }
+
+    const uint16_t len = aggregator.pack(queue, framing, sequence);
+    report.packets++;
+    report.bytes += len;
+    report.longest = len > report.longest ? len : report.longest;
+    report.airtime_us += lora::airtime_us(len);
+    splitter.begin(aggregator.packet(), len);
+    while (splitter.next() && next < queued.size()) {
+      const Queued &q = queued[next++];
+      report.frames++;
+      report.samples += q.count;
+      report.waited += slot - q.slot;
+      report.intact += check(decoder, splitter.frame(), q, samples);
+    }
+  }
+  return report;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SensorData> samples;
+  const char *dir = argc > 1 ? argv[1] : DATA_DIR;
+  if (!dataset::load(samples, dir)) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+
+  printf("aggregation benchmark: %zu samples, SF%d %u kHz, %s framing v%d\n",
+         samples.size(), LORA_SPREADING_FACTOR,
+         (unsigned)(lora::bandwidth_hz(LORA_BANDWIDTH) / 1000),
+         FRAMING_COBS ? "cobs" : "escaped", FRAME_VERSION);
+
+  static const struct {
+    const char *name;
+    bool batches;
+  } workloads[] = {{"varint, a sample per slot", false},
+                   {"dead band batches, one per slot", true}};
+  static const struct {
+    const char *name;
+    uint16_t bytes;
+    uint32_t airtime_ms;
+    uint8_t wait;
+  } policies[] = {{"frame/packet", 1, 0xFFFF, 1},
+                  {"wait 1", LORA_MAX_PAYLOAD, 400, 1},
+                  {"wait 2", LORA_MAX_PAYLOAD, 400, 2},
+                  {"wait 4", LORA_MAX_PAYLOAD, 400, 4},
+                  {"wait 8", LORA_MAX_PAYLOAD, 400, 8},
+                  {"wait 16", LORA_MAX_PAYLOAD, 400, 16},
+                  {"wait 16 200ms", LORA_MAX_PAYLOAD, 200, 16}};
+
+  int status = 0;
+  for (const auto &w : workloads) {
+    printf("\n%s\n\n", w.name);
+    printf("%-14s %8s %9s %9s %11s %8s %9s %12s\n", "policy", "packets",
+           "frames/p", "bytes/p", "ms/sample", "gain", "wait", "intact");
+    double single = 0;
+    for (const auto &p : policies) {
+      const PolicyReport r =
+          run_policy(samples, w.batches, p.bytes, p.airtime_ms * 1000, p.wait);
+      // NOTE: per sample read, held batches included
+      const double ms = r.airtime_us / 1e3 / samples.size();
+      if (single == 0) {
+        single = ms;
+      }
+      printf("%-14s %8zu %9.2f %9.1f %11.3f %7.2fx %9.2f %10zu/%zu\n",
+             p.name, r.packets, r.frames / (double)r.packets,
+             r.bytes / (double)r.packets, ms, single / ms,
+             r.waited / (double)r.frames, r.intact, r.queued);
+      status |= r.intact != r.queued || r.samples != r.queued;
+    }
+  }
+
+  /* NOTE: every field swings across its width from one sample to the next,
+   * the longest records there are, so each batch has to end early to keep
+   * its frame within a packet */
+  std::vector<SensorData> worst(BENCH_WORST_SAMPLES);
+  for (size_t i = 0; i < worst.size(); i++) {
+    memset(&worst[i], i & 1 ? 0x80 : 0x00, sizeof(SensorData));
+  }
+  const PolicyReport r = run_policy(worst, true, LORA_MAX_PAYLOAD,
+                                    AGGREGATE_MAX_AIRTIME_MS * 1000, 1);
+  printf("\nworst case batches, %u samples\n\n", (unsigned)worst.size());
+  printf("%-22s %10.2f of %u\n", "samples per batch",
+         r.samples / (double)r.frames, (unsigned)BATCH_MAX_SAMPLES);
+  printf("%-22s %10u of %u B\n", "longest packet", r.longest,
+         (unsigned)LORA_MAX_PAYLOAD);
+  printf("%-22s %10zu/%zu\n", "intact", r.intact, r.queued);
+  status |= r.intact != r.queued || r.samples != worst.size() ||
+            r.longest > LORA_MAX_PAYLOAD;
+  return status;
+}
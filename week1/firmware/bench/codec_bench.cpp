@@ -0,0 +1,750 @@
+/**
+ *  @file codec_bench.cpp
+ *  @brief Replays the recorded base station captures through the node
+ *  Encoder and the gateway Decoder and reports speed, size and round trip
+ *  correctness for every encoding mode
+ *  */
+
+#include "../subsystems/crc.h"
+#include "../subsystems/decoder.h"
+#include "../subsystems/encoder.h"
+#include "../subsystems/framing.h"
+#include "../subsystems/queue.h"
+#include "../subsystems/retained.h"
+#include "dataset.h"
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifndef BENCH_PASSES
+#define BENCH_PASSES 50
+#endif
+
+/* runs of each transmit path, the fastest is reported */
+#ifndef BENCH_TRANSMIT_RUNS
+#define BENCH_TRANSMIT_RUNS 5
+#endif
+
+/* frames dropped by the simulated radio link, in per mille */
+#ifndef BENCH_LOSS
+#define BENCH_LOSS 10
+#endif
+
+struct ModeReport {
+  double encode_ns;   // per sample
+  double decode_ns;   // per sample
+  double bytes;       // average payload length per sample
+  double frame_bytes; // average framed length per sample
+  size_t mismatches;  // samples that did not survive the round trip
+  size_t samples;
+};
+
+/* use the same predictor on every delta field */
+static void use_predictor(Encoder &encoder, uint8_t predictor) {
+  for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+    encoder.set_predictor(f, predictor);
+  }
+}
+
+/* lossy modes only have to stay within the dead band or half the
+ * quantization step of every field */
+static bool matches(const SensorData &decoded, const SensorData &sample,
+                    uint8_t flags) {
+  if (flags & ENCODE_DEADBAND) {
+    return schema::within_bands(decoded, sample, schema::Fields{});
+  }
+  if (flags & ENCODE_LOSSY) {
+    return schema::within_quant(decoded, sample, schema::Fields{});
+  }
+  return dataset::same(decoded, sample);
+}
+
+static ModeReport run_mode(const std::vector<SensorData> &samples,
+                           uint8_t flags, uint8_t predictor) {
+  Encoder encoder;
+  Decoder decoder;
+  Framing framing;
+  encoder.setup();
+  decoder.setup();
+  framing.setup();
+  use_predictor(encoder, predictor);
+
+  std::vector<EncoderResult> results(samples.size());
+  ModeReport report = {0, 0, 0, 0, 0, 0};
+  double encode_ns = 0, decode_ns = 0;
+  uint64_t bytes = 0, frame_bytes = 0;
+
+  for (int pass = 0; pass < BENCH_PASSES; pass++) {
+    dataset::Stopwatch encode_timer;
+    for (size_t i = 0; i < samples.size(); i++) {
+      results[i] = encoder.encode(samples[i], flags);
+    }
+    encode_ns += encode_timer.ns();
+
+    DecoderResult decoded;
+    size_t mismatches = 0;
+    dataset::Stopwatch decode_timer;
+    for (size_t i = 0; i < samples.size(); i++) {
+      decoded = decoder.decode(results[i]);
+      mismatches += !matches(decoded.data, samples[i], flags);
+    }
+    decode_ns += decode_timer.ns();
+
+    for (size_t i = 0; i < results.size(); i++) {
+      // NOTE: held samples are not sent at all
+      if (results[i].status == ENCODER_HOLD) {
+        continue;
+      }
+      FrameBuffer_t frame;
+      uint16_t crc;
+      bytes += results[i].len;
+      frame_bytes += framing.frame(results[i], (uint16_t)i, frame, crc).len;
+    }
+    report.mismatches += mismatches;
+  }
+
+  const double n = (double)samples.size() * BENCH_PASSES;
+  report.encode_ns = encode_ns / n;
+  report.decode_ns = decode_ns / n;
+  report.bytes = bytes / n;
+  report.frame_bytes = frame_bytes / n;
+  report.samples = samples.size() * BENCH_PASSES;
+  return report;
+}
+
+/* batch mode: BATCH_MAX_SAMPLES consecutive samples per payload (fewer when
+ * a batch ends at BATCH_MAX_LEN), sizes are still reported per sample */
+static ModeReport run_batch(const std::vector<SensorData> &samples,
+                            uint8_t flags, uint8_t predictor) {
+  Encoder encoder;
+  Decoder decoder;
+  Framing framing;
+  encoder.setup();
+  decoder.setup();
+  framing.setup();
+  use_predictor(encoder, predictor);
+
+  std::vector<EncoderBatch> results;
+  std::vector<size_t> firsts;
+  ModeReport report = {0, 0, 0, 0, 0, 0};
+  double encode_ns = 0, decode_ns = 0;
+  uint64_t bytes = 0, frame_bytes = 0;
+
+  for (int pass = 0; pass < BENCH_PASSES; pass++) {
+    results.clear();
+    firsts.clear();
+    dataset::Stopwatch encode_timer;
+    for (size_t first = 0; first < samples.size();) {
+      const size_t count = std::min<size_t>(BATCH_MAX_SAMPLES,
+                                            samples.size() - first);
+      results.push_back(encoder.encode_batch(&samples[first], (uint8_t)count,
+                                             (uint32_t)(first * 1000), 1000,
+                                             flags));
+      firsts.push_back(first);
+      first += std::max<size_t>(results.back().count, 1);
+    }
+    encode_ns += encode_timer.ns();
+    const size_t batches = results.size();
+
+    size_t mismatches = 0;
+    SensorData last;
+    memset(&last, 0, sizeof(last));
+    dataset::Stopwatch decode_timer;
+    for (size_t b = 0; b < batches; b++) {
+      const size_t first = firsts[b];
+      const size_t count = results[b].count;
+      // NOTE: a held batch is not sent, the gateway repeats the last sample
+      if (results[b].status == ENCODER_HOLD) {
+        EncoderResult held;
+        held.flag = FLAG_HOLD;
+        held.len = 0;
+        last = decoder.decode(held).data;
+        for (size_t i = 0; i < count; i++) {
+          mismatches += !matches(last, samples[first + i], flags);
+        }
+        continue;
+      }
+      const DecoderBatch decoded = decoder.decode_batch(results[b]);
+      if (decoded.status != DECODER_OK || decoded.count != count ||
+          decoded.timestamp != first * 1000) {
+        mismatches += count;
+        continue;
+      }
+      for (size_t i = 0; i < count; i++) {
+        // NOTE: the fields of a missing sensor repeat the sample before
+        SensorData expected = samples[first + i];
+        schema::hold_sensors(expected, last, flags & ENCODE_NO_SENSORS,
+                             schema::Fields{});
+        mismatches += !matches(decoded.data[i], expected, flags);
+        last = decoded.data[i];
+      }
+    }
+    decode_ns += decode_timer.ns();
+
+    for (size_t b = 0; b < batches; b++) {
+      if (results[b].status == ENCODER_HOLD) {
+        continue;
+      }
+      FrameBuffer_t frame;
+      uint16_t crc;
+      bytes += results[b].len;
+      frame_bytes += framing.frame(results[b], (uint16_t)b, frame, crc).len;
+    }
+    report.mismatches += mismatches;
+  }
+
+  const double n = (double)samples.size() * BENCH_PASSES;
+  report.encode_ns = encode_ns / n;
+  report.decode_ns = decode_ns / n;
+  report.bytes = bytes / n;
+  report.frame_bytes = frame_bytes / n;
+  report.samples = samples.size() * BENCH_PASSES;
+  return report;
+}
+
+struct LossReport {
+  double frame_bytes;  // average framed length per sample
+  size_t delivered;    // samples decoded (and checked against the capture)
+  size_t lost;         // samples the decoder reported lost
+  size_t mismatches;   // delivered samples that did not match
+  size_t unaccounted;  // sent samples neither delivered nor reported lost
+  size_t samples;
+};
+
+/* deterministic drop pattern (numerical recipes lcg), same for every mode */
+static bool dropped(uint32_t &seed) {
+  seed = seed * 1664525u + 1013904223u;
+  return (seed >> 8) % 1000 < BENCH_LOSS;
+}
+
+/* every frame goes through the sequence aware decoder, BENCH_LOSS of them
+ * never arrive */
+static LossReport run_loss(const std::vector<SensorData> &samples,
+                           uint8_t flags, uint16_t keyframe_interval) {
+  Encoder encoder;
+  Decoder decoder;
+  Framing framing;
+  encoder.setup();
+  decoder.setup();
+  framing.setup();
+  encoder.set_keyframe_interval(keyframe_interval);
+
+  LossReport report = {0, 0, 0, 0, 0, 0};
+  uint64_t frame_bytes = 0;
+  uint32_t seed = 1;
+  uint16_t sequence = 0;
+  size_t trailing = 0; // dropped after the last received frame
+
+  for (int pass = 0; pass < BENCH_PASSES; pass++) {
+    for (size_t i = 0; i < samples.size(); i++) {
+      EncoderResult result = encoder.encode(samples[i], flags);
+      FrameBuffer_t frame;
+      uint16_t crc;
+      frame_bytes += framing.frame(result, sequence, frame, crc).len;
+      if (dropped(seed)) {
+        sequence++;
+        trailing++;
+        continue;
+      }
+      const DecoderResult decoded = decoder.decode(result, sequence++);
+      trailing = 0;
+      if (decoded.status == DECODER_OK) {
+        report.delivered++;
+        report.mismatches += !matches(decoded.data, samples[i], flags);
+      }
+    }
+  }
+
+  report.samples = samples.size() * BENCH_PASSES;
+  report.lost = decoder.lost();
+  report.unaccounted =
+      report.samples - report.delivered - report.lost - trailing;
+  report.frame_bytes = frame_bytes / (double)report.samples;
+  return report;
+}
+
+/* node side from sample to framed, both through the queue: staged through
+ * the EncoderResult copies the queue used to make (copied into a ring slot,
+ * then into the queued Frame) or encoded in place in the queued Frame,
+ * returns ns per sample */
+static double run_transmit(const std::vector<SensorData> &samples,
+                           uint8_t flags, bool in_place, uint64_t &checksum) {
+  Encoder encoder;
+  Framing framing;
+  encoder.setup();
+  framing.setup();
+  static Queue queue;
+  queue.setup();
+  static EncoderResult ring[16]; // NOTE: the slots of the old queue
+
+  uint16_t sequence = 0;
+  dataset::Stopwatch timer;
+  for (int pass = 0; pass < BENCH_PASSES; pass++) {
+    for (size_t i = 0; i < samples.size(); i++) {
+      Frame &frame = *queue.reserve(); // NOTE: released right away
+      if (in_place) {
+        EncoderOutput out = {frame.payload(), 0, 0};
+        if (encoder.encode(samples[i], flags, out) != ENCODER_OK) {
+          continue;
+        }
+        frame.flag = out.flag;
+        frame.len = out.len;
+      } else {
+        EncoderResult result = encoder.encode(samples[i], flags);
+        if (result.status != ENCODER_OK) {
+          continue;
+        }
+        EncoderResult &slot = ring[i % 16];
+        memcpy(&slot, &result, sizeof(EncoderResult));
+        frame.flag = slot.flag;
+        frame.len = slot.len;
+        memcpy(frame.payload(), slot.data, slot.len);
+      }
+      queue.commit();
+      uint16_t crc;
+      const uint16_t len =
+          framing.finalize(*queue.front(), sequence++, crc).len;
+      queue.release();
+      checksum += crc + len;
+    }
+  }
+  return timer.ns() / ((double)samples.size() * BENCH_PASSES);
+}
+
+struct SleepReport {
+  double frame_bytes; // average framed length per sample
+  size_t resumed;     // wake ups that carried on with the delta chain
+  size_t rejected;    // damaged states the checksum turned down
+  size_t mismatches;  // samples not decoded intact (or at all)
+  size_t samples;
+};
+
+/* a node that deep sleeps after every sample: every wake up starts with a
+ * fresh Encoder and Retained (its state file in /tmp), `retain` off is a
+ * node without retained state, every `damage`th state file gets a flipped
+ * byte. `batched` sends a batch once the retained one is full instead of a
+ * frame per wake up. One pass, the point is the frame sizes and the chain,
+ * not speed */
+static SleepReport run_sleep(const std::vector<SensorData> &samples,
+                             uint8_t flags, bool retain, uint32_t damage,
+                             bool batched) {
+  char path[] = "/tmp/codec_bench_retainedXXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    return {0, 0, 0, samples.size(), samples.size()};
+  }
+  close(fd);
+
+  Decoder decoder;
+  Framing framing;
+  decoder.setup();
+  framing.setup();
+
+  SleepReport report = {0, 0, 0, 0, samples.size()};
+  uint64_t frame_bytes = 0;
+  size_t first = 0;           // of the open batch
+  size_t batched_samples = 0; // gone out in a batch
+
+  for (size_t i = 0; i < samples.size(); i++) {
+    if (damage && i % damage == damage - 1) {
+      FILE *f = fopen(path, "r+b");
+      if (f) {
+        fseek(f, offsetof(RetainedState, encoder) + i % sizeof(EncoderState),
+              SEEK_SET);
+        const int c = fgetc(f);
+        fseek(f, -1, SEEK_CUR);
+        fputc(c ^ 0x10, f);
+        fclose(f);
+      }
+    }
+
+    // NOTE: the sequence starts over too unless it is restored
+    uint16_t sequence = 0;
+    Encoder encoder;
+    Retained retained(path);
+    OpenBatch batch = {};
+    encoder.setup();
+    retained.setup();
+    if (retain && retained.restore(encoder, sequence, &batch)) {
+      report.resumed++;
+    } else if (retain && i > 0) {
+      report.rejected++;
+    }
+
+    FrameBuffer_t frame;
+    uint16_t crc;
+    if (batched) {
+      // NOTE: the samples of the open batch came back from the state file
+      if (batch.count == 0) {
+        first = i;
+        batch.timestamp = (uint32_t)(i * 1000);
+      }
+      batch.samples[batch.count++] = samples[i];
+      if (batch.count < BATCH_MAX_SAMPLES && i + 1 < samples.size()) {
+        retained.save(encoder, sequence, &batch);
+        continue;
+      }
+      const EncoderBatch result = encoder.encode_batch(
+          batch.samples, batch.count, batch.timestamp, 1000, flags);
+      frame_bytes += framing.frame(result, sequence, frame, crc).len;
+      const DecoderBatch decoded = decoder.decode_batch(result, sequence++);
+      for (uint8_t k = 0; k < batch.count; k++) {
+        report.mismatches += decoded.status != DECODER_OK ||
+                             decoded.count != batch.count ||
+                             decoded.timestamp != first * 1000 ||
+                             !matches(decoded.data[k], samples[first + k],
+                                      flags);
+      }
+      batched_samples += batch.count;
+      batch.count = 0;
+      retained.save(encoder, sequence, &batch);
+      continue;
+    }
+
+    EncoderResult result = encoder.encode(samples[i], flags);
+    frame_bytes += framing.frame(result, sequence, frame, crc).len;
+    const DecoderResult decoded = decoder.decode(result, sequence++);
+    report.mismatches += decoded.status != DECODER_OK ||
+                         !matches(decoded.data, samples[i], flags);
+
+    if (retain) {
+      retained.save(encoder, sequence);
+    }
+  }
+
+  unlink(path);
+  // NOTE: a batch lost in the sleep never went out
+  if (batched) {
+    report.mismatches += samples.size() - batched_samples;
+  }
+  report.frame_bytes = frame_bytes / (double)samples.size();
+  return report;
+}
+
+/* one pass through the encoder alone, then its statistics; the field bits
+ * plus the per frame overhead must add up to the payload bytes */
+static bool run_stats(const std::vector<SensorData> &samples, uint8_t flags,
+                      bool print) {
+  Encoder encoder;
+  encoder.setup();
+  uint64_t payload = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    payload += encoder.encode(samples[i], flags).len;
+  }
+
+  const EncoderStats &s = encoder.stats();
+  if (print) {
+    stats::print(s);
+  }
+  uint64_t bits = 0;
+  for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+    bits += s.field[f].bits;
+  }
+  const uint64_t deltas = s.samples - s.keyframes;
+  bits += s.keyframes *
+          (8 * schema::PACKED_KEYFRAME_LEN - schema::packed_bits(schema::Fields{}));
+  if (flags & ENCODE_VARINT) {
+    bits += deltas * 8 * schema::CHANGED_LEN;
+  }
+  uint32_t histogram = 0;
+  for (uint8_t b = 0; b < STATS_LEN_BUCKETS; b++) {
+    histogram += s.len[b];
+  }
+  for (uint8_t b = 0; b < STATS_BATCH_LEN_BUCKETS; b++) {
+    histogram += s.batch_len[b];
+  }
+  return !ENCODER_STATS || (bits == 8 * payload && histogram == s.frames &&
+                            s.frames == samples.size());
+}
+
+struct FramingReport {
+  size_t frames;
+  size_t intact;         // deframed, header and payload as sent
+  uint64_t bytes;        // on the air
+  uint64_t header_bytes; // without the SOF
+  uint16_t worst;        // longest frame
+};
+
+/* the frames of `results` as one byte stream through the Deframer, with
+ * header `version`, 0: v1 and v2 in turn (a mixed fleet) */
+template <typename Result>
+static FramingReport run_framing(const std::vector<Result> &results,
+                                 uint8_t version) {
+  Framing framing;
+  framing.setup();
+  std::vector<uint8_t> stream;
+  FramingReport report = {results.size(), 0, 0, 0, 0};
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &result = results[i];
+    FrameBuffer_t frame;
+    uint16_t crc;
+    framing.set_version(version ? version : 1 + (i & 1));
+    const FrameHeader header = framing.frame(result, (uint16_t)i, frame, crc);
+    stream.insert(stream.end(), frame, frame + header.len);
+    report.bytes += header.len;
+    report.header_bytes += Framing::put_header(frame, header);
+    report.worst = std::max(report.worst, header.len);
+  }
+
+  Deframer deframer;
+  deframer.begin();
+  size_t next = 0;
+  for (uint8_t b : stream) {
+    if (deframer.push(b) != DEFRAME_FRAME || next >= results.size()) {
+      continue;
+    }
+    const DeframedFrame &f = deframer.frame();
+    const Result &sent = results[next];
+    const uint16_t mask = (uint16_t)((1u << sequence_bits(f.header)) - 1);
+    report.intact +=
+        f.header.version == (version ? version : 1 + (next & 1)) &&
+        f.header.flags == sent.flag &&
+        f.header.sequence == (uint16_t)(next & mask) &&
+        f.header.len == sent.len &&
+        memcmp(f.payload, sent.data, sent.len) == 0;
+    next++;
+  }
+  return report;
+}
+
+/* a line of the framing table, false if a frame did not come through or
+ * went past MAX_FRAME_LEN */
+template <typename Result>
+static bool print_framing(const char *name, const std::vector<Result> &results,
+                          uint8_t version) {
+  const FramingReport r = run_framing(results, version);
+  printf("%-13s %10.2f %10.2f %10u %10u %10zu/%zu\n", name,
+         r.bytes / (double)r.frames, r.header_bytes / (double)r.frames,
+         r.worst, (unsigned)MAX_FRAME_LEN, r.intact, r.frames);
+  return r.intact == r.frames && r.worst <= MAX_FRAME_LEN;
+}
+
+static void print_report(const char *name, const ModeReport &r,
+                         double keyframe_bytes) {
+  printf("%-13s %10.1f %10.1f %10.2f %10.2f %8.2fx %10zu/%zu\n", name,
+         r.encode_ns, r.decode_ns, r.bytes, r.frame_bytes,
+         keyframe_bytes / r.bytes, r.samples - r.mismatches, r.samples);
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SensorData> samples;
+  const char *dir = argc > 1 ? argv[1] : DATA_DIR;
+  if (!dataset::load(samples, dir)) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+
+  printf("codec benchmark: %zu samples x %d passes\n\n", samples.size(),
+         BENCH_PASSES);
+  printf("%-13s %10s %10s %10s %10s %9s %12s\n", "mode", "enc ns/s",
+         "dec ns/s", "bytes/s", "frame/s", "ratio", "round trip");
+
+  static const struct {
+    const char *name;
+    uint8_t flags;
+    uint8_t predictor;
+  } modes[] = {
+      {"keyframe", ENCODE_NO_DELTA, schema::PRED_PREV},
+      {"delta", 0, schema::PRED_PREV},
+      {"delta/lin", 0, schema::PRED_LINEAR},
+      {"delta/xor", 0, schema::PRED_XOR},
+      {"varint", ENCODE_VARINT, schema::PRED_PREV},
+      {"varint/lin", ENCODE_VARINT, schema::PRED_LINEAR},
+      {"varint/xor", ENCODE_VARINT, schema::PRED_XOR},
+      {"entropy", ENCODE_ENTROPY, schema::PRED_PREV},
+      {"entropy/lin", ENCODE_ENTROPY, schema::PRED_LINEAR},
+      {"varint/db", ENCODE_VARINT | ENCODE_DEADBAND, schema::PRED_PREV},
+      {"entropy/db", ENCODE_ENTROPY | ENCODE_DEADBAND, schema::PRED_PREV},
+      {"delta/lossy", ENCODE_LOSSY, schema::PRED_PREV},
+      {"varint/lossy", ENCODE_VARINT | ENCODE_LOSSY, schema::PRED_PREV},
+      {"entropy/lossy", ENCODE_ENTROPY | ENCODE_LOSSY, schema::PRED_PREV},
+  };
+
+  int status = 0;
+  double keyframe_bytes = 0;
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    ModeReport report =
+        run_mode(samples, modes[m].flags, modes[m].predictor);
+    if (m == 0) {
+      keyframe_bytes = report.bytes;
+    }
+    print_report(modes[m].name, report, keyframe_bytes);
+    status |= report.mismatches != 0;
+  }
+
+  static const struct {
+    const char *name;
+    uint8_t flags;
+    uint8_t predictor;
+  } batch_modes[] = {
+      {"batch", 0, schema::PRED_PREV},
+      {"batch/lin", 0, schema::PRED_LINEAR},
+      {"batch/db", ENCODE_DEADBAND, schema::PRED_PREV},
+      {"batch/lossy", ENCODE_LOSSY, schema::PRED_PREV},
+      {"batch/no mq", ENCODE_NO_MQ135_DATA, schema::PRED_PREV},
+  };
+  for (size_t m = 0; m < sizeof(batch_modes) / sizeof(batch_modes[0]); m++) {
+    ModeReport report = run_batch(samples, batch_modes[m].flags,
+                                  batch_modes[m].predictor);
+    print_report(batch_modes[m].name, report, keyframe_bytes);
+    status |= report.mismatches != 0;
+  }
+  {
+    // NOTE: a batch has no entropy coding, asking for it must fail
+    Encoder encoder;
+    encoder.setup();
+    status |= encoder.encode_batch(&samples[0], BATCH_MAX_SAMPLES, 0, 1000,
+                                   ENCODE_ENTROPY)
+                  .status != ENCODER_FAILURE;
+  }
+
+  printf("\ntransmit path, sample to framed\n\n");
+  printf("%-13s %10s %10s\n", "mode", "staged ns", "in place");
+  static const struct {
+    const char *name;
+    uint8_t flags;
+  } transmit_modes[] = {
+      {"keyframe", ENCODE_NO_DELTA},
+      {"varint", ENCODE_VARINT},
+      {"entropy", ENCODE_ENTROPY},
+  };
+  for (size_t m = 0; m < sizeof(transmit_modes) / sizeof(transmit_modes[0]);
+       m++) {
+    uint64_t staged_sum = 0, in_place_sum = 0;
+    double staged = 0, in_place = 0;
+    // NOTE: the two paths take turns, the best run of each stands
+    for (int r = 0; r < BENCH_TRANSMIT_RUNS; r++) {
+      const double s =
+          run_transmit(samples, transmit_modes[m].flags, false, staged_sum);
+      const double p =
+          run_transmit(samples, transmit_modes[m].flags, true, in_place_sum);
+      staged = r == 0 || s < staged ? s : staged;
+      in_place = r == 0 || p < in_place ? p : in_place;
+    }
+    printf("%-13s %10.1f %10.1f\n", transmit_modes[m].name, staged, in_place);
+    // NOTE: both paths must put the same frames on the air
+    status |= staged_sum != in_place_sum;
+  }
+
+  printf("\nlink with %.1f%% frame loss\n\n", BENCH_LOSS / 10.0);
+  printf("%-13s %10s %10s %10s %10s\n", "mode", "keyframes", "frame/s",
+         "delivered", "lost");
+
+  static const struct {
+    const char *name;
+    uint8_t flags;
+    uint16_t keyframe_interval;
+  } loss_modes[] = {
+      {"keyframe", ENCODE_NO_DELTA, 1},
+      {"varint", ENCODE_VARINT, 0},
+      {"varint", ENCODE_VARINT, 8},
+      {"varint", ENCODE_VARINT, 32},
+      {"varint", ENCODE_VARINT, 128},
+      {"entropy", ENCODE_ENTROPY, 32},
+  };
+  for (size_t m = 0; m < sizeof(loss_modes) / sizeof(loss_modes[0]); m++) {
+    const LossReport r =
+        run_loss(samples, loss_modes[m].flags, loss_modes[m].keyframe_interval);
+    char every[16];
+    snprintf(every, sizeof(every), loss_modes[m].keyframe_interval
+                                       ? "1/%u"
+                                       : "never",
+             loss_modes[m].keyframe_interval);
+    printf("%-13s %10s %10.2f %9.2f%% %9.2f%%\n", loss_modes[m].name, every,
+           r.frame_bytes, 100.0 * r.delivered / r.samples,
+           100.0 * r.lost / r.samples);
+    // NOTE: every sample is either delivered intact or reported lost
+    status |= r.mismatches != 0 || r.unaccounted != 0;
+  }
+
+  printf("\ndeep sleep after every sample, %zu wake ups\n\n", samples.size());
+  printf("%-13s %10s %10s %10s %10s %12s\n", "mode", "state", "frame/s",
+         "resumed", "rejected", "round trip");
+
+  static const struct {
+    const char *name;
+    uint8_t flags;
+    bool retain;
+    uint32_t damage;
+    bool batched;
+  } sleep_modes[] = {
+      {"varint", ENCODE_VARINT, false, 0, false},
+      {"varint", ENCODE_VARINT, true, 0, false},
+      {"entropy", ENCODE_ENTROPY, true, 0, false},
+      {"varint", ENCODE_VARINT, true, 64, false},
+      {"batch", 0, true, 0, true},
+  };
+  for (size_t m = 0; m < sizeof(sleep_modes) / sizeof(sleep_modes[0]); m++) {
+    const SleepReport r = run_sleep(samples, sleep_modes[m].flags,
+                                    sleep_modes[m].retain,
+                                    sleep_modes[m].damage,
+                                    sleep_modes[m].batched);
+    const char *state = !sleep_modes[m].retain  ? "none"
+                        : sleep_modes[m].damage ? "damaged"
+                                                : "retained";
+    printf("%-13s %10s %10.2f %10zu %10zu %10zu/%zu\n", sleep_modes[m].name,
+           state, r.frame_bytes, r.resumed, r.rejected,
+           r.samples - r.mismatches, r.samples);
+    // NOTE: every damaged state is turned down, every other one resumed
+    const size_t damaged =
+        sleep_modes[m].damage ? (r.samples - 1) / sleep_modes[m].damage : 0;
+    status |= r.mismatches != 0 ||
+              (sleep_modes[m].retain &&
+               (r.rejected != damaged || r.resumed + damaged != r.samples - 1));
+  }
+
+  printf("\n%s framing, v1 and v2 headers, through the Deframer\n\n",
+         FRAMING_COBS ? "cobs" : "escaped");
+  printf("%-13s %10s %10s %10s %10s %12s\n", "payloads", "frame B",
+         "header B", "worst B", "bound B", "intact");
+  {
+    std::vector<EncoderResult> keyframes, varints;
+    std::vector<EncoderBatch> batches;
+    std::vector<Encoded<MAX_FRAME_PAYLOAD_LEN>> extremes;
+    Encoder encoder;
+    encoder.setup();
+    for (size_t i = 0; i < samples.size(); i++) {
+      keyframes.push_back(encoder.encode(samples[i], ENCODE_NO_DELTA));
+    }
+    encoder.setup();
+    for (size_t i = 0; i < samples.size(); i++) {
+      varints.push_back(encoder.encode(samples[i], ENCODE_VARINT));
+    }
+    // NOTE: what the node sends, a dead band batch per transmission
+    encoder.setup();
+    for (size_t i = 0; i + BATCH_MAX_SAMPLES <= samples.size();) {
+      const EncoderBatch r = encoder.encode_batch(
+          &samples[i], BATCH_MAX_SAMPLES, (uint32_t)(i * 1000), 1000,
+          ENCODE_DEADBAND);
+      if (r.status == ENCODER_OK) {
+        batches.push_back(r);
+      }
+      i += std::max<size_t>(r.count, 1);
+    }
+    // NOTE: the longest payload with no zero at all (a code byte every 254)
+    // and nothing but zeros
+    for (uint8_t fill : {0xFF, 0x00, 0x01}) {
+      Encoded<MAX_FRAME_PAYLOAD_LEN> r;
+      r.status = ENCODER_OK;
+      r.flag = fill ? 0xFFFFFFFF : 0;
+      r.len = MAX_FRAME_PAYLOAD_LEN;
+      memset(r.data, fill, sizeof(r.data));
+      extremes.push_back(r);
+    }
+    status |= !print_framing("keyframe v1", keyframes, 1);
+    status |= !print_framing("keyframe v2", keyframes, 2);
+    status |= !print_framing("varint v1", varints, 1);
+    status |= !print_framing("varint v2", varints, 2);
+    status |= !print_framing("batch v1", batches, 1);
+    status |= !print_framing("batch v2", batches, 2);
+    status |= !print_framing("mixed fleet", varints, 0);
+    status |= !print_framing("extremes v1", extremes, 1);
+    status |= !print_framing("extremes v2", extremes, 2);
+  }
+
+  printf("\nencoder statistics, varint, one pass\n\n");
+  status |= !run_stats(samples, ENCODE_VARINT, true);
+  status |= !run_stats(samples, 0, false);
+  return status;
+}
@@ -0,0 +1,144 @@
+/**
+ *  @file dataset.h
+ *  @brief Loader that turns the base station CSV captures back into the
+ *  fixed point SensorData samples the node produced
+ *  */
+
+#ifndef BENCH_DATASET_H_
+#define BENCH_DATASET_H_
+
+#include "../subsystems/schema.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#ifndef DATA_DIR
+#define DATA_DIR "../bstation/data"
+#endif
+
+namespace dataset {
+
+typedef std::vector<std::string> Row;
+
+static inline Row split(const std::string &line) {
+  Row row;
+  std::stringstream ss(line);
+  std::string cell;
+  while (std::getline(ss, cell, ',')) {
+    row.push_back(cell);
+  }
+  return row;
+}
+
+static inline int column(const Row &header, const char *name) {
+  for (size_t i = 0; i < header.size(); i++) {
+    if (header[i] == name) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+/* read every data row of a csv file, returns false if the file is missing */
+static inline bool read_csv(const std::string &path, Row &header,
+                            std::vector<Row> &rows) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::string line;
+  if (!std::getline(file, line)) {
+    return false;
+  }
+  header = split(line);
+  while (std::getline(file, line)) {
+    if (!line.empty()) {
+      rows.push_back(split(line));
+    }
+  }
+  return true;
+}
+
+static inline long fixed(const std::string &cell, double scale) {
+  return std::lround(std::stod(cell) * scale);
+}
+
+/* NOTE: the gateway logs the node values after dividing them back to SI
+ * units, so the scales below mirror Sensor::process_bsec_outputs (pressure is
+ * logged in units of 100 kPa with three decimals) */
+static inline bool load(std::vector<SensorData> &samples,
+                        const std::string &dir = DATA_DIR) {
+  Row bsec_header, analog_header;
+  std::vector<Row> bsec_rows, analog_rows;
+  if (!read_csv(dir + "/bsec_data.csv", bsec_header, bsec_rows) ||
+      !read_csv(dir + "/analog_data.csv", analog_header, analog_rows)) {
+    return false;
+  }
+
+  const int temperature = column(bsec_header, "temperature");
+  const int humidity = column(bsec_header, "humidity");
+  const int pressure = column(bsec_header, "pressure");
+  const int iaq = column(bsec_header, "iaq");
+  const int iaq_accuracy = column(bsec_header, "iaq_accuracy");
+  const int static_iaq = column(bsec_header, "static_iaq");
+  const int co2 = column(bsec_header, "co2_ppm");
+  const int voc = column(bsec_header, "voc_ppm");
+  const int gas = column(bsec_header, "gas_percent");
+  const int stabilized = column(bsec_header, "stabilized");
+  const int run_in = column(bsec_header, "run_in_complete");
+  const int mq135 = column(analog_header, "mq135_raw");
+  const int anemo = column(analog_header, "anemometer_raw");
+
+  const size_t n = std::min(bsec_rows.size(), analog_rows.size());
+  samples.reserve(samples.size() + n);
+  for (size_t i = 0; i < n; i++) {
+    const Row &b = bsec_rows[i];
+    const Row &a = analog_rows[i];
+
+    SensorData d;
+    memset(&d, 0, sizeof(d));
+    d.bsec_data.temperature = (int16_t)fixed(b[temperature], 100);
+    d.bsec_data.humidity = (uint16_t)fixed(b[humidity], 100);
+    d.bsec_data.pressure = (uint32_t)fixed(b[pressure], 100000);
+    d.bsec_data.iaq = (uint16_t)fixed(b[iaq], 1);
+    d.bsec_data.iaqAccuracy = (uint8_t)fixed(b[iaq_accuracy], 1);
+    d.bsec_data.staticIaq = (uint16_t)fixed(b[static_iaq], 1);
+    d.bsec_data.co2Equivalent = (uint16_t)fixed(b[co2], 1);
+    d.bsec_data.breathVoc = (uint16_t)fixed(b[voc], 100);
+    d.bsec_data.gasPercentage = (uint8_t)fixed(b[gas], 1);
+    d.bsec_data.stabStatus = b[stabilized] == "True";
+    d.bsec_data.runInStatus = b[run_in] == "True";
+    d.mq135_data.analog = (uint16_t)fixed(a[mq135], 1);
+    d.anemo_data = (uint16_t)fixed(a[anemo], 1);
+    samples.push_back(d);
+  }
+  return !samples.empty();
+}
+
+/* compare only the fields that travel over the air (mq135 digital and the
+ * sensors outside SENSOR_PROFILE do not) */
+static inline bool same(const SensorData &a, const SensorData &b) {
+  return schema::same(a, b, schema::Fields{});
+}
+
+/* wall clock helper for the ns/op figures */
+class Stopwatch {
+  std::chrono::steady_clock::time_point start;
+
+public:
+  Stopwatch() : start(std::chrono::steady_clock::now()) {}
+  double ns() const {
+    return std::chrono::duration<double, std::nano>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+};
+
+} // namespace dataset
+
+#endif // BENCH_DATASET_H_
@@ -0,0 +1,277 @@
+/**
+ *  @file deframe_bench.cpp
+ *  @brief The gateway side of the framing (Deframer, subsystems/framing.h)
+ *  over a multi megabyte stream of node frames: throughput for several chunk
+ *  sizes, then what injected bit errors cost, lost frames, false accepts and
+ *  the resynchronization latency
+ *  */
+
+#include "../subsystems/decoder.h"
+#include "../subsystems/encoder.h"
+#include "../subsystems/framing.h"
+#include "dataset.h"
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+
+#ifndef BENCH_STREAM_BYTES
+#define BENCH_STREAM_BYTES (8u << 20)
+#endif
+
+#ifndef BENCH_PASSES
+#define BENCH_PASSES 5
+#endif
+
+/* the frames of the node back to back, as a gateway would log them */
+struct Stream {
+  std::vector<uint8_t> bytes;
+  std::vector<uint32_t> start; // of frame k
+  std::vector<uint32_t> end;   // one past frame k
+};
+
+static Stream build(const std::vector<EncoderResult> &results) {
+  Framing framing;
+  framing.setup();
+  Stream s;
+  s.bytes.reserve(BENCH_STREAM_BYTES + MAX_FRAME_LEN);
+  for (size_t k = 0; s.bytes.size() < BENCH_STREAM_BYTES; k++) {
+    EncoderResult result = results[k % results.size()];
+    FrameBuffer_t frame;
+    uint16_t crc;
+    const uint16_t len = framing.frame(result, (uint16_t)k, frame, crc).len;
+    s.start.push_back((uint32_t)s.bytes.size());
+    s.bytes.insert(s.bytes.end(), frame, frame + len);
+    s.end.push_back((uint32_t)s.bytes.size());
+  }
+  return s;
+}
+
+/* the stream in the chunk sizes a reader gets it in (cycled), none: one
+ * byte at a time through push() */
+static size_t deframe(Deframer &deframer, const std::vector<uint8_t> &bytes,
+                      const std::vector<uint16_t> &chunks, uint64_t &sink) {
+  size_t frames = 0;
+  if (chunks.empty()) {
+    for (uint8_t b : bytes) {
+      if (deframer.push(b) == DEFRAME_FRAME) {
+        sink += deframer.frame().header.sequence;
+        frames++;
+      }
+    }
+    return frames;
+  }
+  size_t pos = 0;
+  for (size_t c = 0; pos < bytes.size(); c++) {
+    const uint8_t *p = bytes.data() + pos;
+    size_t left =
+        std::min((size_t)chunks[c % chunks.size()], bytes.size() - pos);
+    pos += left;
+    while (left > 0) {
+      uint8_t status;
+      const size_t took = deframer.feed(p, left, status);
+      p += took;
+      left -= took;
+      if (status == DEFRAME_FRAME) {
+        sink += deframer.frame().header.sequence;
+        frames++;
+      }
+    }
+  }
+  return frames;
+}
+
+struct Delivery {
+  std::vector<uint8_t> delivered; // frame k came out intact
+  size_t intact;
+  size_t false_accepts; // passed the crc, but not a frame that was sent
+  DeframerStats stats;
+};
+
+/* untimed pass that checks every frame handed out against the one sent
+ * ending at the same stream offset */
+static Delivery verify(const Stream &s, const std::vector<uint8_t> &bytes,
+                       const std::vector<EncoderResult> &results) {
+  Delivery d = {std::vector<uint8_t>(s.end.size()), 0, 0, {}};
+  Deframer deframer;
+  deframer.begin();
+  for (size_t pos = 0; pos < bytes.size(); pos++) {
+    if (deframer.push(bytes[pos]) != DEFRAME_FRAME) {
+      continue;
+    }
+    const DeframedFrame &f = deframer.frame();
+    const auto at = std::lower_bound(s.end.begin(), s.end.end(), pos + 1);
+    const size_t k = at - s.end.begin();
+    const EncoderResult &sent = results[k % results.size()];
+    const uint16_t mask = (uint16_t)((1u << sequence_bits(f.header)) - 1);
+    if (at != s.end.end() && *at == pos + 1 &&
+        f.header.sequence == (k & mask) && f.header.flags == sent.flag &&
+        f.header.len == sent.len &&
+        memcmp(f.payload, sent.data, sent.len) == 0) {
+      d.delivered[k] = 1;
+      d.intact++;
+    } else {
+      d.false_accepts++;
+    }
+  }
+  d.stats = deframer.stats();
+  return d;
+}
+
+/* the first lap of frames handed on to the Decoder, as a gateway does */
+static size_t decode_lap(const std::vector<uint8_t> &bytes,
+                         const std::vector<SensorData> &samples) {
+  Deframer deframer;
+  deframer.begin();
+  Decoder decoder;
+  decoder.setup();
+  size_t mismatches = samples.size();
+  for (size_t pos = 0, k = 0; k < samples.size() && pos < bytes.size(); pos++) {
+    if (deframer.push(bytes[pos]) != DEFRAME_FRAME) {
+      continue;
+    }
+    const DeframedFrame &f = deframer.frame();
+    EncoderResult result;
+    result.status = ENCODER_OK;
+    result.flag = f.header.flags;
+    result.len = f.header.len;
+    memcpy(result.data, f.payload, f.header.len);
+    const DecoderResult r =
+        decoder.decode(result, f.header.sequence, sequence_bits(f.header));
+    mismatches -= r.status == DECODER_OK && dataset::same(r.data, samples[k]);
+    k++;
+  }
+  return mismatches;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SensorData> samples;
+  const char *dir = argc > 1 ? argv[1] : DATA_DIR;
+  if (!dataset::load(samples, dir)) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+
+  std::vector<EncoderResult> results;
+  Encoder encoder;
+  encoder.setup();
+  for (const SensorData &sample : samples) {
+    results.push_back(encoder.encode(sample, ENCODE_VARINT));
+  }
+  const Stream s = build(results);
+
+  printf("deframer benchmark: %s, v%d headers, %zu varint frames in %.1f "
+         "MB\n\n",
+         FRAMING_COBS ? "cobs" : "escaped", FRAME_VERSION, s.end.size(),
+         s.bytes.size() / 1e6);
+  int status = 0;
+
+  /* clean stream, how the reader gets it */
+  std::mt19937 rng(1);
+  std::vector<uint16_t> lora(4096), serial(4096);
+  for (size_t i = 0; i < lora.size(); i++) {
+    lora[i] = (uint16_t)(1 + rng() % 255); // NOTE: a LoRa packet, 255 at most
+    serial[i] = (uint16_t)(1 + rng() % 64); // NOTE: a UART FIFO
+  }
+  const struct {
+    const char *name;
+    std::vector<uint16_t> chunks;
+  } readers[] = {{"byte", {}},
+                 {"uart <= 64 B", serial},
+                 {"lora <= 255 B", lora},
+                 {"whole stream", {(uint16_t)0xFFFF}}};
+  printf("%-16s %10s %10s %10s\n", "chunks", "MB/s", "ns/frame", "frames");
+  uint64_t sink = 0;
+  for (const auto &reader : readers) {
+    size_t frames = 0;
+    dataset::Stopwatch timer;
+    for (int pass = 0; pass < BENCH_PASSES; pass++) {
+      Deframer deframer;
+      deframer.begin();
+      frames = deframe(deframer, s.bytes, reader.chunks, sink);
+    }
+    const double ns = timer.ns() / BENCH_PASSES;
+    printf("%-16s %10.1f %10.1f %10zu/%zu\n", reader.name,
+           s.bytes.size() * 1e3 / ns, ns / frames, frames, s.end.size());
+    status |= frames != s.end.size();
+  }
+  const Delivery clean = verify(s, s.bytes, results);
+  const size_t mismatches = decode_lap(s.bytes, samples);
+  printf("\nclean stream: %zu/%zu intact, %zu false accepts, first lap "
+         "through the Decoder %zu/%zu\n",
+         clean.intact, s.end.size(), clean.false_accepts,
+         samples.size() - mismatches, samples.size());
+  status |= clean.intact != s.end.size() || clean.false_accepts != 0 ||
+            clean.stats.dropped != 0 || mismatches != 0;
+
+  /* NOTE: bit errors at random positions, geometric gaps at the given rate.
+   * A frame with an error in it is lost, any other frame lost is what the
+   * error cost the resynchronization. Its latency is counted from the end
+   * of the frame hit to the start of the next frame handed out, a second
+   * hit frame in between spoils the figure so those are left out */
+  printf("\nbit errors, lora chunks\n\n");
+  printf("%-8s %8s %8s %8s %8s %8s %8s %8s %8s %10s %10s\n", "ber",
+         "MB/s", "errors", "hit", "lost", "collat.", "f.acc.", "crc",
+         "framing", "resync avg", "resync max");
+  static const double rates[] = {1e-6, 1e-5, 1e-4, 1e-3};
+  for (double ber : rates) {
+    std::vector<uint8_t> bytes = s.bytes;
+    std::vector<uint8_t> hit(s.end.size());
+    std::vector<size_t> firsts; // frames whose first error it was
+    std::geometric_distribution<uint64_t> gap(ber);
+    size_t errors = 0;
+    for (uint64_t bit = gap(rng); bit < 8 * (uint64_t)bytes.size();
+         bit += 1 + gap(rng)) {
+      bytes[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+      const size_t k = std::upper_bound(s.start.begin(), s.start.end(),
+                                        (uint32_t)(bit / 8)) -
+                       s.start.begin() - 1;
+      if (!hit[k]) {
+        firsts.push_back(k);
+      }
+      hit[k] = 1;
+      errors++;
+    }
+
+    dataset::Stopwatch timer;
+    for (int pass = 0; pass < BENCH_PASSES; pass++) {
+      Deframer deframer;
+      deframer.begin();
+      deframe(deframer, bytes, lora, sink);
+    }
+    const double ns = timer.ns() / BENCH_PASSES;
+
+    const Delivery d = verify(s, bytes, results);
+    size_t lost = 0, collateral = 0;
+    for (size_t k = 0; k < s.end.size(); k++) {
+      lost += !d.delivered[k];
+      collateral += !d.delivered[k] && !hit[k];
+    }
+    uint64_t resync = 0;
+    uint32_t worst = 0;
+    size_t counted = 0;
+    for (size_t k : firsts) {
+      size_t j = k + 1;
+      bool clean_gap = true;
+      for (; j < s.end.size() && !d.delivered[j]; j++) {
+        clean_gap &= !hit[j];
+      }
+      if (j == s.end.size() || !clean_gap) {
+        continue;
+      }
+      const uint32_t latency = s.start[j] - s.end[k];
+      resync += latency;
+      worst = std::max(worst, latency);
+      counted++;
+    }
+    printf("%-8.0e %8.1f %8zu %8zu %8zu %8zu %8zu %8u %8u %8.2f B %8u B\n",
+           ber, bytes.size() * 1e3 / ns, errors, firsts.size(), lost,
+           collateral, d.false_accepts, d.stats.crc_errors,
+           d.stats.framing_errors,
+           counted ? resync / (double)counted : 0.0, worst);
+  }
+
+  if (sink == 1) {
+    printf("\n"); // NOTE: keeps the loops from being dropped
+  }
+  return status;
+}
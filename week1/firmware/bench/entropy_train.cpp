@@ -0,0 +1,276 @@
+/**
+ *  @file entropy_train.cpp
+ *  @brief Trains the static Huffman tables of the entropy stage from the
+ *  base station captures, writes subsystems/entropy_tables.h and reports the
+ *  bits per sample before (varint mode) and after (entropy mode)
+ *
+ *  usage: entropy_train [data dir] [output header]
+ *  */
+
+#include "../subsystems/schema.h"
+#include "dataset.h"
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <stdio.h>
+
+/* must match subsystems/entropy.h */
+#define MAX_CODE_LEN 15
+#define MASK_SYMBOLS 16
+#define RESIDUAL_SYMBOLS 32
+
+struct Node {
+  uint64_t weight;
+  int index; // leaf: symbol, otherwise -1 - position in `children`
+};
+
+struct Heavier {
+  bool operator()(const Node &a, const Node &b) const {
+    return a.weight != b.weight ? a.weight > b.weight : a.index > b.index;
+  }
+};
+
+/* plain Huffman code lengths, symbols without weight get no code */
+static std::vector<uint8_t> huffman(const std::vector<uint64_t> &weights) {
+  std::priority_queue<Node, std::vector<Node>, Heavier> heap;
+  std::vector<std::pair<int, int>> children;
+  for (size_t s = 0; s < weights.size(); s++) {
+    if (weights[s]) {
+      heap.push({weights[s], (int)s});
+    }
+  }
+  while (heap.size() > 1) {
+    Node a = heap.top();
+    heap.pop();
+    Node b = heap.top();
+    heap.pop();
+    children.push_back({a.index, b.index});
+    heap.push({a.weight + b.weight, -(int)children.size()});
+  }
+
+  std::vector<uint8_t> lengths(weights.size(), 0);
+  std::vector<std::pair<int, uint8_t>> stack = {{heap.top().index, 0}};
+  while (!stack.empty()) {
+    std::pair<int, uint8_t> top = stack.back();
+    stack.pop_back();
+    if (top.first >= 0) {
+      lengths[top.first] = std::max<uint8_t>(top.second, 1);
+    } else {
+      const std::pair<int, int> &c = children[-top.first - 1];
+      stack.push_back({c.first, (uint8_t)(top.second + 1)});
+      stack.push_back({c.second, (uint8_t)(top.second + 1)});
+    }
+  }
+  return lengths;
+}
+
+/* NOTE: +1 smoothing keeps a code for the first `symbols` symbols even when
+ * the captures never showed them, the weights are flattened until the
+ * longest code fits MAX_CODE_LEN */
+static std::vector<uint8_t> limited(std::vector<uint64_t> weights,
+                                    size_t symbols) {
+  for (size_t s = 0; s < symbols; s++) {
+    weights[s] += 1;
+  }
+  for (;;) {
+    std::vector<uint8_t> lengths = huffman(weights);
+    if (*std::max_element(lengths.begin(), lengths.end()) <= MAX_CODE_LEN) {
+      return lengths;
+    }
+    for (uint64_t &w : weights) {
+      w = (w + 1) / 2;
+    }
+  }
+}
+
+static uint8_t bit_length(uint32_t v) {
+  return (uint8_t)(32 - __builtin_clz(v));
+}
+
+struct Stats {
+  std::map<uint16_t, uint64_t> masks;
+  uint64_t residuals[FIELD_COUNT][RESIDUAL_SYMBOLS] = {};
+  uint64_t varint_bytes = 0;
+  size_t samples = 0;
+};
+
+/* walks the captures the way the encoder does in varint mode: one keyframe
+ * and then deltas with the default predictors */
+static void collect(const std::vector<SensorData> &samples, Stats &stats) {
+  const schema::PredictorMap map = {};
+  uint8_t payload[schema::MAX_PAYLOAD_LEN];
+  for (size_t i = 1; i < samples.size(); i++) {
+    const SensorData &prev2 = samples[i > 1 ? i - 2 : 0];
+    uint32_t values[FIELD_COUNT] = {};
+    schema::residual_values(prev2, samples[i - 1], samples[i], map, values,
+                            schema::Fields{});
+
+    uint16_t mask = 0;
+    for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+      if (values[f] == 0) {
+        continue;
+      }
+      mask |= (uint16_t)(1 << f);
+      stats.residuals[f][bit_length(values[f]) - 1]++;
+    }
+    stats.masks[mask]++;
+    stats.varint_bytes += schema::encode_varints(
+        prev2, samples[i - 1], samples[i], payload, map, schema::Fields{});
+    stats.samples++;
+  }
+}
+
+static const uint8_t FIELD_WIDTH[] = {
+#define X(id, member, ...) sizeof(((SensorData *)0)->member),
+    SENSOR_FIELDS(X)
+#undef X
+};
+
+static const char *FIELD_NAME[] = {
+#define X(id, ...) #id,
+    SENSOR_FIELDS(X)
+#undef X
+};
+
+int main(int argc, char *argv[]) {
+  const char *dir = argc > 1 ? argv[1] : DATA_DIR;
+  const char *out_path = argc > 2 ? argv[2] : "subsystems/entropy_tables.h";
+
+  std::vector<SensorData> samples;
+  if (!dataset::load(samples, dir)) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+
+  Stats stats;
+  collect(samples, stats);
+
+  /* the most frequent masks get a symbol, the rest share the escape */
+  std::vector<std::pair<uint64_t, uint16_t>> masks;
+  for (const auto &m : stats.masks) {
+    masks.push_back({m.second, m.first});
+  }
+  std::sort(masks.begin(), masks.end(),
+            [](const std::pair<uint64_t, uint16_t> &a,
+               const std::pair<uint64_t, uint16_t> &b) {
+              return a.first != b.first ? a.first > b.first
+                                        : a.second < b.second;
+            });
+
+  std::vector<uint16_t> mask_values;
+  std::vector<uint64_t> mask_weights(MASK_SYMBOLS, 0);
+  uint64_t escaped_masks = 0;
+  for (size_t i = 0; i < masks.size(); i++) {
+    if (i < MASK_SYMBOLS - 1) {
+      mask_values.push_back(masks[i].second);
+      mask_weights[i] = masks[i].first;
+    } else {
+      mask_weights[MASK_SYMBOLS - 1] += masks[i].first;
+      escaped_masks += masks[i].first;
+    }
+  }
+  // NOTE: the symbols no mask took keep a code but are never sent
+  const std::vector<uint8_t> mask_lengths =
+      limited(mask_weights, MASK_SYMBOLS);
+
+  std::vector<std::vector<uint8_t>> residual_lengths;
+  for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+    residual_lengths.push_back(
+        limited(std::vector<uint64_t>(stats.residuals[f],
+                                      stats.residuals[f] + RESIDUAL_SYMBOLS),
+                8 * FIELD_WIDTH[f]));
+  }
+
+  /* size with the trained codes, payloads are padded to whole bytes */
+  double bits = 0;
+  uint64_t bytes = 0;
+  {
+    const schema::PredictorMap map = {};
+    for (size_t i = 1; i < samples.size(); i++) {
+      const SensorData &prev2 = samples[i > 1 ? i - 2 : 0];
+      uint32_t values[FIELD_COUNT] = {};
+      schema::residual_values(prev2, samples[i - 1], samples[i], map, values,
+                              schema::Fields{});
+      uint16_t mask = 0;
+      uint32_t n = 0;
+      for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+        if (values[f] == 0) {
+          continue;
+        }
+        mask |= (uint16_t)(1 << f);
+        const uint8_t k = bit_length(values[f]);
+        n += residual_lengths[f][k - 1] + k - 1;
+      }
+      size_t m = std::find(mask_values.begin(), mask_values.end(), mask) -
+                 mask_values.begin();
+      m = m < mask_values.size() ? m : MASK_SYMBOLS - 1;
+      n += mask_lengths[m];
+      if (m == MASK_SYMBOLS - 1) {
+        n += FIELD_COUNT;
+      }
+      bits += n;
+      bytes += (n + 7) / 8;
+    }
+  }
+
+  FILE *out = fopen(out_path, "w");
+  if (!out) {
+    fprintf(stderr, "ERROR: could not write %s\n", out_path);
+    return 2;
+  }
+  fprintf(out, "/**\n"
+               " *  @file entropy_tables.h\n"
+               " *  @brief Huffman code lengths of the entropy stage, generated "
+               "by\n"
+               " *  bench/entropy_train from %zu samples (make tables), do not "
+               "edit\n"
+               " *  */\n\n"
+               "#ifndef ENTROPY_TABLES_H_\n"
+               "#define ENTROPY_TABLES_H_\n\n"
+               "namespace entropy {\n\n",
+          samples.size());
+
+  fprintf(out, "/* changed field masks by frequency, the escape covers the "
+               "rest. The symbols\n"
+               " * between the last trained mask and the escape are never "
+               "sent */\n");
+  fprintf(out, "constexpr uint8_t MASK_TRAINED = %zu;\n\n",
+          mask_values.size());
+  fprintf(out, "constexpr schema::changed_t MASKS[MASK_TRAINED] = {");
+  for (size_t i = 0; i < mask_values.size(); i++) {
+    fprintf(out, "%s0x%04X,", i % 8 ? " " : "\n    ", mask_values[i]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "constexpr uint8_t MASK_LENGTHS[MASK_SYMBOLS] = {");
+  for (size_t s = 0; s < mask_lengths.size(); s++) {
+    fprintf(out, "%s%d,", s ? " " : "\n    ", mask_lengths[s]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "/* per field, by bit length of the residual (0: no code) */\n");
+  fprintf(out, "constexpr uint8_t RESIDUAL_LENGTHS[FIELD_COUNT]"
+               "[RESIDUAL_SYMBOLS] = {\n");
+  for (uint8_t f = 0; f < FIELD_COUNT; f++) {
+    fprintf(out, "    // %s\n    {", FIELD_NAME[f]);
+    for (size_t s = 0; s < residual_lengths[f].size(); s++) {
+      fprintf(out, "%s%d%s", s == 16 ? "\n     " : "", residual_lengths[f][s],
+              s + 1 < residual_lengths[f].size() ? "," : "");
+      if (s + 1 < residual_lengths[f].size() && s != 15) {
+        fprintf(out, " ");
+      }
+    }
+    fprintf(out, "},\n");
+  }
+  fprintf(out, "};\n\n} // namespace entropy\n\n#endif // ENTROPY_TABLES_H_\n");
+  fclose(out);
+
+  const double n = (double)stats.samples;
+  printf("trained on %zu delta samples, %zu distinct masks (%llu escaped)\n",
+         stats.samples, stats.masks.size(), (unsigned long long)escaped_masks);
+  printf("varint  : %6.2f bits/sample\n", 8.0 * stats.varint_bytes / n);
+  printf("entropy : %6.2f bits/sample (%.2f padded to bytes)\n", bits / n,
+         8.0 * bytes / n);
+  printf("wrote %s\n", out_path);
+  return 0;
+}
@@ -0,0 +1,274 @@
+/**
+ *  @file fec_bench.cpp
+ *  @brief The Reed-Solomon FEC of the frames (ReedSolomon, subsystems/fec.h):
+ *  encode and decode cost per body size and parity, with an ESP32-S3
+ *  estimate, how many errors it takes, then what it buys on a noisy
+ *  channel, the node frames one per packet through bit errors into the
+ *  Deframer, against the airtime the parity costs
+ *  */
+
+#include "../subsystems/encoder.h"
+#include "../subsystems/framing.h"
+#include "../subsystems/lora.h"
+#include "dataset.h"
+#include <random>
+#include <stdio.h>
+
+static_assert(FEC_PARITY == FEC_MAX_PARITY,
+              "built with every parity available (see the Makefile)");
+
+#ifndef BENCH_TRIALS
+#define BENCH_TRIALS 2000
+#endif
+
+/* NOTE: the model of an ESP32-S3 core (240 MHz): a step of the field
+ * arithmetic, two table loads, an add and a xor, at 6 cycles with the
+ * tables in internal SRAM. Encoding takes a step per data byte and parity
+ * byte, checking a clean block one per byte and parity byte too */
+#define S3_MHZ 240
+#define S3_CYCLES_PER_STEP 6
+
+static double s3_us(uint64_t steps) {
+  return steps * S3_CYCLES_PER_STEP / (double)S3_MHZ;
+}
+
+struct CodecReport {
+  double encode_ns;
+  double clean_ns;   // decode, no error
+  double errors_ns;  // decode, parity / 2 errors per block
+  size_t corrected;  // trials with parity / 2 errors per block fixed
+  size_t detected;   // trials with one error too many turned down
+  size_t miscorrect; // trials with one error too many "fixed", the crc is
+                     // left to catch those
+};
+
+/* `count` random bytes of every block of a codeword of `len` data bytes
+ * changed to a different value (see ReedSolomon::encode() for the
+ * interleaving) */
+static void corrupt(uint8_t *data, uint16_t len, uint16_t total,
+                    uint16_t blocks, uint8_t count, std::mt19937 &rng) {
+  for (uint16_t b = 0; b < blocks; b++) {
+    std::vector<uint16_t> at;
+    for (uint16_t i = 0; i < total; i++) {
+      if ((i < len ? i : i - len) % blocks == b) {
+        at.push_back(i);
+      }
+    }
+    for (uint8_t i = 0; i < count; i++) {
+      std::swap(at[i], at[i + rng() % (at.size() - i)]);
+      data[at[i]] ^= (uint8_t)(1 + rng() % 255);
+    }
+  }
+}
+
+static CodecReport run_codec(uint16_t len, uint8_t parity, std::mt19937 &rng) {
+  ReedSolomon rs;
+  rs.begin(parity);
+  const uint16_t total = len + rs.overhead(len);
+  const uint16_t blocks = rs.overhead(len) / parity;
+  std::vector<uint8_t> sent(total), data(total);
+  CodecReport r = {0, 0, 0, 0, 0, 0};
+  uint64_t sink = 0;
+  uint16_t corrected;
+
+  for (uint16_t i = 0; i < len; i++) {
+    sent[i] = (uint8_t)rng();
+  }
+  dataset::Stopwatch timer;
+  for (int i = 0; i < BENCH_TRIALS; i++) {
+    sent[i % len] ^= (uint8_t)i;
+    sink += rs.encode(sent.data(), len) + sent[len];
+  }
+  r.encode_ns = timer.ns() / BENCH_TRIALS;
+
+  timer = dataset::Stopwatch();
+  for (int i = 0; i < BENCH_TRIALS; i++) {
+    sink += rs.decode(sent.data(), total, corrected);
+  }
+  r.clean_ns = timer.ns() / BENCH_TRIALS;
+
+  double ns = 0;
+  for (int i = 0; i < BENCH_TRIALS; i++) {
+    data = sent;
+    corrupt(data.data(), len, total, blocks, parity / 2, rng);
+    timer = dataset::Stopwatch();
+    const uint16_t out = rs.decode(data.data(), total, corrected);
+    ns += timer.ns();
+    r.corrected += out == len && data == sent;
+
+    // NOTE: past what the code takes it must say so, not fix the wrong bytes
+    data = sent;
+    corrupt(data.data(), len, total, blocks, parity / 2 + 1, rng);
+    if (rs.decode(data.data(), total, corrected) == 0) {
+      r.detected++;
+    } else {
+      r.miscorrect++;
+    }
+  }
+  r.errors_ns = ns / BENCH_TRIALS;
+  if (sink == 1) {
+    printf("\n"); // NOTE: keeps the loops from being dropped
+  }
+  return r;
+}
+
+struct ChannelReport {
+  uint64_t bytes;
+  uint64_t airtime_us;
+  size_t intact;
+  size_t false_accepts;
+  DeframerStats stats;
+  double deframe_ns; // per frame, clean
+};
+
+/* every frame in a packet of its own, bits flipped at `ber` (none for 0),
+ * then through a Deframer as the Splitter does */
+static ChannelReport run_channel(const std::vector<EncoderResult> &results,
+                                 uint8_t parity, double ber, int laps,
+                                 std::mt19937 &rng) {
+  Framing framing;
+  framing.setup();
+  framing.set_fec(parity);
+  Deframer deframer;
+  deframer.begin(parity);
+  ChannelReport r = {0, 0, 0, 0, {}, 0};
+  std::bernoulli_distribution flip(ber);
+  double ns = 0;
+  for (int lap = 0; lap < laps; lap++) {
+    for (size_t k = 0; k < results.size(); k++) {
+      const uint16_t sequence = (uint16_t)(lap * results.size() + k);
+      EncoderResult result = results[k];
+      FrameBuffer_t frame;
+      uint16_t crc;
+      const uint16_t len = framing.frame(result, sequence, frame, crc).len;
+      r.bytes += len;
+      r.airtime_us += lora::airtime_us(len);
+      for (uint16_t i = 0; ber > 0 && i < len; i++) {
+        for (uint8_t bit = 0; bit < 8; bit++) {
+          frame[i] ^= (uint8_t)(flip(rng) << bit);
+        }
+      }
+
+      dataset::Stopwatch timer;
+      uint8_t status;
+      deframer.feed(frame, len, status);
+      ns += timer.ns();
+#if FRAMING_COBS
+      if (status != DEFRAME_FRAME) {
+        deframer.push(COBS_DELIMITER); // NOTE: the end of the packet
+      }
+#endif
+      if (status != DEFRAME_FRAME) {
+        continue;
+      }
+      /* NOTE: an escaped frame whose end got lost (an ESC in front of the
+       * next SOF) may come out with the next packet, repaired */
+      const DeframedFrame &f = deframer.frame();
+      const uint16_t mask = (uint16_t)((1u << sequence_bits(f.header)) - 1);
+      const uint16_t back = (sequence - f.header.sequence) & mask;
+      const EncoderResult &sent =
+          results[(k + results.size() - back) % results.size()];
+      if (back <= 1 && f.header.flags == sent.flag &&
+          f.header.len == sent.len &&
+          memcmp(f.payload, sent.data, sent.len) == 0) {
+        r.intact++;
+      } else {
+        r.false_accepts++;
+      }
+    }
+  }
+  r.stats = deframer.stats();
+  r.deframe_ns = ns / (laps * results.size());
+  return r;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SensorData> samples;
+  const char *dir = argc > 1 ? argv[1] : DATA_DIR;
+  if (!dataset::load(samples, dir)) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+  std::vector<EncoderResult> results;
+  Encoder encoder;
+  encoder.setup();
+  for (const SensorData &sample : samples) {
+    results.push_back(encoder.encode(sample, ENCODE_VARINT));
+  }
+
+  printf("fec benchmark: reed-solomon over GF(256), %s framing v%d, "
+         "SF%d %u kHz\n",
+         FRAMING_COBS ? "cobs" : "escaped", FRAME_VERSION,
+         LORA_SPREADING_FACTOR,
+         (unsigned)(lora::bandwidth_hz(LORA_BANDWIDTH) / 1000));
+  int status = 0;
+  std::mt19937 rng(1);
+
+  /* NOTE: bodies of a varint frame, a batch, a full packet and the
+   * longest frame, a full batch */
+  printf("\ncodec, %d trials each, S3: estimate at %d MHz\n\n", BENCH_TRIALS,
+         S3_MHZ);
+  printf("%-6s %6s %6s %9s %9s %9s %9s %9s %11s %9s\n", "body", "parity",
+         "+bytes", "enc ns", "dec ns", "fix ns", "S3 enc", "S3 dec",
+         "fixed", "t+1 miss");
+  static const uint16_t lengths[] = {
+      10, 58, 200, FRAME_BODY_LEN(MAX_FRAME_PAYLOAD_LEN)};
+  static const uint8_t parities[] = {2, 4, 8, 16, 32};
+  for (uint16_t len : lengths) {
+    for (uint8_t parity : parities) {
+      const CodecReport r = run_codec(len, parity, rng);
+      const uint16_t extra = FEC_LEN(parity, len);
+      printf("%-6u %6u %6u %9.0f %9.0f %9.0f %7.1f us %7.1f us %6zu/%d "
+             "%9zu\n",
+             len, parity, extra, r.encode_ns, r.clean_ns, r.errors_ns,
+             s3_us((uint64_t)len * parity), s3_us((uint64_t)(len + extra) *
+                                                  parity),
+             r.corrected, BENCH_TRIALS, r.miscorrect);
+      status |= r.corrected != BENCH_TRIALS;
+    }
+  }
+
+  /* NOTE: independent bit errors at the given rate over every frame, a
+   * frame counts once it comes out of the Deframer as it was sent. The
+   * radio CRC is off in every row (LORA_CRC_ON), it would drop each frame
+   * hit before the FEC saw it */
+  static const uint8_t channel_parities[] = {0, 2, 4, 8, 16};
+  static const double rates[] = {0, 1e-4, 1e-3, 3e-3, 1e-2};
+  const int laps = 4;
+  printf("\nnoisy channel, %zu varint frames a frame per packet, ms/sample: "
+         "airtime per frame delivered\n",
+         laps * results.size());
+  for (double ber : rates) {
+    printf("\nber %.0e\n\n", ber);
+    printf("%-6s %8s %9s %9s %9s %9s %9s %8s %10s %7s\n", "parity",
+           "bytes/f", "delivered", "repaired", "fec err", "crc err",
+           "framing", "f.acc.", "ms/sample", "gain");
+    double plain = 0;
+    for (uint8_t parity : channel_parities) {
+      const ChannelReport r = run_channel(results, parity, ber, laps, rng);
+      const size_t frames = laps * results.size();
+      const double ms = r.intact ? r.airtime_us / 1e3 / r.intact : 0;
+      if (parity == 0) {
+        plain = ms;
+      }
+      printf("%-6u %8.2f %8.2f%% %9u %9u %9u %9u %8zu %10.3f %6.2fx\n",
+             parity, r.bytes / (double)frames, 100.0 * r.intact / frames,
+             r.stats.repaired, r.stats.fec_errors, r.stats.crc_errors,
+             r.stats.framing_errors, r.false_accepts, ms,
+             ms > 0 ? plain / ms : 0.0);
+      // NOTE: a false accept is down to the crc, which the FEC leaves as
+      // it is, so only a clean channel has to come out whole
+      if (ber == 0) {
+        status |= r.intact != frames || r.false_accepts != 0;
+      }
+    }
+  }
+
+  printf("\ngateway cost, clean frames through the Deframer\n\n");
+  printf("%-6s %10s\n", "parity", "ns/frame");
+  for (uint8_t parity : channel_parities) {
+    const ChannelReport r = run_channel(results, parity, 0, laps, rng);
+    printf("%-6u %10.1f\n", parity, r.deframe_ns);
+  }
+  return status;
+}
@@ -0,0 +1,231 @@
+/**
+ *  @file fleet_bench.cpp
+ *  @brief A mixed fleet at one gateway. Built with a SENSOR_PROFILE short of
+ *  every sensor it is a node of that variant: the captures go out as
+ *  keyframes, delta, varint and entropy frames and batches, sealed as on
+ *  the air into a file. Built with every sensor it is the gateway: the
+ *  frames of the file go through a Deframer into a DecoderPool, each one
+ *  next to a frame of a node of every sensor, and every sample must come
+ *  back as captured (the fields of a missing sensor as 0)
+ *  */
+
+#include "../subsystems/decoder_pool.h"
+#include "dataset.h"
+#include <stdio.h>
+
+#ifndef BENCH_FRAMES
+#define BENCH_FRAMES 4000 // the node sends
+#endif
+#define BENCH_RUN 16 // frames of one kind in a row
+
+#define BENCH_FILE "bench/fleet_bench.bin"
+
+#define FULL_NODE 0x0100 // device id of the node of every sensor
+
+enum Kind : uint8_t { KEYFRAME, DELTA, VARINT, ENTROPY, BATCH, KINDS };
+
+static const char *const KIND_NAMES[KINDS] = {"keyframe", "delta", "varint",
+                                              "entropy", "batch"};
+static const uint8_t KIND_FLAGS[KINDS] = {ENCODE_NO_DELTA, 0, ENCODE_VARINT,
+                                          ENCODE_ENTROPY, 0};
+
+static Kind kind_of(flag_t flags) {
+  if (flags & FLAG_BATCH) {
+    return BATCH;
+  }
+  if (flags & FLAG_KEYFRAME) {
+    return KEYFRAME;
+  }
+  return flags & FLAG_ENTROPY  ? ENTROPY
+         : flags & FLAG_VARINT ? VARINT
+                               : DELTA;
+}
+
+/* node side, the frames back to back as the radio hears them */
+static int send(const std::vector<SensorData> &samples, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "ERROR: could not write %s\n", path);
+    return 2;
+  }
+  Encoder encoder;
+  encoder.setup();
+  Framing framing;
+  framing.setup();
+  FrameBuffer_t buffer;
+  size_t bytes = 0, sample = 0;
+  uint16_t sequence = 0;
+  for (; sequence < BENCH_FRAMES &&
+         sample + BATCH_MAX_SAMPLES <= samples.size();
+       sequence++) {
+    const Kind kind = (Kind)(sequence / BENCH_RUN % KINDS);
+    uint16_t crc;
+    FrameHeader header;
+    if (kind == BATCH) {
+      const EncoderBatch batch =
+          encoder.encode_batch(&samples[sample], BATCH_MAX_SAMPLES,
+                               (uint32_t)(sample * 1000), 1000);
+      sample += batch.count;
+      header = framing.frame(batch, sequence, buffer, crc);
+    } else {
+      const EncoderResult result =
+          encoder.encode(samples[sample++], KIND_FLAGS[kind]);
+      header = framing.frame(result, sequence, buffer, crc);
+    }
+    bytes += fwrite(buffer, 1, header.len, file);
+  }
+  fclose(file);
+  printf("fleet benchmark, node of sensors 0x%x: %u frames of %zu samples, "
+         "%zu B on the air\n",
+         (unsigned)(SENSOR_PROFILE), (unsigned)sequence, sample, bytes);
+  return 0;
+}
+
+struct Node {
+  size_t sample; // the next frame starts with
+  uint32_t frames[KINDS];
+  uint32_t decoded[KINDS];
+  uint32_t wrong; // samples decoded other than captured
+};
+
+/* the samples of a decoded frame against the captures, the fields of the
+ * sensors the node lacks as 0 */
+static void check(Node &node, const DecoderState &state,
+                  const SensorData *data, uint8_t count,
+                  const std::vector<SensorData> &samples) {
+  for (uint8_t i = 0; i < count; i++) {
+    SensorData expected;
+    memset(&expected, 0, sizeof(expected));
+    schema::hold_sensors(expected, samples[node.sample + i], state.sensors,
+                         schema::Fields{});
+    node.wrong += !dataset::same(data[i], expected);
+  }
+}
+
+/* a frame of `kind` from the node of every sensor, straight to the pool */
+template <uint16_t N>
+static void send_full(DecoderPool<N> &pool, Encoder &encoder, Node &node,
+                      Kind kind, uint16_t sequence,
+                      const std::vector<SensorData> &samples) {
+  node.frames[kind]++;
+  if (kind == BATCH) {
+    const EncoderBatch encoded =
+        encoder.encode_batch(&samples[node.sample], BATCH_MAX_SAMPLES,
+                             (uint32_t)(node.sample * 1000), 1000);
+    const DecoderBatch batch =
+        pool.decode_batch(FULL_NODE, encoded, sequence);
+    if (batch.status == DECODER_OK) {
+      node.decoded[kind]++;
+      check(node, *pool.find(FULL_NODE), batch.data, batch.count, samples);
+    }
+    node.sample += encoded.count;
+    return;
+  }
+  const EncoderResult encoded =
+      encoder.encode(samples[node.sample], KIND_FLAGS[kind]);
+  const DecoderResult result = pool.decode(FULL_NODE, encoded, sequence);
+  if (result.status == DECODER_OK) {
+    node.decoded[kind]++;
+    check(node, *pool.find(FULL_NODE), &result.data, 1, samples);
+  }
+  node.sample++;
+}
+
+/* gateway side, the file of the node and a node of every sensor in turn */
+static int receive(const std::vector<SensorData> &samples, const char *path) {
+  std::vector<uint8_t> air;
+  if (FILE *file = fopen(path, "rb")) {
+    uint8_t chunk[4096];
+    for (size_t n; (n = fread(chunk, 1, sizeof(chunk), file)) > 0;) {
+      air.insert(air.end(), chunk, chunk + n);
+    }
+    fclose(file);
+  }
+  if (air.empty()) {
+    fprintf(stderr, "ERROR: no frames in %s, run a node build first\n", path);
+    return 2;
+  }
+
+  static DecoderPool<4> pool;
+  pool.setup();
+  Deframer deframer;
+  deframer.begin();
+  Encoder encoder;
+  encoder.setup();
+  Node node = {}, full = {};
+  deviceid_t device = 0;
+  uint16_t sequence = 0;
+
+  for (size_t at = 0; at < air.size();) {
+    uint8_t status;
+    at += deframer.feed(&air[at], air.size() - at, status);
+    if (status != DEFRAME_FRAME) {
+      continue;
+    }
+    const DeframedFrame &f = deframer.frame();
+    const Kind kind = kind_of(f.header.flags);
+    device = f.header.deviceid;
+    node.frames[kind]++;
+    if (kind == BATCH) {
+      EncoderBatch encoded;
+      encoded.flag = f.header.flags;
+      encoded.len = f.header.len;
+      memcpy(encoded.data, f.payload, f.header.len);
+      const DecoderBatch batch = pool.decode_batch(
+          device, encoded, f.header.sequence, sequence_bits(f.header));
+      if (batch.status == DECODER_OK &&
+          batch.timestamp == node.sample * 1000) {
+        node.decoded[kind]++;
+        check(node, *pool.find(device), batch.data, batch.count, samples);
+        node.sample += batch.count;
+      }
+    } else {
+      EncoderResult encoded;
+      encoded.flag = f.header.flags;
+      encoded.len = f.header.len;
+      memcpy(encoded.data, f.payload, f.header.len);
+      const DecoderResult result = pool.decode(
+          device, encoded, f.header.sequence, sequence_bits(f.header));
+      if (result.status == DECODER_OK) {
+        node.decoded[kind]++;
+        check(node, *pool.find(device), &result.data, 1, samples);
+      }
+      node.sample++;
+    }
+    send_full(pool, encoder, full, kind, sequence++, samples);
+  }
+  remove(path);
+
+  const DecoderState *state = pool.find(device);
+  printf("fleet benchmark, gateway of sensors 0x%x: a node of sensors 0x%x "
+         "from %s and one of every sensor\n\n",
+         (unsigned)(SENSOR_PROFILE), state ? (unsigned)state->sensors : 0,
+         path);
+  printf("%-10s %18s %18s\n", "frames", "node decoded", "full decoded");
+  int status = state == nullptr || state->sensors == (SENSOR_PROFILE);
+  uint32_t frames = 0;
+  for (uint8_t k = 0; k < KINDS; k++) {
+    printf("%-10s %8u of %6u %8u of %6u\n", KIND_NAMES[k], node.decoded[k],
+           node.frames[k], full.decoded[k], full.frames[k]);
+    status |= node.decoded[k] != node.frames[k] ||
+              full.decoded[k] != full.frames[k];
+    frames += node.frames[k];
+  }
+  printf("%-10s %18u %18u\n", "wrong", node.wrong, full.wrong);
+  status |= frames == 0 || node.wrong != 0 || full.wrong != 0 ||
+            deframer.stats().frames != frames;
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SensorData> samples;
+  const char *dir = argc > 2 ? argv[2] : DATA_DIR;
+  if (!dataset::load(samples, dir) || samples.size() <= BATCH_MAX_SAMPLES) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+  const char *path = argc > 1 ? argv[1] : BENCH_FILE;
+  // NOTE: the build of every sensor is the gateway, any other one a node
+  return (SENSOR_PROFILE) == SENSOR_ALL ? receive(samples, path)
+                                        : send(samples, path);
+}
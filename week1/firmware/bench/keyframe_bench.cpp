@@ -0,0 +1,145 @@
+/**
+ *  @file keyframe_bench.cpp
+ *  @brief Throughput of the host batch keyframe decoder (host/keyframes.h)
+ *  against the per frame path, over an archive of full width keyframes
+ *  built from the captures
+ *  */
+
+#include "../host/keyframes.h"
+#include "../subsystems/decoder.h"
+#include "dataset.h"
+#include <stdio.h>
+
+#ifndef BENCH_KEYFRAMES
+#define BENCH_KEYFRAMES (1 << 20)
+#endif
+
+#ifndef BENCH_PASSES
+#define BENCH_PASSES 10
+#endif
+
+/* owns the columns of `count` samples */
+struct Columns {
+#define X(id, member, ...) std::vector<decltype(((SensorData *)0)->member)> id;
+  SENSOR_FIELDS(X)
+#undef X
+
+  explicit Columns(size_t count) {
+#define X(id, ...) id.resize(count);
+    SENSOR_FIELDS(X)
+#undef X
+  }
+
+  keyframes::SensorColumns view() {
+    keyframes::SensorColumns c;
+#define X(id, ...) c.id = id.data();
+    SENSOR_FIELDS(X)
+#undef X
+    return c;
+  }
+
+  bool same(size_t i, const SensorData &d) const {
+#define X(id, member, ...)                                                     \
+  if (schema::present(FIELD_##id) && id[i] != d.member) {                      \
+    return false;                                                              \
+  }
+    SENSOR_FIELDS(X)
+#undef X
+    return true;
+  }
+};
+
+static void report(const char *name, double ns, size_t mismatches) {
+  const double bytes = (double)BENCH_KEYFRAMES * keyframes::STRIDE;
+  printf("%-16s %10.2f %10.2f %10zu\n", name, bytes * BENCH_PASSES / ns,
+         ns / BENCH_PASSES / BENCH_KEYFRAMES, mismatches);
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SensorData> samples;
+  const char *dir = argc > 1 ? argv[1] : DATA_DIR;
+  if (!dataset::load(samples, dir)) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+
+  std::vector<uint8_t> archive((size_t)BENCH_KEYFRAMES * keyframes::STRIDE);
+  for (size_t i = 0; i < BENCH_KEYFRAMES; i++) {
+    schema::encode_keyframe(samples[i % samples.size()],
+                            &archive[i * keyframes::STRIDE], schema::Fields{});
+  }
+
+  printf("keyframe batch decoder: %d keyframes of %zu bytes x %d passes, "
+         "best isa %s\n\n",
+         BENCH_KEYFRAMES, keyframes::STRIDE, BENCH_PASSES,
+         keyframes::isa_name(keyframes::best_isa()));
+  printf("%-16s %10s %10s %10s\n", "decoder", "GB/s", "ns/frame", "mismatch");
+
+  int status = 0;
+
+  /* what reprocessing does today, one EncoderResult per keyframe */
+  {
+    Decoder decoder;
+    decoder.setup();
+    EncoderResult result;
+    result.flag = FLAG_PRESN_PROFILE;
+    result.len = keyframes::STRIDE;
+    std::vector<SensorData> decoded(BENCH_KEYFRAMES);
+    dataset::Stopwatch timer;
+    for (int pass = 0; pass < BENCH_PASSES; pass++) {
+      for (size_t i = 0; i < BENCH_KEYFRAMES; i++) {
+        memcpy(result.data, &archive[i * keyframes::STRIDE], result.len);
+        decoded[i] = decoder.decode(result).data;
+      }
+    }
+    const double ns = timer.ns();
+    size_t mismatches = 0;
+    for (size_t i = 0; i < BENCH_KEYFRAMES; i++) {
+      mismatches += !dataset::same(decoded[i], samples[i % samples.size()]);
+    }
+    report("Decoder", ns, mismatches);
+    status |= mismatches != 0;
+  }
+
+  /* its inner loop alone, the field by field big endian reads */
+  {
+    std::vector<SensorData> decoded(BENCH_KEYFRAMES);
+    dataset::Stopwatch timer;
+    for (int pass = 0; pass < BENCH_PASSES; pass++) {
+      for (size_t i = 0; i < BENCH_KEYFRAMES; i++) {
+        schema::decode_keyframe(decoded[i], &archive[i * keyframes::STRIDE],
+                                schema::Fields{});
+      }
+    }
+    const double ns = timer.ns();
+    size_t mismatches = 0;
+    for (size_t i = 0; i < BENCH_KEYFRAMES; i++) {
+      mismatches += !dataset::same(decoded[i], samples[i % samples.size()]);
+    }
+    report("per frame", ns, mismatches);
+    status |= mismatches != 0;
+  }
+
+  static const keyframes::Isa isas[] = {
+      keyframes::ISA_SCALAR, keyframes::ISA_SSE4, keyframes::ISA_AVX2};
+  for (keyframes::Isa isa : isas) {
+    if (isa > keyframes::best_isa()) {
+      printf("%-16s %10s\n", keyframes::isa_name(isa), "n/a");
+      continue;
+    }
+    Columns columns(BENCH_KEYFRAMES);
+    keyframes::SensorColumns view = columns.view();
+    dataset::Stopwatch timer;
+    for (int pass = 0; pass < BENCH_PASSES; pass++) {
+      keyframes::decode(archive.data(), BENCH_KEYFRAMES, view, isa);
+    }
+    const double ns = timer.ns();
+    size_t mismatches = 0;
+    for (size_t i = 0; i < BENCH_KEYFRAMES; i++) {
+      mismatches += !columns.same(i, samples[i % samples.size()]);
+    }
+    report(keyframes::isa_name(isa), ns, mismatches);
+    status |= mismatches != 0;
+  }
+  return status;
+}
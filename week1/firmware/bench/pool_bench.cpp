@@ -0,0 +1,135 @@
+/**
+ *  @file pool_bench.cpp
+ *  @brief Gateway side DecoderPool: interleaved frames of thousands of
+ *  simulated nodes, each replaying the captures from its own offset, and
+ *  the decode rate, memory per node and evictions for a few pool sizes
+ *  */
+
+#include "../subsystems/decoder_pool.h"
+#include "dataset.h"
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+
+#ifndef BENCH_NODES
+#define BENCH_NODES 10000
+#endif
+
+#ifndef BENCH_ROUNDS
+#define BENCH_ROUNDS 64
+#endif
+
+struct Node {
+  Encoder encoder;
+  deviceid_t device;
+  uint16_t sequence;
+  size_t sample; // next sample of the captures to send
+};
+
+struct Sent {
+  EncoderResult result;
+  uint32_t node;
+  uint16_t sequence;
+  size_t sample;
+};
+
+struct PoolReport {
+  double frames_per_s;
+  double bytes_per_node;
+  uint32_t evictions;
+  size_t delivered;  // frames decoded and checked against the capture
+  size_t lost;       // samples the pool reported lost
+  size_t mismatches; // delivered samples that did not match
+  size_t frames;
+};
+
+/* `busy` nodes send every round, the others one round in `idle_every` */
+template <uint16_t N>
+static PoolReport run_pool(const std::vector<SensorData> &samples,
+                           uint32_t busy, uint32_t idle_every) {
+  static DecoderPool<N> pool;
+  pool.setup();
+
+  std::vector<Node> nodes(BENCH_NODES);
+  for (uint32_t n = 0; n < BENCH_NODES; n++) {
+    nodes[n].encoder.setup();
+    // NOTE: odd multiplier, a bijection of the 16 bit ids
+    nodes[n].device = (deviceid_t)(n * 40503u);
+    nodes[n].sequence = 0;
+    nodes[n].sample = (n * 617u) % samples.size();
+  }
+
+  PoolReport report = {0, sizeof(DecoderPool<N>) / (double)N, 0, 0, 0, 0, 0};
+  std::mt19937 rng(1);
+  std::vector<Sent> frames;
+  frames.reserve(BENCH_NODES);
+  double ns = 0;
+
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    frames.clear();
+    for (uint32_t n = 0; n < BENCH_NODES; n++) {
+      if (n >= busy && round % idle_every != n % idle_every) {
+        continue;
+      }
+      Node &node = nodes[n];
+      Sent frame;
+      frame.result = node.encoder.encode(samples[node.sample], ENCODE_VARINT);
+      frame.node = n;
+      frame.sequence = node.sequence++;
+      frame.sample = node.sample;
+      node.sample = (node.sample + 1) % samples.size();
+      frames.push_back(frame);
+    }
+    std::shuffle(frames.begin(), frames.end(), rng);
+
+    std::vector<DecoderResult> decoded(frames.size());
+    dataset::Stopwatch timer;
+    for (size_t f = 0; f < frames.size(); f++) {
+      decoded[f] = pool.decode(nodes[frames[f].node].device, frames[f].result,
+                               frames[f].sequence);
+    }
+    ns += timer.ns();
+
+    for (size_t f = 0; f < frames.size(); f++) {
+      if (decoded[f].status == DECODER_OK) {
+        report.delivered++;
+        report.mismatches +=
+            !dataset::same(decoded[f].data, samples[frames[f].sample]);
+      }
+      report.lost += decoded[f].lost;
+    }
+    report.frames += frames.size();
+  }
+
+  report.frames_per_s = report.frames / (ns / 1e9);
+  report.evictions = pool.evicted();
+  return report;
+}
+
+static bool print_report(const char *name, const PoolReport &r) {
+  printf("%-24s %10.2f %10.1f %10u %9.2f%% %9.2f%%\n", name,
+         r.frames_per_s / 1e6, r.bytes_per_node, r.evictions,
+         100.0 * r.delivered / r.frames, 100.0 * r.lost / r.frames);
+  // NOTE: every frame is either decoded intact or reported lost
+  return r.mismatches == 0 && r.delivered + r.lost == r.frames;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SensorData> samples;
+  const char *dir = argc > 1 ? argv[1] : DATA_DIR;
+  if (!dataset::load(samples, dir)) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+
+  printf("decoder pool benchmark: %d nodes x %d rounds, varint frames\n\n",
+         BENCH_NODES, BENCH_ROUNDS);
+  printf("%-24s %10s %10s %10s %10s %10s\n", "pool", "Mframe/s", "B/node",
+         "evictions", "delivered", "lost");
+
+  bool ok = true;
+  ok &= print_report("16384, all busy", run_pool<16384>(samples, BENCH_NODES, 1));
+  ok &= print_report("4096, 2000 busy 1/16", run_pool<4096>(samples, 2000, 16));
+  ok &= print_report("4096, all busy", run_pool<4096>(samples, BENCH_NODES, 1));
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/**
+ *  @file queue_bench.cpp
+ *  @brief The node queue (Queue, subsystems/queue.h), frames of any length
+ *  back to back in one byte arena: a random run of queueing, sealing and
+ *  sending checked against a model of what it should hold, then how many
+ *  frames of each kind the arena holds against fixed slots of the longest
+ *  frame in the same RAM, and the cost of a frame in and out
+ *  */
+
+#include "../subsystems/encoder.h"
+#include "../subsystems/queue.h"
+#include "dataset.h"
+#include <deque>
+#include <random>
+#include <stdio.h>
+
+#ifndef BENCH_STEPS
+#define BENCH_STEPS 2000000
+#endif
+
+/* NOTE: a slot of the fixed size queue the arena replaced */
+struct Slot {
+  Frame frame;
+  uint8_t bytes[MAX_FRAME_LEN];
+};
+
+struct Queued {
+  flag_t flag;
+  std::vector<uint8_t> payload;
+};
+
+/* random payloads queued (some encodes held, never committed) and sent,
+ * every frame sealed in place and read back through a Deframer, the queue
+ * against a model. A full queue drops its oldest frames before the next
+ * reserve(), as the sketch does when the spool can not take them, and
+ * reserve() must then have room for the longest frame. Spells of an outage
+ * (the queue overflows) and of a good link (it runs empty) take turns */
+static size_t check(uint32_t seed, QueueStats &last) {
+  static Queue queue;
+  queue.setup();
+  Framing framing;
+  framing.setup();
+  Deframer deframer;
+  deframer.begin();
+  std::deque<Queued> model;
+  std::mt19937 rng(seed);
+  size_t errors = 0;
+  uint32_t dropped = 0;
+  uint16_t sequence = 0;
+
+  for (uint32_t step = 0; step < BENCH_STEPS; step++) {
+    const bool outage = (step >> 12) & 1;
+    const uint32_t dice = rng() % 8;
+    if (dice < (outage ? 5 : 2)) {
+      while (queue.isFull()) {
+        queue.drop();
+        model.pop_front();
+        dropped++;
+      }
+      // NOTE: mostly short payloads, now and then the longest
+      Frame *room = queue.reserve();
+      if (room == nullptr) {
+        errors++;
+        continue;
+      }
+      Frame &frame = *room;
+      Queued q;
+      q.flag = rng();
+      q.payload.resize(rng() % 16 ? 1 + rng() % 60
+                                  : 1 + rng() % MAX_FRAME_PAYLOAD_LEN);
+      for (uint8_t &b : q.payload) {
+        b = (uint8_t)rng();
+      }
+      memcpy(frame.payload(), q.payload.data(), q.payload.size());
+      frame.flag = q.flag;
+      frame.len = (uint16_t)q.payload.size();
+      if (dice == 0) {
+        continue; // NOTE: held, the slot is handed out again
+      }
+      queue.commit();
+      model.push_back(q);
+    } else if (dice < (outage ? 7 : 4)) {
+      // NOTE: a few frames looked at in place, the first one sealed
+      const uint16_t i = (uint16_t)(rng() % 4);
+      Frame *frame = queue.peek(i);
+      errors += (frame != nullptr) != (i < model.size());
+      if (frame && !frame->sealed) {
+        errors += frame->flag != model[i].flag ||
+                  frame->len != model[i].payload.size() ||
+                  memcmp(frame->payload(), model[i].payload.data(),
+                         frame->len) != 0;
+      }
+      if (Frame *first = queue.front()) {
+        if (!first->sealed) {
+          uint16_t crc;
+          framing.finalize(*first, sequence++, crc);
+        }
+      }
+    } else if (Frame *frame = queue.front()) {
+      if (!frame->sealed) {
+        uint16_t crc;
+        framing.finalize(*frame, sequence++, crc);
+      }
+      uint8_t status;
+      deframer.feed(frame->data(), frame->len, status);
+      const DeframedFrame &f = deframer.frame();
+      errors += status != DEFRAME_FRAME || f.header.flags != model[0].flag ||
+                f.header.len != model[0].payload.size() ||
+                memcmp(f.payload, model[0].payload.data(), f.header.len) != 0;
+      queue.release();
+      model.pop_front();
+    }
+    errors += queue.size() != model.size();
+  }
+  last = queue.stats();
+  errors += last.dropped != dropped;
+  return errors;
+}
+
+struct Fill {
+  uint16_t frames;      // queued until the queue was full
+  double payload_bytes; // per frame
+  double arena_bytes;   // per frame
+};
+
+/* the captures queued with nothing sent, as in a long outage */
+static Fill fill(const std::vector<SensorData> &samples, bool batches,
+                 uint8_t flags) {
+  static Queue queue;
+  queue.setup();
+  Encoder encoder;
+  encoder.setup();
+  uint64_t payload = 0;
+  uint32_t frames = 0;
+  for (size_t i = 0; i < samples.size() && !queue.isFull();) {
+    const uint8_t count =
+        batches ? (uint8_t)std::min<size_t>(BATCH_MAX_SAMPLES,
+                                            samples.size() - i)
+                : 1;
+    Frame &frame = *queue.reserve();
+    EncoderOutput out = {frame.payload(), 0, 0};
+    const uint8_t status =
+        batches ? encoder.encode_batch(&samples[i], count,
+                                       (uint32_t)(i * 1000), 1000, flags, out)
+                : encoder.encode(samples[i], flags, out);
+    i += out.count;
+    if (status != ENCODER_OK) {
+      continue;
+    }
+    frame.flag = out.flag;
+    frame.len = out.len;
+    queue.commit();
+    payload += out.len;
+    frames++;
+  }
+  const QueueStats s = queue.stats();
+  Fill f;
+  f.frames = s.most_frames;
+  f.payload_bytes = payload / (double)frames;
+  f.arena_bytes = s.high_water / (double)s.most_frames;
+  return f;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SensorData> samples;
+  const char *dir = argc > 1 ? argv[1] : DATA_DIR;
+  if (!dataset::load(samples, dir)) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+  const size_t slots = QUEUE_ARENA_BYTES / sizeof(Slot);
+  printf("queue benchmark: %u B arena, %zu B per fixed slot (%zu of them in "
+         "the same RAM), %s framing\n",
+         (unsigned)QUEUE_ARENA_BYTES, sizeof(Slot), slots,
+         FRAMING_COBS ? "cobs" : "escaped");
+  int status = 0;
+
+  printf("\nrandom run, %u steps\n\n", (unsigned)BENCH_STEPS);
+  printf("%-6s %8s %12s %12s %10s\n", "seed", "errors", "high water",
+         "most frames", "dropped");
+  for (uint32_t seed = 1; seed <= 3; seed++) {
+    QueueStats s;
+    const size_t errors = check(seed, s);
+    printf("%-6u %8zu %10u B %12u %10u\n", seed, errors,
+           (unsigned)s.high_water, s.most_frames, (unsigned)s.dropped);
+    status |= errors != 0 || s.high_water > QUEUE_ARENA_BYTES;
+  }
+
+  static const struct {
+    const char *name;
+    bool batches;
+    uint8_t flags;
+  } workloads[] = {{"varint", false, ENCODE_VARINT},
+                   {"delta", false, 0},
+                   {"entropy", false, ENCODE_ENTROPY},
+                   {"dead band batches", true, ENCODE_DEADBAND}};
+  printf("\nframes held until the queue is full\n\n");
+  printf("%-18s %9s %9s %8s %8s %7s\n", "payloads", "payload", "arena/f",
+         "arena", "slots", "gain");
+  for (const auto &w : workloads) {
+    const Fill f = fill(samples, w.batches, w.flags);
+    printf("%-18s %7.1f B %7.1f B %8u %8zu %6.2fx\n", w.name, f.payload_bytes,
+           f.arena_bytes, f.frames, slots, f.frames / (double)slots);
+  }
+
+  /* NOTE: a frame in, sealed and out again, a few queued all along */
+  static Queue queue;
+  queue.setup();
+  Framing framing;
+  framing.setup();
+  uint64_t sink = 0;
+  dataset::Stopwatch timer;
+  for (uint32_t i = 0; i < BENCH_STEPS; i++) {
+    Frame &frame = *queue.reserve(); // NOTE: 8 frames queued at most
+    memset(frame.payload(), (uint8_t)i, 12);
+    frame.flag = 0x02000000;
+    frame.len = 12;
+    queue.commit();
+    if (queue.size() > 8) {
+      Frame *next = queue.front();
+      uint16_t crc;
+      sink += framing.finalize(*next, (uint16_t)i, crc).len;
+      queue.release();
+    }
+  }
+  printf("\nin, sealed and out: %.1f ns per frame\n", timer.ns() / BENCH_STEPS);
+  if (sink == 1) {
+    printf("\n"); // NOTE: keeps the loop from being dropped
+  }
+  return status;
+}
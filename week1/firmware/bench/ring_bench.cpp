@@ -0,0 +1,295 @@
+/**
+ *  @file ring_bench.cpp
+ *  @brief The lock-free ring (SpscRing, subsystems/spsc_ring.h): a stress
+ *  run of a producer and a consumer thread through every way in and out of
+ *  it, checking each element arrives once and in order, then its throughput
+ *  across threads and within one loop against the same ring behind a mutex
+ *  */
+
+#include "../subsystems/framing.h"
+#include "../subsystems/spsc_ring.h"
+#include "dataset.h"
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <thread>
+
+#ifndef BENCH_ITEMS
+#define BENCH_ITEMS (1u << 20) // per stress run and throughput row
+#endif
+
+/* NOTE: the check word ties the payload to the sequence, a slot read
+ * before it was written (or after it was given back) shows up */
+struct Item {
+  uint32_t sequence;
+  uint32_t check;
+};
+
+static uint32_t check_of(uint32_t sequence) {
+  return sequence * 2654435761u ^ 0xA5A5A5A5u;
+}
+
+/* NOTE: a slot of a queue of fixed size frames, the metadata and room for
+ * the longest one */
+struct Slot {
+  Frame frame;
+  uint8_t bytes[MAX_FRAME_LEN];
+};
+
+#define WAYS 3 // 0: one at a time, 1: batches, 2: in place
+
+static const char *WAY_NAMES[WAYS] = {"single", "batch", "in place"};
+
+struct StressReport {
+  size_t received;
+  size_t errors; // out of order, torn or missing
+  size_t full;   // producer found it full
+  size_t empty;  // consumer found it empty
+};
+
+template <uint32_t N>
+static StressReport stress(int produce, int consume, uint32_t seed) {
+  static SpscRing<Item, N> ring;
+  ring.clear();
+  StressReport r = {0, 0, 0, 0};
+
+  std::thread producer([&] {
+    std::mt19937 rng(seed);
+    Item batch[32];
+    for (uint32_t next = 0; next < BENCH_ITEMS;) {
+      uint32_t sent = 0;
+      if (produce == 0) {
+        sent = ring.push(Item{next, check_of(next)});
+      } else if (produce == 1) {
+        const uint32_t n =
+            std::min<uint32_t>(1 + rng() % 32, BENCH_ITEMS - next);
+        for (uint32_t i = 0; i < n; i++) {
+          batch[i] = Item{next + i, check_of(next + i)};
+        }
+        sent = ring.push(batch, n);
+      } else if (Item *slot = ring.reserve()) {
+        slot->sequence = next;
+        slot->check = check_of(next);
+        ring.commit();
+        sent = 1;
+      }
+      next += sent;
+      if (!sent) {
+        r.full++;
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  std::mt19937 rng(seed + 1);
+  Item batch[32];
+  uint32_t expected = 0;
+  while (expected < BENCH_ITEMS) {
+    uint32_t got = 0;
+    if (consume == 0) {
+      got = ring.pop(batch[0]);
+    } else if (consume == 1) {
+      got = ring.pop(batch, 1 + rng() % 32);
+    } else {
+      // NOTE: a few looked at in place, then given back at once
+      const uint32_t want = 1 + rng() % 8;
+      while (got < want && ring.peek(got)) {
+        batch[got] = *ring.peek(got);
+        got++;
+      }
+      ring.release(got);
+    }
+    for (uint32_t i = 0; i < got; i++, expected++) {
+      r.errors += batch[i].sequence != expected ||
+                  batch[i].check != check_of(expected);
+    }
+    r.received += got;
+    if (!got) {
+      r.empty++;
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  r.errors += !ring.empty();
+  return r;
+}
+
+/* elements from a producer thread to this one, filled and read in place
+ * or copied in and out, `batch` of them per call */
+template <typename Ring, typename T>
+static double cross_thread(Ring &ring, uint32_t batch, bool in_place) {
+  std::vector<T> out(batch), in(batch);
+  dataset::Stopwatch timer;
+  std::thread producer([&] {
+    for (uint32_t sent = 0; sent < BENCH_ITEMS;) {
+      uint32_t n = 0;
+      if (in_place) {
+        while (n < batch && ring.reserve()) {
+          *(uint32_t *)ring.reserve() = sent + n;
+          ring.commit();
+          n++;
+        }
+      } else {
+        n = ring.push(out.data(), batch);
+      }
+      sent += n;
+      if (!n) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  uint64_t sink = 0;
+  for (uint32_t got = 0; got < BENCH_ITEMS;) {
+    uint32_t n = 0;
+    if (in_place) {
+      while (n < batch && ring.peek(n)) {
+        sink += *(const uint32_t *)ring.peek(n);
+        n++;
+      }
+      ring.release(n);
+    } else {
+      n = ring.pop(in.data(), batch);
+      sink += n ? *(const uint32_t *)&in[0] : 0;
+    }
+    got += n;
+    if (!n) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  const double ns = timer.ns();
+  if (sink == 1) {
+    printf("\n"); // NOTE: keeps the loops from being dropped
+  }
+  return ns / BENCH_ITEMS;
+}
+
+/* the same ring, every call under one lock, the way it would be shared
+ * without the atomics */
+template <typename T, uint32_t N> class LockedRing {
+private:
+  SpscRing<T, N> ring;
+  std::mutex lock;
+
+public:
+  T *reserve() {
+    std::lock_guard<std::mutex> guard(lock);
+    return ring.reserve();
+  }
+  void commit() {
+    std::lock_guard<std::mutex> guard(lock);
+    ring.commit();
+  }
+  uint32_t push(const T *items, uint32_t count) {
+    std::lock_guard<std::mutex> guard(lock);
+    return ring.push(items, count);
+  }
+  T *peek(uint32_t i) {
+    std::lock_guard<std::mutex> guard(lock);
+    return ring.peek(i);
+  }
+  void release(uint32_t count) {
+    std::lock_guard<std::mutex> guard(lock);
+    ring.release(count);
+  }
+  uint32_t pop(T *items, uint32_t count) {
+    std::lock_guard<std::mutex> guard(lock);
+    return ring.pop(items, count);
+  }
+};
+
+/* producer and consumer in one loop, as the node runs them: an element in
+ * then out again, with a few queued all along */
+template <typename T, uint32_t N>
+static double same_loop(bool in_place) {
+  static SpscRing<T, N> ring;
+  ring.clear();
+  static T item;
+  uint64_t sink = 0;
+  dataset::Stopwatch timer;
+  for (uint32_t i = 0; i < BENCH_ITEMS; i++) {
+    if (in_place) {
+      *(uint32_t *)ring.reserve() = i;
+      ring.commit();
+    } else {
+      *(uint32_t *)&item = i;
+      ring.push(item);
+    }
+    if (ring.size() > N / 2) {
+      if (in_place) {
+        sink += *(const uint32_t *)ring.front();
+        ring.release();
+      } else {
+        ring.pop(item);
+        sink += *(const uint32_t *)&item;
+      }
+    }
+  }
+  const double ns = timer.ns();
+  if (sink == 1) {
+    printf("\n");
+  }
+  return ns / BENCH_ITEMS;
+}
+
+int main() {
+  printf("spsc ring benchmark: %u items per run, %u hardware threads\n",
+         (unsigned)BENCH_ITEMS, std::thread::hardware_concurrency());
+  int status = 0;
+
+  /* NOTE: a ring of 4 is full or empty most of the time, one of 1024
+   * rarely, every pair of ways in and out through both */
+  printf("\nstress, producer and consumer threads\n\n");
+  printf("%-6s %-9s %-9s %10s %8s %10s %10s\n", "slots", "push", "pop",
+         "received", "errors", "full", "empty");
+  for (int produce = 0; produce < WAYS; produce++) {
+    for (int consume = 0; consume < WAYS; consume++) {
+      const StressReport small = stress<4>(produce, consume, 3 * produce);
+      const StressReport large =
+          stress<1024>(produce, consume, 3 * produce + consume);
+      printf("%-6u %-9s %-9s %10zu %8zu %10zu %10zu\n", 4, WAY_NAMES[produce],
+             WAY_NAMES[consume], small.received, small.errors, small.full,
+             small.empty);
+      printf("%-6u %-9s %-9s %10zu %8zu %10zu %10zu\n", 1024,
+             WAY_NAMES[produce], WAY_NAMES[consume], large.received,
+             large.errors, large.full, large.empty);
+      status |= small.errors || large.errors ||
+                small.received != BENCH_ITEMS || large.received != BENCH_ITEMS;
+    }
+  }
+
+  printf("\nacross threads, ns per element\n\n");
+  printf("%-14s %6s %10s %10s %10s\n", "element", "batch", "lock-free",
+         "mutex", "gain");
+  static const uint32_t batches[] = {1, 8, 32};
+  for (uint32_t batch : batches) {
+    static SpscRing<uint32_t, 256> ring;
+    static LockedRing<uint32_t, 256> locked;
+    ring.clear();
+    const double free_ns = cross_thread<decltype(ring), uint32_t>(
+        ring, batch, false);
+    const double locked_ns = cross_thread<decltype(locked), uint32_t>(
+        locked, batch, false);
+    printf("%-14s %6u %10.1f %10.1f %9.2fx\n", "uint32 copy", batch, free_ns,
+           locked_ns, locked_ns / free_ns);
+  }
+  for (uint32_t batch : batches) {
+    static SpscRing<Slot, 16> ring;
+    static LockedRing<Slot, 16> locked;
+    ring.clear();
+    const double free_ns =
+        cross_thread<decltype(ring), Slot>(ring, batch, true);
+    const double locked_ns =
+        cross_thread<decltype(locked), Slot>(locked, batch, true);
+    printf("%-14s %6u %10.1f %10.1f %9.2fx\n", "slot in place", batch,
+           free_ns, locked_ns, locked_ns / free_ns);
+  }
+
+  printf("\none loop (the node), ns per element in and out\n\n");
+  printf("%-14s %10s %10s\n", "element", "copy", "in place");
+  printf("%-14s %10.2f %10.2f\n", "uint32", same_loop<uint32_t, 16>(false),
+         same_loop<uint32_t, 16>(true));
+  printf("%-14s %10.2f %10.2f\n", "slot", same_loop<Slot, 16>(false),
+         same_loop<Slot, 16>(true));
+  return status;
+}
@@ -0,0 +1,311 @@
+/**
+ *  @file spool_bench.cpp
+ *  @brief The flash log behind the node queue (Spool, subsystems/spool.h)
+ *  on a file standing in for the partition: how many batches of an outage
+ *  it holds and the cost of writing them back and taking them out again,
+ *  how evenly laps of the ring wear the sectors, an outage spilled in the
+ *  order of the sketch without a frame dropped, then power losses at
+ *  random points of the writes, each followed by a recovery that must
+ *  neither lose a frame nor bring a taken one back, and its cost
+ *  */
+
+#include "../subsystems/encoder.h"
+#include "../subsystems/spool.h"
+#include "dataset.h"
+#include <deque>
+#include <random>
+#include <stdio.h>
+
+#ifndef BENCH_CUTS
+#define BENCH_CUTS 2000 // power losses
+#endif
+#define BENCH_LAPS 8      // of the ring, the backlog drained all along
+#define BENCH_BACKLOG 128 // frames at most, the log never drops one
+#define BENCH_SPILLED 200 // frames of an outage in the sketch's order
+
+#define BENCH_FILE "bench/spool_bench.bin"
+
+/* NOTE: a rough model of the quad SPI flash of the S3 modules, typical
+ * datasheet figures: 20 MB/s read through esp_partition_read(), a 256 byte
+ * page programmed in 0.7 ms and a 4 KB sector erased in 45 ms */
+#define S3_READ_NS_PER_BYTE 50.0
+#define S3_PROGRAM_NS_PER_BYTE (700000.0 / 256)
+#define S3_ERASE_NS 45e6
+
+/* flash work between two snapshots of the counters, in ms on the S3 */
+static double s3_ms(const SpoolStats &now, const SpoolStats &before) {
+  return ((now.read - before.read) * S3_READ_NS_PER_BYTE +
+          (now.programmed - before.programmed) * S3_PROGRAM_NS_PER_BYTE +
+          (now.erased - before.erased) * S3_ERASE_NS) /
+         1e6;
+}
+
+struct Queued {
+  flag_t flag;
+  std::vector<uint8_t> payload;
+};
+
+static bool same(Frame &frame, const Queued &q) {
+  return !frame.sealed && frame.flag == q.flag &&
+         frame.len == q.payload.size() &&
+         memcmp(frame.payload(), q.payload.data(), frame.len) == 0;
+}
+
+/* NOTE: the frames of the power losses tell their id, every 5th one was
+ * sealed before it went to flash */
+static uint16_t id_len(uint32_t id) {
+  return 4 + id * 2654435761u % (MAX_FRAME_PAYLOAD_LEN - 3);
+}
+
+static void make(Frame &frame, uint32_t id) {
+  frame.flag = id;
+  frame.len = id_len(id);
+  frame.sealed = id % 5 == 0;
+  frame.start = frame.sealed ? 3 : 0;
+  uint8_t *bytes = frame.sealed ? frame.data() : frame.payload();
+  for (uint16_t i = 0; i < frame.len; i++) {
+    bytes[i] = (uint8_t)(id + 31 * i);
+  }
+}
+
+static bool is(Frame &frame, uint32_t id) {
+  if (frame.flag != id || frame.len != id_len(id) ||
+      frame.sealed != (id % 5 == 0)) {
+    return false;
+  }
+  const uint8_t *bytes = frame.sealed ? frame.data() : frame.payload();
+  for (uint16_t i = 0; i < frame.len; i++) {
+    if (bytes[i] != (uint8_t)(id + 31 * i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* one dead band batch of the captures (round and round) into the queue,
+ * false if the dead band held it. NOTE: the queue must have room */
+static bool encode(Encoder &encoder, Queue &queue,
+                   const std::vector<SensorData> &samples, size_t &i,
+                   std::deque<Queued> &model) {
+  const size_t at = i % (samples.size() - BATCH_MAX_SAMPLES);
+  Frame &frame = *queue.reserve(); // NOTE: spilled after every batch
+  EncoderOutput out = {frame.payload(), 0, 0};
+  const uint8_t status =
+      encoder.encode_batch(&samples[at], BATCH_MAX_SAMPLES,
+                           (uint32_t)(i * 1000), 1000, ENCODE_DEADBAND, out);
+  i += out.count;
+  if (status != ENCODER_OK) {
+    return false;
+  }
+  frame.flag = out.flag;
+  frame.len = out.len;
+  queue.commit();
+  model.push_back(
+      {out.flag, std::vector<uint8_t>(out.data, out.data + out.len)});
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SensorData> samples;
+  const char *dir = argc > 1 ? argv[1] : DATA_DIR;
+  if (!dataset::load(samples, dir) || samples.size() <= BATCH_MAX_SAMPLES) {
+    fprintf(stderr, "ERROR: could not load the captures from %s\n", dir);
+    return 2;
+  }
+  printf("spool benchmark: %u sectors of %u B, %u B RAM queue in front\n",
+         (unsigned)SPOOL_SECTORS, (unsigned)SPOOL_SECTOR_BYTES,
+         (unsigned)QUEUE_ARENA_BYTES);
+  int status = 0;
+  static Queue queue;
+  queue.setup();
+  Encoder encoder;
+  encoder.setup();
+  std::deque<Queued> model;
+  size_t sample = 0;
+  remove(BENCH_FILE);
+
+  /* NOTE: an outage, every batch written back until the log drops one */
+  uint32_t held = 0;
+  double append_ns = 0, append_ms = 0;
+  {
+    Spool spool(BENCH_FILE);
+    status |= !spool.setup();
+    while (spool.stats().dropped == 0) {
+      if (!encode(encoder, queue, samples, sample, model)) {
+        continue;
+      }
+      const SpoolStats before = spool.stats();
+      dataset::Stopwatch timer;
+      status |= spool.spill(queue, true) != 1;
+      append_ns += timer.ns();
+      append_ms += s3_ms(spool.stats(), before);
+      held = spool.size() > held ? spool.size() : held;
+    }
+    const SpoolStats s = spool.stats();
+    for (uint32_t i = 0; i < s.dropped; i++) {
+      model.pop_front();
+    }
+    printf("\noutage, dead band batches written back one at a time\n\n");
+    printf("%-22s %10u\n", "frames held", held);
+    printf("%-22s %10.1f\n", "flash bytes per frame",
+           s.programmed / (double)s.written);
+    printf("%-22s %10.2f us host %8.2f ms S3\n", "append",
+           append_ns / 1e3 / s.written, append_ms / s.written);
+  }
+
+  /* NOTE: the full log found again, then taken back in order */
+  size_t errors = 0;
+  {
+    Spool spool(BENCH_FILE);
+    dataset::Stopwatch timer;
+    status |= !spool.setup();
+    const double recover_ns = timer.ns();
+    const SpoolStats before = spool.stats();
+    errors += spool.size() != model.size();
+    printf("%-22s %10.2f us host %8.2f ms S3 (%u B read)\n",
+           "recovery of it", recover_ns / 1e3, s3_ms(before, SpoolStats{}),
+           (unsigned)before.read);
+
+    double take_ns = 0;
+    uint32_t taken = 0;
+    for (;;) {
+      dataset::Stopwatch t;
+      if (!spool.take(queue)) {
+        break;
+      }
+      take_ns += t.ns();
+      taken++;
+      errors += model.empty() || !same(*queue.front(), model.front());
+      if (!model.empty()) {
+        model.pop_front();
+      }
+      queue.release();
+    }
+    errors += !model.empty() || !spool.isEmpty();
+    printf("%-22s %10.2f us host %8.2f ms S3\n", "take",
+           take_ns / 1e3 / taken, s3_ms(spool.stats(), before) / taken);
+
+    /* NOTE: laps of the ring with a backlog of half of it, written back by
+     * the queue and refilled once the queue ran empty, as in the sketch */
+    const uint32_t erased = spool.stats().erased;
+    while (spool.stats().erased < erased + BENCH_LAPS * SPOOL_SECTORS) {
+      if (encode(encoder, queue, samples, sample, model)) {
+        spool.spill(queue, true);
+      }
+      if (spool.size() > held / 2) {
+        spool.refill(queue);
+        while (!queue.isEmpty()) {
+          errors += model.empty() || !same(*queue.front(), model.front());
+          model.pop_front();
+          queue.release();
+        }
+      }
+    }
+    const SpoolStats s = spool.stats();
+    printf("%-22s %10zu\n", "errors", errors);
+    printf("\n%u laps of the ring: sectors erased %u to %u times, %u "
+           "dropped\n",
+           BENCH_LAPS, (unsigned)s.min_erases, (unsigned)s.max_erases,
+           (unsigned)s.dropped);
+    status |= errors != 0 || s.dropped != 0 ||
+              s.max_erases - s.min_erases > 1;
+  }
+
+  /* NOTE: an outage in the order of the sketch, the oldest frames go to
+   * flash while the queue is full right before the next batch is encoded,
+   * none may be dropped. The queue holds the newest ones behind them */
+  remove(BENCH_FILE);
+  {
+    queue.setup();
+    model.clear();
+    Spool spool(BENCH_FILE);
+    status |= !spool.setup();
+    while (spool.size() < BENCH_SPILLED) {
+      spool.spill(queue);
+      if (queue.isFull()) {
+        break;
+      }
+      encode(encoder, queue, samples, sample, model);
+    }
+    const uint32_t spilled = spool.size();
+    const uint32_t dropped = queue.stats().dropped;
+    size_t errors = spilled + queue.size() != model.size();
+    for (size_t k = spilled; !errors && k < model.size(); k++) {
+      errors += !same(*queue.front(), model[k]);
+      queue.release();
+    }
+    for (size_t k = 0; !errors && k < spilled; k++) {
+      errors += !spool.take(queue) || !same(*queue.front(), model[k]);
+      queue.release();
+    }
+    printf("\noutage, the queue spilled before every batch\n\n");
+    printf("%-22s %10u\n", "frames spilled", (unsigned)spilled);
+    printf("%-22s %10u\n", "dropped", (unsigned)dropped);
+    printf("%-22s %10zu\n", "errors", errors);
+    status |= spilled < BENCH_SPILLED || dropped != 0 || errors != 0;
+  }
+
+  /* NOTE: the power goes somewhere in the next few KB programmed, the
+   * write under way (an append or the mark of a take) may or may not have
+   * made it, nothing else may differ */
+  remove(BENCH_FILE);
+  std::mt19937 rng(1);
+  std::deque<uint32_t> ids;
+  uint32_t next = 0;
+  int8_t cut_in = 0; // 1: an append, -1: a take
+  size_t lost = 0, wrong = 0, torn = 0;
+  double recover_ns = 0, worst_ns = 0, recover_ms = 0, worst_ms = 0;
+  for (uint32_t cut = 0; cut < BENCH_CUTS; cut++) {
+    Spool spool(BENCH_FILE);
+    dataset::Stopwatch timer;
+    status |= !spool.setup();
+    const double ns = timer.ns();
+    const double ms = s3_ms(spool.stats(), SpoolStats{});
+    if (cut > 0) { // NOTE: the first one formats the file
+      recover_ns += ns;
+      worst_ns = ns > worst_ns ? ns : worst_ns;
+      recover_ms += ms;
+      worst_ms = ms > worst_ms ? ms : worst_ms;
+    }
+    torn += spool.stats().torn;
+
+    if (cut_in > 0 && spool.size() == ids.size() + 1) {
+      ids.push_back(next - 1);
+    } else if (cut_in < 0 && spool.size() + 1 == ids.size()) {
+      ids.pop_front();
+    }
+    lost += spool.size() != ids.size();
+    cut_in = 0;
+
+    spool.cut_power(rng() % 8192);
+    while (!cut_in) {
+      if (ids.size() < 8 || (ids.size() < BENCH_BACKLOG && rng() % 2)) {
+        Frame &frame = *queue.reserve(); // NOTE: never committed
+        make(frame, next++);
+        if (spool.append(frame)) {
+          ids.push_back(next - 1);
+        } else {
+          cut_in = 1;
+        }
+      } else if (spool.take(queue)) {
+        wrong += !is(*queue.front(), ids.front());
+        ids.pop_front();
+        queue.release();
+      } else {
+        cut_in = -1;
+      }
+    }
+  }
+  remove(BENCH_FILE);
+  printf("\n%u power losses, %u frames written\n\n", (unsigned)BENCH_CUTS,
+         (unsigned)next);
+  printf("%-22s %10zu\n", "frames lost or back", lost);
+  printf("%-22s %10zu\n", "frames out of order", wrong);
+  printf("%-22s %10.1f\n", "torn, per recovery", torn / (double)BENCH_CUTS);
+  printf("%-22s %10.2f us host %8.2f ms S3\n", "recovery, mean",
+         recover_ns / 1e3 / (BENCH_CUTS - 1), recover_ms / (BENCH_CUTS - 1));
+  printf("%-22s %10.2f us host %8.2f ms S3\n", "recovery, worst",
+         worst_ns / 1e3, worst_ms);
+  status |= lost != 0 || wrong != 0 || torn == 0;
+  return status;
+}
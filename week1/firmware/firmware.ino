@@ -1,32 +1,64 @@
 #include <Arduino.h>
 
+#include "subsystems/aggregator.h"
 #include "subsystems/cadence.h"
 #include "subsystems/encoder.h"
 #include "subsystems/framing.h"
 #include "subsystems/queue.h"
+#include "subsystems/retained.h"
 #include "subsystems/sensor.h"
+#include "subsystems/spool.h"
 #include "subsystems/transmission.h"
 
+#include "subsystems/aggregator.cpp"
 #include "subsystems/cadence.cpp"
 #include "subsystems/encoder.cpp"
+#include "subsystems/fec.cpp"
 #include "subsystems/framing.cpp"
 #include "subsystems/queue.cpp"
+#include "subsystems/retained.cpp"
 #include "subsystems/sensor.cpp"
+#include "subsystems/spool.cpp"
+#include "subsystems/stats.cpp"
 #include "subsystems/subsystem.cpp"
 #include "subsystems/transmission.cpp"
 
 #define BAUD 115200
 
+/* frames between two dumps of the encoder statistics, 0 never */
+#ifndef STATS_DUMP_FRAMES
+#define STATS_DUMP_FRAMES 360
+#endif
+
+/* deep sleep between two samples whenever everything encoded went out,
+ * the samples are then this far apart, 0 keeps the node awake */
+#ifndef DEEP_SLEEP_MS
+#define DEEP_SLEEP_MS 0
+#endif
+
+// NOTE: the spacing of the samples of a batch
+#define BATCH_INTERVAL_MS                                                      \
+  (DEEP_SLEEP_MS ? DEEP_SLEEP_MS : DEFAULT_SENSOR_INTERVAL_MS)
+
 Cadence cadence;
 Sensor sensor;
 Encoder encoder;
 Queue queue;
+Spool spool;
 Framing framing;
+Aggregator aggregator;
 Transmission transmission;
+Retained retained;
 
 uint16_t sequence = 0;
 uint32_t last_millis = 0;
 bool sensor_ok = false;
+uint32_t sampled_at = 0; // millis() of the sample taken since the wake up
+bool sampled = false;
+
+/* samples waiting to be sent as one batch (one per transmission interval),
+ * carried through a deep sleep (see retained.h) */
+OpenBatch batch = {};
 
 void setup() {
   Serial.begin(BAUD);
@@ -45,18 +77,36 @@ void setup() {
   if (!encoder.setup()) {
     Serial.println("ERROR: Encoder setup failed");
   }
+  if (!retained.setup()) {
+    Serial.println("ERROR: Retained setup failed");
+  }
+  if (retained.restore(encoder, sequence, &batch)) {
+    Serial.printf("Woke up, delta chain resumed at seq=%d, %d samples "
+                  "batched\n",
+                  sequence, batch.count);
+  }
   if (!queue.setup()) {
     Serial.println("ERROR: Queue setup failed");
   }
+  if (!spool.setup()) {
+    Serial.println("WARNING: Spool setup failed - frames past the queue will "
+                   "be dropped");
+  } else if (!spool.isEmpty()) {
+    Serial.printf("Spool: %d frames waiting from before the reset\n",
+                  (int)spool.size());
+  }
   if (!framing.setup()) {
     Serial.println("ERROR: Framing setup failed");
   }
+  if (!aggregator.setup()) {
+    Serial.println("ERROR: Aggregator setup failed");
+  }
   if (!transmission.setup()) {
     Serial.println("ERROR: Transmission setup failed");
   }
 
-  cadence.setSensorInterval(1000);
-  cadence.setTransmissionInterval(10000);
+  cadence.setSensorInterval(DEFAULT_SENSOR_INTERVAL_MS);
+  cadence.setTransmissionInterval(DEFAULT_TRANSMISSION_INTERVAL_MS);
 
   last_millis = millis();
   Serial.println("Initialization complete");
@@ -80,35 +130,86 @@ void loop() {
       Serial.println("WARNING: BSEC error detected");
     }
 
-    if (sensor.has_new_bsec_data()) {
-      SensorData data = sensor.get_data();
-
-      uint8_t encode_flags = 0;
-      EncoderResult result = encoder.encode(data, encode_flags);
-
-      if (result.status == ENCODER_OK) {
-        queue.push(result);
-        Serial.printf("Encoded data (len=%d, streak=%d, queue=%d/%d)\n",
-                      result.len, result.streak, queue.size(),
-                      queue.capacity());
+    // NOTE: a node that deep sleeps takes one sample per wake up, the
+    // samples of its batch are BATCH_INTERVAL_MS apart
+    if (sensor.has_new_bsec_data() && !(DEEP_SLEEP_MS && sampled)) {
+      if (batch.count == 0) {
+        batch.timestamp = batch.clock + current_millis;
+      }
+      batch.samples[batch.count++] = sensor.get_data();
+      sampled_at = current_millis;
+      sampled = true;
+
+      // NOTE: one payload per transmission interval, so the queue is no
+      // longer overwritten by the samples taken in between
+      if (batch.count == BATCH_MAX_SAMPLES) {
+        // NOTE: the oldest frames go to flash rather than being dropped,
+        // before the batch needs their room
+        spool.spill(queue);
+        // NOTE: the spool did not take them, the oldest frames are lost
+        while (queue.isFull()) {
+          queue.drop();
+        }
+        // NOTE: encoded straight into the queued frame, no staging copies
+        Frame &frame = *queue.reserve();
+        EncoderOutput out = {frame.payload(), 0, 0};
+        uint8_t status = encoder.encode_batch(
+            batch.samples, batch.count, batch.timestamp, BATCH_INTERVAL_MS,
+            ENCODE_DEADBAND, out);
+        // NOTE: a batch too long for a packet ends early, the samples it
+        // left open the next one
+        const uint8_t took =
+            status == ENCODER_FAILURE ? batch.count : out.count;
+        batch.count -= took;
+        memmove(batch.samples, batch.samples + took,
+                batch.count * sizeof(SensorData));
+        batch.timestamp += took * BATCH_INTERVAL_MS;
+
+        // NOTE: ENCODER_HOLD (nothing left the dead band) is not queued
+        if (status == ENCODER_OK) {
+          frame.flag = out.flag;
+          frame.len = out.len;
+          queue.commit();
+          Serial.printf("Encoded batch (len=%d, queue=%d frames, %d/%dB, "
+                        "spool=%d frames)\n",
+                        out.len, queue.size(), (int)queue.stats().bytes,
+                        queue.capacity(), (int)spool.size());
+        }
       }
     }
   }
 
   if (cadence.shouldTransmit()) {
-    if (!queue.isEmpty()) {
-      EncoderResult to_transmit;
-      queue.pop(to_transmit);
-
-      FrameBuffer_t frame;
-      uint16_t crc;
-      FrameHeader header = framing.frame(to_transmit, sequence++, frame, crc);
-
-      Serial.printf("Transmitting frame (seq=%d, len=%d, crc=0x%04X)\n",
-                    sequence - 1, header.len, crc);
-
-      transmission.transmit(frame, header.len);
-    } else {
+    // NOTE: the backlog in flash goes out once the live frames did
+    if (queue.isEmpty()) {
+      spool.refill(queue);
+    }
+    // NOTE: the queued frames wait for each other (see aggregator.h), a
+    // packet of several pays for one preamble
+    if (aggregator.ready(queue)) {
+      const uint16_t first = sequence;
+      const uint16_t len = aggregator.pack(queue, framing, sequence);
+
+      Serial.printf("Transmitting packet (frames=%d, len=%d, airtime=%dms, "
+                    "next seq=%d)\n",
+                    aggregator.frames(), len,
+                    (int)(lora::airtime_us(len) / 1000), sequence);
+
+      transmission.transmit(aggregator.packet(), len);
+
+      if (STATS_DUMP_FRAMES &&
+          sequence / STATS_DUMP_FRAMES != first / STATS_DUMP_FRAMES) {
+        stats::print(encoder.stats());
+        const QueueStats q = queue.stats();
+        Serial.printf("Queue: high water %dB (%d frames), %d dropped\n",
+                      (int)q.high_water, q.most_frames, (int)q.dropped);
+        const SpoolStats s = spool.stats();
+        Serial.printf("Spool: %d frames, %d dropped, %d torn, sectors "
+                      "erased %d to %d times\n",
+                      (int)s.frames, (int)s.dropped, (int)s.torn,
+                      (int)s.min_erases, (int)s.max_erases);
+      }
+    } else if (queue.isEmpty()) {
       if (sensor_ok) {
         Serial.println("No data to transmit");
       }
@@ -116,5 +217,20 @@ void loop() {
   }
 
   transmission.run(dt);
+
+  // NOTE: the queue lives in normal RAM, only sleep once it is empty and
+  // the radio is done, the open batch goes into the RTC memory with the
+  // sample of this wake up (see retained.h)
+  if (DEEP_SLEEP_MS && sampled && queue.isEmpty() && !transmission.busy()) {
+    // NOTE: the next sample one interval after this one
+    const uint32_t awake = current_millis - sampled_at;
+    const uint32_t sleep_ms = awake < DEEP_SLEEP_MS ? DEEP_SLEEP_MS - awake : 0;
+    batch.clock += current_millis + sleep_ms;
+    retained.save(encoder, sequence, &batch);
+    Serial.printf("Deep sleep for %dms (seq=%d, %d samples batched)\n",
+                  (int)sleep_ms, sequence, batch.count);
+    esp_sleep_enable_timer_wakeup((uint64_t)sleep_ms * 1000);
+    esp_deep_sleep_start();
+  }
   delay(10);
 }
@@ -0,0 +1,50 @@
+/**
+ *  @file Arduino.h
+ *  @brief Minimal Arduino core shim used to build the subsystems on a Linux
+ *  host (benchmarks and tools only, never part of the sketch)
+ *  */
+
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static inline uint64_t host_monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000ULL;
+}
+
+static inline uint32_t millis(void) {
+  return (uint32_t)(host_monotonic_us() / 1000ULL);
+}
+static inline uint32_t micros(void) { return (uint32_t)host_monotonic_us(); }
+
+static inline void delay(uint32_t ms) {
+  struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+
+/* stdout backed replacement for the HardwareSerial object */
+class HostSerial {
+public:
+  void begin(uint32_t baud) { (void)baud; }
+  size_t print(const char *s) { return fputs(s, stdout) < 0 ? 0 : strlen(s); }
+  size_t println(const char *s = "") { return printf("%s\n", s); }
+  size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vprintf(fmt, args);
+    va_end(args);
+    return n < 0 ? 0 : (size_t)n;
+  }
+};
+
+inline HostSerial Serial;
+
+#endif // HOST_ARDUINO_H_
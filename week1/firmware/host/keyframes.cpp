@@ -0,0 +1,314 @@
+#include "keyframes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEYFRAMES_X86 1
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace keyframes {
+
+/* bytes of every field in the keyframe, 0 outside the profile */
+constexpr uint8_t WIDTH[] = {
+#define X(id, member, ...)                                                     \
+  schema::present(FIELD_##id) ? sizeof(((SensorData *)0)->member) : 0,
+    SENSOR_FIELDS(X)
+#undef X
+};
+
+/* byte offset of a field in the keyframe */
+constexpr size_t wire_offset(size_t field) {
+  size_t n = 0;
+  for (size_t i = 0; i < field; i++) {
+    n += WIDTH[i];
+  }
+  return n;
+}
+
+template <size_t I>
+static inline void decode_field(const uint8_t *in, size_t r,
+                                SensorColumns &out) {
+  typedef schema::Field<I> F;
+  Column<I>::get(out)[r] =
+      (typename F::type)schema::take<typename F::wire>(in + wire_offset(I));
+}
+
+template <size_t... I>
+static size_t decode_scalar(const uint8_t *in, size_t first, size_t count,
+                            SensorColumns &out, std::index_sequence<I...>) {
+  for (size_t r = first; r < count; r++) {
+    (decode_field<I>(in + r * STRIDE, r, out), ...);
+  }
+  return count;
+}
+
+#ifdef KEYFRAMES_X86
+
+/* NOTE: the shuffles turn every keyframe into 16 little endian 16 bit slots
+ * (a 4 byte field takes two, low word first), eight keyframes of slots are
+ * then transposed into one vector per slot, ie. eight values of a column */
+constexpr uint8_t SLOTS = 16;
+
+constexpr size_t slot(size_t field) {
+  size_t n = 0;
+  for (size_t i = 0; i < field; i++) {
+    n += WIDTH[i] == 4 ? 2 : WIDTH[i] != 0;
+  }
+  return n;
+}
+
+constexpr bool simd_layout() {
+  for (size_t i = 0; i < FIELD_COUNT; i++) {
+    if (WIDTH[i] > 2 && WIDTH[i] != 4) {
+      return false;
+    }
+  }
+  // NOTE: a keyframe is read as its first and its last 16 bytes
+  return slot(FIELD_COUNT) <= SLOTS && STRIDE >= 16 && STRIDE <= 32;
+}
+
+/* pshufb controls for the two loads of a keyframe (0x80 yields zero) */
+struct Shuffle {
+  uint8_t head[2][16]; // bytes 0..15
+  uint8_t tail[2][16]; // bytes STRIDE - 16 .. STRIDE - 1
+};
+
+constexpr Shuffle build_shuffle() {
+  Shuffle s{};
+  for (size_t v = 0; v < 2; v++) {
+    for (size_t b = 0; b < 16; b++) {
+      s.head[v][b] = 0x80;
+      s.tail[v][b] = 0x80;
+    }
+  }
+  // source byte of every output byte, -1 for zero
+  int source[2 * SLOTS] = {};
+  for (size_t b = 0; b < 2 * SLOTS; b++) {
+    source[b] = -1;
+  }
+  for (size_t f = 0; f < FIELD_COUNT; f++) {
+    if (WIDTH[f] == 0) {
+      continue;
+    }
+    const int o = (int)wire_offset(f);
+    const size_t k = 2 * slot(f);
+    if (WIDTH[f] == 1) {
+      source[k] = o;
+    } else {
+      for (size_t b = 0; b < WIDTH[f]; b++) {
+        source[k + b] = o + WIDTH[f] - 1 - (int)b; // big endian
+      }
+    }
+  }
+  for (size_t b = 0; b < 2 * SLOTS; b++) {
+    if (source[b] < 0) {
+      continue;
+    }
+    if (source[b] < 16) {
+      s.head[b / 16][b % 16] = (uint8_t)source[b];
+    } else {
+      s.tail[b / 16][b % 16] = (uint8_t)(source[b] - (int)(STRIDE - 16));
+    }
+  }
+  return s;
+}
+
+alignas(16) static constexpr Shuffle SHUFFLE =
+    simd_layout() ? build_shuffle() : Shuffle{};
+
+/* 8x8 transpose of 16 bit lanes (per 128 bit lane for avx2) */
+#define TRANSPOSE(v, lo16, hi16, lo32, hi32, lo64, hi64, type)                 \
+  do {                                                                         \
+    type a[8], b[8];                                                           \
+    for (int i = 0; i < 4; i++) {                                              \
+      a[2 * i] = lo16(v[2 * i], v[2 * i + 1]);                                 \
+      a[2 * i + 1] = hi16(v[2 * i], v[2 * i + 1]);                             \
+    }                                                                          \
+    for (int i = 0; i < 2; i++) {                                              \
+      b[4 * i] = lo32(a[4 * i], a[4 * i + 2]);                                 \
+      b[4 * i + 1] = hi32(a[4 * i], a[4 * i + 2]);                             \
+      b[4 * i + 2] = lo32(a[4 * i + 1], a[4 * i + 3]);                         \
+      b[4 * i + 3] = hi32(a[4 * i + 1], a[4 * i + 3]);                         \
+    }                                                                          \
+    for (int i = 0; i < 4; i++) {                                              \
+      v[2 * i] = lo64(b[i], b[i + 4]);                                         \
+      v[2 * i + 1] = hi64(b[i], b[i + 4]);                                     \
+    }                                                                          \
+  } while (0)
+
+TARGET_SSE4 static inline void transpose_sse4(__m128i *v) {
+  TRANSPOSE(v, _mm_unpacklo_epi16, _mm_unpackhi_epi16, _mm_unpacklo_epi32,
+            _mm_unpackhi_epi32, _mm_unpacklo_epi64, _mm_unpackhi_epi64,
+            __m128i);
+}
+
+TARGET_AVX2 static inline void transpose_avx2(__m256i *v) {
+  TRANSPOSE(v, _mm256_unpacklo_epi16, _mm256_unpackhi_epi16,
+            _mm256_unpacklo_epi32, _mm256_unpackhi_epi32,
+            _mm256_unpacklo_epi64, _mm256_unpackhi_epi64, __m256i);
+}
+#undef TRANSPOSE
+
+/* sse4.1: eight keyframes per step */
+template <size_t I>
+TARGET_SSE4 static inline void store_sse4(const __m128i *slots, size_t r,
+                                          SensorColumns &out) {
+  typename schema::Field<I>::type *col = Column<I>::get(out) + r;
+  const __m128i v = slots[slot(I)];
+  if constexpr (WIDTH[I] == 1) {
+    _mm_storel_epi64((__m128i *)col, _mm_packus_epi16(v, v));
+  } else if constexpr (WIDTH[I] == 2) {
+    _mm_storeu_si128((__m128i *)col, v);
+  } else {
+    const __m128i hi = slots[slot(I) + 1];
+    _mm_storeu_si128((__m128i *)col, _mm_unpacklo_epi16(v, hi));
+    _mm_storeu_si128((__m128i *)(col + 4), _mm_unpackhi_epi16(v, hi));
+  }
+}
+
+template <size_t... I>
+TARGET_SSE4 static size_t decode_sse4(const uint8_t *in, size_t first,
+                                      size_t count, SensorColumns &out,
+                                      std::index_sequence<I...> fields) {
+  const __m128i head0 = _mm_load_si128((const __m128i *)SHUFFLE.head[0]);
+  const __m128i head1 = _mm_load_si128((const __m128i *)SHUFFLE.head[1]);
+  const __m128i tail0 = _mm_load_si128((const __m128i *)SHUFFLE.tail[0]);
+  const __m128i tail1 = _mm_load_si128((const __m128i *)SHUFFLE.tail[1]);
+  // NOTE: a local copy, the stores can not alias the column pointers
+  SensorColumns cols = out;
+
+  size_t r = first;
+  for (; r + 8 <= count; r += 8) {
+    __m128i slots[SLOTS];
+    for (size_t k = 0; k < 8; k++) {
+      const uint8_t *p = in + (r + k) * STRIDE;
+      const __m128i head = _mm_loadu_si128((const __m128i *)p);
+      const __m128i tail = _mm_loadu_si128((const __m128i *)(p + STRIDE - 16));
+      slots[k] = _mm_or_si128(_mm_shuffle_epi8(head, head0),
+                              _mm_shuffle_epi8(tail, tail0));
+      slots[8 + k] = _mm_or_si128(_mm_shuffle_epi8(head, head1),
+                                  _mm_shuffle_epi8(tail, tail1));
+    }
+    transpose_sse4(slots);
+    transpose_sse4(slots + 8);
+    (store_sse4<I>(slots, r, cols), ...);
+  }
+  return decode_scalar(in, r, count, out, fields);
+}
+
+/* avx2: sixteen keyframes per step, keyframe k in the low 128 bit lane and
+ * k + 8 in the high one, so every column comes out in order */
+template <size_t I>
+TARGET_AVX2 static inline void store_avx2(const __m256i *slots, size_t r,
+                                          SensorColumns &out) {
+  typename schema::Field<I>::type *col = Column<I>::get(out) + r;
+  const __m256i v = slots[slot(I)];
+  if constexpr (WIDTH[I] == 1) {
+    const __m256i packed =
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+    _mm_storeu_si128((__m128i *)col, _mm256_castsi256_si128(packed));
+  } else if constexpr (WIDTH[I] == 2) {
+    _mm256_storeu_si256((__m256i *)col, v);
+  } else {
+    const __m256i hi = slots[slot(I) + 1];
+    const __m256i a = _mm256_unpacklo_epi16(v, hi); // 0..3, 8..11
+    const __m256i b = _mm256_unpackhi_epi16(v, hi); // 4..7, 12..15
+    _mm256_storeu_si256((__m256i *)col, _mm256_permute2x128_si256(a, b, 0x20));
+    _mm256_storeu_si256((__m256i *)(col + 8),
+                        _mm256_permute2x128_si256(a, b, 0x31));
+  }
+}
+
+TARGET_AVX2 static inline __m256i load_pair(const uint8_t *low,
+                                            const uint8_t *high) {
+  return _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)low)),
+      _mm_loadu_si128((const __m128i *)high), 1);
+}
+
+template <size_t... I>
+TARGET_AVX2 static size_t decode_avx2(const uint8_t *in, size_t count,
+                                      SensorColumns &out,
+                                      std::index_sequence<I...> fields) {
+  const __m256i head0 = _mm256_broadcastsi128_si256(
+      _mm_load_si128((const __m128i *)SHUFFLE.head[0]));
+  const __m256i head1 = _mm256_broadcastsi128_si256(
+      _mm_load_si128((const __m128i *)SHUFFLE.head[1]));
+  const __m256i tail0 = _mm256_broadcastsi128_si256(
+      _mm_load_si128((const __m128i *)SHUFFLE.tail[0]));
+  const __m256i tail1 = _mm256_broadcastsi128_si256(
+      _mm_load_si128((const __m128i *)SHUFFLE.tail[1]));
+  SensorColumns cols = out;
+
+  size_t r = 0;
+  for (; r + 16 <= count; r += 16) {
+    __m256i slots[SLOTS];
+    for (size_t k = 0; k < 8; k++) {
+      const uint8_t *p = in + (r + k) * STRIDE;
+      const uint8_t *q = p + 8 * STRIDE;
+      const __m256i head = load_pair(p, q);
+      const __m256i tail = load_pair(p + STRIDE - 16, q + STRIDE - 16);
+      slots[k] = _mm256_or_si256(_mm256_shuffle_epi8(head, head0),
+                                 _mm256_shuffle_epi8(tail, tail0));
+      slots[8 + k] = _mm256_or_si256(_mm256_shuffle_epi8(head, head1),
+                                     _mm256_shuffle_epi8(tail, tail1));
+    }
+    transpose_avx2(slots);
+    transpose_avx2(slots + 8);
+    (store_avx2<I>(slots, r, cols), ...);
+  }
+  // NOTE: the last 8 to 15 keyframes still fill an sse4.1 step
+  return decode_sse4(in, r, count, out, fields);
+}
+
+#endif // KEYFRAMES_X86
+
+Isa best_isa() {
+#ifdef KEYFRAMES_X86
+  if (simd_layout()) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+      return ISA_SSE4;
+    }
+  }
+#endif
+  return ISA_SCALAR;
+}
+
+const char *isa_name(Isa isa) {
+  switch (isa) {
+  case ISA_AVX2:
+    return "avx2";
+  case ISA_SSE4:
+    return "sse4.1";
+  default:
+    return "scalar";
+  }
+}
+
+size_t decode(const uint8_t *in, size_t count, SensorColumns &out) {
+  static const Isa isa = best_isa();
+  return decode(in, count, out, isa);
+}
+
+size_t decode(const uint8_t *in, size_t count, SensorColumns &out, Isa isa) {
+  if (isa > best_isa()) {
+    return 0;
+  }
+  switch (isa) {
+#ifdef KEYFRAMES_X86
+  case ISA_AVX2:
+    return decode_avx2(in, count, out, schema::Fields{});
+  case ISA_SSE4:
+    return decode_sse4(in, 0, count, out, schema::Fields{});
+#endif
+  default:
+    return decode_scalar(in, 0, count, out, schema::Fields{});
+  }
+}
+
+} // namespace keyframes
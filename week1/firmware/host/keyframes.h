@@ -0,0 +1,50 @@
+/**
+ *  @file keyframes.h
+ *  @brief Host only batch decoder for archived full width keyframes (the
+ *  layout of schema::encode_keyframe), unpacked into one column per field.
+ *  Uses AVX2 or SSE4.1 byte shuffles when the CPU has them, the scalar
+ *  loop otherwise.
+ *  */
+
+#ifndef KEYFRAMES_H_
+#define KEYFRAMES_H_
+
+#include "../subsystems/schema.h"
+
+namespace keyframes {
+
+/* bytes per keyframe in the input array */
+constexpr size_t STRIDE = schema::payload_len(schema::Fields{});
+
+/* struct of arrays, one column of `count` values per field, named after
+ * SENSOR_FIELDS (eg. columns.TEMPR[i]) */
+struct SensorColumns {
+#define X(id, member, ...) decltype(((SensorData *)0)->member) *id;
+  SENSOR_FIELDS(X)
+#undef X
+};
+
+template <size_t I> struct Column;
+#define X(id, ...)                                                             \
+  template <> struct Column<FIELD_##id> {                                      \
+    static typename schema::Field<FIELD_##id>::type *get(SensorColumns &c) {   \
+      return c.id;                                                             \
+    }                                                                          \
+  };
+SENSOR_FIELDS(X)
+#undef X
+
+enum Isa : uint8_t { ISA_SCALAR, ISA_SSE4, ISA_AVX2 };
+
+/* widest instruction set both the build and the CPU support */
+Isa best_isa();
+const char *isa_name(Isa isa);
+
+/* decode `count` keyframes laid out back to back (STRIDE bytes each),
+ * returns the number decoded (0 if `isa` is not available) */
+size_t decode(const uint8_t *in, size_t count, SensorColumns &out);
+size_t decode(const uint8_t *in, size_t count, SensorColumns &out, Isa isa);
+
+} // namespace keyframes
+
+#endif // KEYFRAMES_H_
@@ -28,6 +28,8 @@ struct Mq135Data {
     uint8_t digital;
 };
 
+/* NOTE: the fields that go over the air are described once in
+ * SENSOR_FIELDS (subsystems/schema.h), keep it in sync with these structures */
 struct SensorData {
     BsecData bsec_data;
     Mq135Data mq135_data;
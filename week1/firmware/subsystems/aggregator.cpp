@@ -0,0 +1,109 @@
+#include "aggregator.h"
+#include <string.h>
+
+bool Aggregator::setup() {
+  len = 0;
+  count = 0;
+  waited = 0;
+  walked = nullptr;
+  walked_bytes = 0;
+  walked_front = 0;
+  set_budget(AGGREGATE_MAX_BYTES, (uint32_t)AGGREGATE_MAX_AIRTIME_MS * 1000,
+             AGGREGATE_MAX_WAIT);
+  return true;
+}
+
+void Aggregator::run(uint16_t dt) { (void)dt; }
+
+void Aggregator::set_budget(uint16_t bytes, uint32_t airtime_us,
+                            uint8_t wait) {
+  max_bytes = bytes < AGGREGATE_MAX_BYTES ? bytes : AGGREGATE_MAX_BYTES;
+  max_airtime_us = airtime_us;
+  max_wait = wait;
+}
+
+bool Aggregator::fits(uint16_t bytes) const {
+  return bytes <= max_bytes && lora::airtime_us(bytes) <= max_airtime_us;
+}
+
+bool Aggregator::ready(Queue &queue) {
+  if (queue.isEmpty()) {
+    waited = 0;
+    walked = nullptr;
+    return false;
+  }
+  // NOTE: a full queue goes out whatever the wait, the next frame has no
+  // room
+  if (++waited >= max_wait || queue.isFull()) {
+    return true;
+  }
+  /* NOTE: the walk goes on from the last frame counted, over the frames
+   * queued since, and starts over once the front moved (pack(), a spill or
+   * a drop released frames) */
+  if (walked == nullptr || queue.releases() != walked_front) {
+    walked = nullptr;
+    walked_bytes = 0;
+    walked_front = queue.releases();
+  }
+  /* NOTE: a frame not sealed yet is counted with the longest header, so the
+   * packet may go out with room for one more frame left, a slot early */
+  for (const Frame *frame = walked ? queue.next(walked) : queue.front();
+       frame && fits(walked_bytes); frame = queue.next(frame)) {
+    walked_bytes += frame->sealed
+                        ? frame->len
+                        : 1 + FRAME_CODED_LEN(frame->len) + FRAMING_COBS;
+    walked = frame;
+  }
+  return !fits(walked_bytes);
+}
+
+uint16_t Aggregator::pack(Queue &queue, Framing &framing, uint16_t &sequence) {
+  len = 0;
+  count = 0;
+  waited = 0;
+  for (Frame *frame = queue.front(); frame; frame = queue.front()) {
+    if (!frame->sealed) {
+      uint16_t crc;
+      framing.finalize(*frame, sequence++, crc);
+    }
+    if (count && !fits(len + frame->len)) {
+      break;
+    }
+    memcpy(buffer + len, frame->data(), frame->len);
+    len += frame->len;
+    count++;
+    queue.release();
+  }
+  return len;
+}
+
+bool Splitter::setup() {
+  deframer.begin();
+  left = 0;
+  return true;
+}
+
+void Splitter::run(uint16_t dt) { (void)dt; }
+
+void Splitter::begin(const uint8_t *packet, uint16_t len) {
+  this->packet = packet;
+  left = len;
+}
+
+bool Splitter::next() {
+  while (left > 0) {
+    uint8_t status;
+    const size_t took = deframer.feed(packet, left, status);
+    packet += took;
+    left -= took;
+    if (status == DEFRAME_FRAME) {
+      return true;
+    }
+  }
+#if FRAMING_COBS
+  // NOTE: a packet holds whole frames, a cut one must not swallow the first
+  // frame of the next packet
+  deframer.push(COBS_DELIMITER);
+#endif
+  return false;
+}
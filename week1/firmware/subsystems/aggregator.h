@@ -0,0 +1,93 @@
+/**
+ *  @file aggregator.h
+ *  @brief Packs the queued frames into as few radio packets as a byte and
+ *  an airtime budget allow, every packet pays the preamble and the PHY
+ *  header only once (see lora.h). A packet is nothing but whole frames back
+ *  to back, the gateway gets them out with the Splitter (a Deframer run
+ *  over one packet at a time).
+ *  */
+
+#ifndef AGGREGATOR_H_
+#define AGGREGATOR_H_
+
+#include "framing.h"
+#include "lora.h"
+#include "queue.h"
+#include "subsystem.h"
+
+/* budget of one packet, a frame over a smaller one still goes out alone */
+#ifndef AGGREGATE_MAX_BYTES
+#define AGGREGATE_MAX_BYTES LORA_MAX_PAYLOAD
+#endif
+// NOTE: the US915 dwell time, a full packet at SF7 125 kHz
+#ifndef AGGREGATE_MAX_AIRTIME_MS
+#define AGGREGATE_MAX_AIRTIME_MS 400
+#endif
+
+/* transmission slots the oldest frame waits for others to fill a packet
+ * with, 1: every slot sends whatever is queued */
+#ifndef AGGREGATE_MAX_WAIT
+#define AGGREGATE_MAX_WAIT 4
+#endif
+
+static_assert(AGGREGATE_MAX_BYTES <= LORA_MAX_PAYLOAD,
+              "a packet is at most LORA_MAX_PAYLOAD bytes");
+// NOTE: the radio takes the length as a byte, a longer frame goes out cut
+static_assert(MAX_FRAME_LEN <= LORA_MAX_PAYLOAD,
+              "a frame fits a packet of its own, lower BATCH_MAX_LEN");
+
+#define AGGREGATE_BUFFER_LEN LORA_MAX_PAYLOAD
+
+class Aggregator : public Subsystem {
+private:
+  uint8_t buffer[AGGREGATE_BUFFER_LEN];
+  uint16_t len;
+  uint8_t count;  // frames in the packet
+  uint8_t waited; // slots since the oldest frame could have gone out
+  // NOTE: where ready() left its walk over the queue, see Queue::releases()
+  const Frame *walked; // last frame counted, nullptr: none
+  uint16_t walked_bytes;
+  uint16_t walked_front;
+  uint16_t max_bytes;
+  uint32_t max_airtime_us;
+  uint8_t max_wait;
+  bool fits(uint16_t bytes) const;
+
+public:
+  bool setup();
+  void run(uint16_t dt);
+  /* budget from now on (setup() sets the AGGREGATE_* ones) */
+  void set_budget(uint16_t bytes, uint32_t airtime_us, uint8_t wait);
+  /* once per transmission slot, true when the queue should go out now: it
+   * holds a full packet, its oldest frame waited long enough or it is full */
+  bool ready(Queue &queue);
+  /* seals the oldest frames (Framing::finalize) and packs as many as fit
+   * into the packet, releases them from the queue and returns the packet
+   * length. A sealed frame that did not fit is the first of the next one */
+  uint16_t pack(Queue &queue, Framing &framing, uint16_t &sequence);
+  uint8_t *packet() { return buffer; }
+  uint8_t frames() const { return count; }
+};
+
+/* gateway side, the frames of one packet at a time:
+ *   splitter.begin(payload, size);
+ *   while (splitter.next()) { splitter.frame() ... }
+ * the Deframer carries on from packet to packet, so its counters cover the
+ * whole link */
+class Splitter : public Subsystem {
+private:
+  Deframer deframer;
+  const uint8_t *packet;
+  uint16_t left;
+
+public:
+  bool setup();
+  void run(uint16_t dt);
+  void begin(const uint8_t *packet, uint16_t len);
+  /* false once the packet is used up */
+  bool next();
+  const DeframedFrame &frame() const { return deframer.frame(); }
+  const DeframerStats &stats() const { return deframer.stats(); }
+};
+
+#endif // AGGREGATOR_H_
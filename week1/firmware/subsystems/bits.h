@@ -0,0 +1,110 @@
+/**
+ *  @file bits.h
+ *  @brief MSB first bit stream writer and reader over a byte buffer
+ *  */
+
+#ifndef BITS_H_
+#define BITS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* NOTE: the codec folds call write()/read() once per field, gcc stops
+ * inlining them after a few calls which costs more than the packing itself */
+#define BITS_INLINE inline __attribute__((always_inline))
+
+class BitWriter {
+private:
+  uint8_t *buffer;
+  uint16_t capacity; // in bytes
+  uint16_t pos;      // bytes completed so far
+  uint64_t acc;      // pending bits, right aligned
+  uint8_t count;     // number of pending bits (always < 32 between writes)
+  bool overflowed;
+
+  void drain() {
+    while (count >= 8) {
+      count -= 8;
+      if (pos < capacity) {
+        buffer[pos++] = (uint8_t)(acc >> count);
+      } else {
+        overflowed = true;
+      }
+    }
+  }
+
+public:
+  BitWriter(uint8_t *buffer, uint16_t capacity)
+      : buffer(buffer), capacity(capacity), pos(0), acc(0), count(0),
+        overflowed(false) {}
+
+  /* append the low `bits` bits of value (bits <= 32) */
+  BITS_INLINE void write(uint32_t value, uint8_t bits) {
+    acc = (acc << bits) | (value & (((uint64_t)1 << bits) - 1));
+    count += bits;
+    // NOTE: spill a whole word only once 32 bits are pending, keeps the per
+    // field cost to a shift and an or (and write() small enough to inline)
+    if (count >= 32) {
+      count -= 32;
+      if (pos + 4 <= capacity) {
+        uint32_t word = (uint32_t)(acc >> count);
+        buffer[pos++] = (uint8_t)(word >> 24);
+        buffer[pos++] = (uint8_t)(word >> 16);
+        buffer[pos++] = (uint8_t)(word >> 8);
+        buffer[pos++] = (uint8_t)word;
+      } else {
+        overflowed = true;
+      }
+    }
+  }
+
+  /* pad the last byte with zeros, returns the length in bytes */
+  uint16_t flush() {
+    if (count % 8) {
+      write(0, 8 - count % 8);
+    }
+    drain();
+    return pos;
+  }
+
+  uint32_t bits() const { return 8 * (uint32_t)pos + count; }
+  bool overflow() const { return overflowed; }
+};
+
+class BitReader {
+private:
+  const uint8_t *buffer;
+  uint16_t len; // in bytes
+  uint16_t pos; // bytes consumed so far
+  uint64_t acc;
+  uint8_t count;
+  bool overflowed;
+
+public:
+  BitReader(const uint8_t *buffer, uint16_t len)
+      : buffer(buffer), len(len), pos(0), acc(0), count(0),
+        overflowed(false) {}
+
+  /* read `bits` bits (bits <= 32), reading past the end yields zeros */
+  BITS_INLINE uint32_t read(uint8_t bits) {
+    while (count < bits) {
+      uint8_t b = 0;
+      if (pos < len) {
+        b = buffer[pos];
+      } else {
+        overflowed = true;
+      }
+      pos++;
+      acc = (acc << 8) | b;
+      count += 8;
+    }
+    count -= bits;
+    return (uint32_t)((acc >> count) & (((uint64_t)1 << bits) - 1));
+  }
+
+  /* bytes touched so far, the partially read last byte included */
+  uint16_t consumed() const { return pos; }
+  bool overflow() const { return overflowed; }
+};
+
+#endif // BITS_H_
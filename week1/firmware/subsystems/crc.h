@@ -0,0 +1,271 @@
+/**
+ *  @file crc.h
+ *  @brief CRC engine shared by the node framing, the base station packets
+ *  and the Modbus master. This is the only source: the Modbus master takes
+ *  it from here (-I in its Makefile), the base station sketch gets a copy
+ *  by `make bstation` and `make check` fails when that copy drifted. A CRC
+ *  is described by its register type, polynomial, initial value, bit order
+ *  and final xor, its lookup tables are generated at compile time.
+ *
+ *  Variants, all giving the same result:
+ *    BITWISE  8 shifts per byte, no table (the reference)
+ *    TABLE    one 256 entry table, a byte per lookup
+ *    SLICE4   4 tables, 4 bytes per step
+ *    SLICE8   8 tables, 8 bytes per step
+ *    CLMUL    x86 hosts only, carry-less multiply folding of 16 byte blocks
+ *             (PCLMULQDQ), the tail goes through SLICE8
+ *  */
+
+#ifndef CRC_H_
+#define CRC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_CLMUL 1
+#define CRC_TARGET_CLMUL __attribute__((target("pclmul,ssse3")))
+#endif
+
+/* variant used when none is given: at frame sizes (16 to 32 bytes) slice
+ * by 4 is the fastest table variant, for 2 KB of tables with a 16 bit CRC
+ * (see bench/crc_bench), crc::TABLE gets it down to 512 bytes */
+#ifndef CRC_DEFAULT_VARIANT
+#define CRC_DEFAULT_VARIANT crc::SLICE4
+#endif
+
+namespace crc {
+
+enum Variant : uint8_t { BITWISE, TABLE, SLICE4, SLICE8, CLMUL };
+
+/* CLMUL falls back to SLICE8 without PCLMULQDQ (and off x86) */
+static inline bool has_clmul() {
+#ifdef CRC_CLMUL
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+#else
+  return false;
+#endif
+}
+
+/* table k maps a byte to its remainder after k more zero bytes */
+template <typename T, size_t N> struct Tables {
+  T t[N][256];
+};
+
+/* low `bits` bits of v in reverse order */
+constexpr uint64_t reflect(uint64_t v, uint8_t bits) {
+  uint64_t r = 0;
+  for (uint8_t i = 0; i < bits; i++) {
+    r = (r << 1) | ((v >> i) & 1);
+  }
+  return r;
+}
+
+template <typename T, T Poly, T Init, bool Reflected, T XorOut = 0>
+struct Crc {
+  typedef T type;
+  static constexpr uint8_t WIDTH = 8 * sizeof(T);
+  static constexpr T TOP = (T)((T)1 << (WIDTH - 1));
+  static constexpr T REVERSED = (T)reflect(Poly, WIDTH);
+
+  static constexpr T bitwise_byte(T crc, uint8_t b) {
+    if constexpr (Reflected) {
+      crc ^= b;
+      for (uint8_t j = 0; j < 8; j++) {
+        crc = (crc & 1) ? (T)((crc >> 1) ^ REVERSED) : (T)(crc >> 1);
+      }
+    } else {
+      crc ^= (T)((T)b << (WIDTH - 8));
+      for (uint8_t j = 0; j < 8; j++) {
+        crc = (crc & TOP) ? (T)((T)(crc << 1) ^ Poly) : (T)(crc << 1);
+      }
+    }
+    return crc;
+  }
+
+  template <size_t N> static constexpr Tables<T, N> build() {
+    Tables<T, N> s{};
+    for (size_t b = 0; b < 256; b++) {
+      s.t[0][b] = bitwise_byte(0, (uint8_t)b);
+    }
+    for (size_t k = 1; k < N; k++) {
+      for (size_t b = 0; b < 256; b++) {
+        const T c = s.t[k - 1][b];
+        s.t[k][b] = Reflected
+                        ? (T)((c >> 8) ^ s.t[0][c & 0xFF])
+                        : (T)((T)(c << 8) ^ s.t[0][(c >> (WIDTH - 8)) & 0xFF]);
+      }
+    }
+    return s;
+  }
+
+  // NOTE: only the tables of the variants actually called end up in flash
+  template <size_t N> static constexpr Tables<T, N> TABLES = build<N>();
+
+  static constexpr T begin() { return Init; }
+  static constexpr T finish(T crc) { return (T)(crc ^ XorOut); }
+
+  static constexpr T update_bitwise(T crc, const uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      crc = bitwise_byte(crc, p[i]);
+    }
+    return crc;
+  }
+
+  static inline T table_byte(const T (&t)[256], T crc, uint8_t b) {
+    if constexpr (Reflected) {
+      return (T)((WIDTH > 8 ? crc >> 8 : 0) ^ t[(crc ^ b) & 0xFF]);
+    } else {
+      return (T)((WIDTH > 8 ? (T)(crc << 8) : 0) ^
+                 t[((crc >> (WIDTH - 8)) ^ b) & 0xFF]);
+    }
+  }
+
+  static inline T update_table(T crc, const uint8_t *p, size_t len) {
+    const T(&t)[256] = TABLES<1>.t[0];
+    for (size_t i = 0; i < len; i++) {
+      crc = table_byte(t, crc, p[i]);
+    }
+    return crc;
+  }
+
+  /* N bytes per step, the register is folded into the first of them */
+  template <size_t N>
+  static inline T update_slice(T crc, const uint8_t *p, size_t len) {
+    static_assert(WIDTH <= 8 * N, "a slice holds the whole register");
+    const Tables<T, N> &s = TABLES<N>;
+    for (; len >= N; len -= N, p += N) {
+      uint64_t v = 0;
+      for (size_t b = 0; b < N; b++) {
+        v |= Reflected ? (uint64_t)p[b] << (8 * b)
+                       : (uint64_t)p[b] << (8 * (N - 1 - b));
+      }
+      v ^= Reflected ? (uint64_t)crc : (uint64_t)crc << (8 * N - WIDTH);
+      T c = 0;
+      for (size_t b = 0; b < N; b++) {
+        // NOTE: the first byte of the stream has the most bytes after it
+        c ^= s.t[Reflected ? N - 1 - b : b][(v >> (8 * b)) & 0xFF];
+      }
+      crc = c;
+    }
+    for (size_t i = 0; i < len; i++) {
+      crc = table_byte(s.t[0], crc, p[i]);
+    }
+    return crc;
+  }
+
+#ifdef CRC_CLMUL
+  /* x^k mod P */
+  static constexpr uint64_t xpow(uint16_t k) {
+    uint64_t r = 1;
+    const uint64_t top = (uint64_t)1 << WIDTH;
+    for (uint16_t i = 0; i < k; i++) {
+      r <<= 1;
+      if (r & top) {
+        r ^= top | Poly;
+      }
+    }
+    return r;
+  }
+
+  /* NOTE: a block A of 128 bits followed by more data counts as
+   * A_hi x^192 + A_lo x^128 (mod P), two products of less than 80 bits that
+   * fold into the next block. Reflected, bit j of a register is x^(127-j)
+   * and a product comes out one bit short, which the x^(k-1) constants
+   * make up for */
+  static constexpr uint64_t FOLD_LO =
+      Reflected ? reflect(xpow(191), 64) : xpow(128);
+  static constexpr uint64_t FOLD_HI =
+      Reflected ? reflect(xpow(127), 64) : xpow(192);
+
+  CRC_TARGET_CLMUL static inline __m128i load_block(const uint8_t *p) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)p);
+    if constexpr (Reflected) {
+      return v;
+    } else {
+      const __m128i swap =
+          _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+      return _mm_shuffle_epi8(v, swap);
+    }
+  }
+
+  CRC_TARGET_CLMUL static T update_clmul(T crc, const uint8_t *p,
+                                         size_t len) {
+    if (len < 32) {
+      return update_slice<8>(crc, p, len);
+    }
+    // NOTE: the register xored into the first bytes is the same as starting
+    // from it, the blocks are then folded from a zero register
+    __m128i acc = load_block(p);
+    acc = _mm_xor_si128(
+        acc, Reflected ? _mm_set_epi64x(0, (long long)crc)
+                       : _mm_set_epi64x(
+                             (long long)((uint64_t)crc << (64 - WIDTH)), 0));
+    const __m128i k = _mm_set_epi64x((long long)FOLD_HI, (long long)FOLD_LO);
+    for (p += 16, len -= 16; len >= 16; p += 16, len -= 16) {
+      acc = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(acc, k, 0x00),
+                                        _mm_clmulepi64_si128(acc, k, 0x11)),
+                          load_block(p));
+    }
+    alignas(16) uint8_t rest[16];
+    _mm_store_si128((__m128i *)rest, load_block((const uint8_t *)&acc));
+    crc = update_slice<8>(0, rest, 16);
+    return update_slice<8>(crc, p, len);
+  }
+#endif
+
+  template <Variant V = CRC_DEFAULT_VARIANT>
+  static inline T update(T crc, const uint8_t *p, size_t len) {
+    if constexpr (V == BITWISE) {
+      return update_bitwise(crc, p, len);
+    } else if constexpr (V == SLICE4) {
+      return update_slice<4>(crc, p, len);
+    } else if constexpr (V == SLICE8) {
+      return update_slice<8>(crc, p, len);
+    } else if constexpr (V == CLMUL) {
+#ifdef CRC_CLMUL
+      static const bool ok = has_clmul();
+      return ok ? update_clmul(crc, p, len) : update_slice<8>(crc, p, len);
+#else
+      return update_slice<8>(crc, p, len);
+#endif
+    } else {
+      return update_table(crc, p, len);
+    }
+  }
+
+  /* whole message: begin(), update(), finish() */
+  template <Variant V = CRC_DEFAULT_VARIANT>
+  static inline T compute(const uint8_t *p, size_t len) {
+    return finish(update<V>(begin(), p, len));
+  }
+
+  /* table bytes a variant puts in flash */
+  static constexpr size_t table_bytes(Variant v) {
+    return v == BITWISE  ? 0
+           : v == TABLE  ? sizeof(Tables<T, 1>)
+           : v == SLICE4 ? sizeof(Tables<T, 4>)
+                         : sizeof(Tables<T, 8>);
+  }
+
+  /* the catalogue check value, CRC of the ASCII digits 1 to 9 */
+  static constexpr T check() {
+    const uint8_t digits[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    return finish(update_bitwise(begin(), digits, sizeof(digits)));
+  }
+};
+
+/* CRC-16/MODBUS (reflected 0x8005, ie. 0xA001), the node frames and the
+ * Modbus RTU soil sensors */
+typedef Crc<uint16_t, 0x8005, 0xFFFF, true> Modbus;
+static_assert(Modbus::check() == 0x4B37, "CRC-16/MODBUS check value");
+
+/* CRC-16/CCITT-FALSE (0x1021, MSB first), the base station packets */
+typedef Crc<uint16_t, 0x1021, 0xFFFF, false> CcittFalse;
+static_assert(CcittFalse::check() == 0x29B1, "CRC-16/CCITT-FALSE check value");
+
+} // namespace crc
+
+#endif // CRC_H_
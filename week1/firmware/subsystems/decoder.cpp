@@ -2,194 +2,292 @@
 #include <string.h>
 
 bool Decoder::setup() {
-  memset(&state, 0, sizeof(state));
+  memset(state, 0, sizeof(*state));
+  state->sensors = SENSOR_PROFILE;
   return true;
 }
 
 void Decoder::run(uint16_t dt) { (void)dt; }
 
-DecoderResult Decoder::decode_no_delta(const uint8_t *data, flag_t flags) {
+/* NOTE: a node of another variant only sends the fields of its sensors,
+ * any profile within the one of the gateway decodes */
+static bool decodable(uint8_t sensors) {
+  return sensors != 0 && (sensors & ~(SENSOR_PROFILE)) == 0;
+}
+
+uint16_t Decoder::decode_keyframe(SensorData &data, const uint8_t *in,
+                                  uint16_t len, flag_t flags,
+                                  uint8_t sensors) {
+  return schema::with_fields(sensors, [&](auto fields) -> uint16_t {
+    if (flags & FLAG_PACKED) {
+      return schema::decode_packed_keyframe(data, in, len, fields);
+    }
+    if (len < schema::payload_len(fields)) {
+      return 0;
+    }
+    return schema::decode_keyframe(data, in, fields);
+  });
+}
+
+DecoderResult Decoder::decode_no_delta(const uint8_t *data, uint16_t len,
+                                       flag_t flags) {
   DecoderResult result;
+  memset(&result, 0, sizeof(result));
+
+  const uint8_t sensors = (flags & FLAG_KEYFRAME) >> FLAG_PRESN_SHIFT;
+  if (!decodable(sensors) ||
+      decode_keyframe(result.data, data, len, flags, sensors) != len) {
+    result.status = DECODER_FAILURE;
+    return result;
+  }
+
   result.status = DECODER_OK;
-  uint16_t idx = 0;
+  state->data = result.data;
+  state->prev = result.data;
+  memset(&state->predictors, 0, sizeof(state->predictors));
+  state->sensors = sensors;
+  return result;
+}
 
-  int16_t temp = (data[idx] << 8) | data[idx + 1];
-  idx += 2;
-  if (flags & FLAG_NEG_TEMPR) {
-    temp = -temp;
+/* the residuals of a delta, varint or entropy payload from `len` on, over
+ * the fields of the node. Moves `len` past them, false if the bit stream
+ * ran past the payload */
+template <size_t... I>
+static bool decode_residuals(const EncoderResult &encoded, uint16_t &len,
+                             SensorData prev2, SensorData prev,
+                             const schema::PredictorMap &predictors,
+                             SensorData &data,
+                             std::index_sequence<I...> fields) {
+  // NOTE: lossy residuals are between quantization indices of the state
+  if (encoded.flag & FLAG_LOSSY) {
+    schema::quantize(prev2, prev2, fields);
+    schema::quantize(prev, prev, fields);
   }
-  result.data.bsec_data.temperature = temp;
 
-  result.data.bsec_data.humidity = (data[idx] << 8) | data[idx + 1];
-  idx += 2;
+  if (encoded.flag & FLAG_ENTROPY) {
+    const uint8_t n = entropy::decode(prev2, prev, data, predictors,
+                                      encoded.data + len, encoded.len - len,
+                                      fields);
+    // NOTE: 0 means the bit stream ran past the payload or is corrupt
+    if (n == 0) {
+      return false;
+    }
+    len += n;
+  } else if (encoded.flag & FLAG_VARINT) {
+    len += schema::decode_varints(prev2, prev, data, encoded.data + len,
+                                  predictors, fields);
+  } else {
+    len += schema::decode_deltas(prev2, prev, data, encoded.data + len,
+                                 encoded.flag, predictors, fields);
+  }
 
-  result.data.bsec_data.pressure =
-      ((uint32_t)data[idx] << 24) | ((uint32_t)data[idx + 1] << 16) |
-      ((uint32_t)data[idx + 2] << 8) | data[idx + 3];
-  idx += 4;
+  if (encoded.flag & FLAG_LOSSY) {
+    schema::dequantize(data, data, fields);
+  }
+  return true;
+}
 
-  result.data.bsec_data.iaq = (data[idx] << 8) | data[idx + 1];
-  idx += 2;
+/* the varint records of a batch behind its first sample, from `idx` on.
+ * Returns how many samples it holds then */
+template <size_t... I>
+static uint8_t decode_records(const EncoderBatch &encoded, uint16_t &idx,
+                              uint8_t count,
+                              const schema::PredictorMap &predictors,
+                              SensorData *data,
+                              std::index_sequence<I...> fields) {
+  /* NOTE: a record only starts where the longest one fits, as the encoder
+   * has it, so even a corrupt batch can not read past the buffer */
+  uint8_t i = 1;
+  for (; i < count && idx <= encoded.len &&
+         idx + schema::varint_payload_len(fields) <= BATCH_MAX_LEN;
+       i++) {
+    SensorData prev2 = data[i > 1 ? i - 2 : 0], prev = data[i - 1];
+    if (encoded.flag & FLAG_LOSSY) {
+      schema::quantize(prev2, prev2, fields);
+      schema::quantize(prev, prev, fields);
+    }
+    idx += schema::decode_varints(prev2, prev, data[i], encoded.data + idx,
+                                  predictors, fields);
+    if (encoded.flag & FLAG_LOSSY) {
+      schema::dequantize(data[i], data[i], fields);
+    }
+  }
+  return i;
+}
 
-  result.data.bsec_data.iaqAccuracy = data[idx++];
+DecoderResult Decoder::decode(const EncoderResult &encoded) {
+  // NOTE: the dead band held every field, repeat the last sample
+  if ((encoded.flag & FLAG_HOLD) && encoded.len == 0) {
+    DecoderResult result;
+    result.status = DECODER_OK;
+    result.data = state->data;
+    result.lost = 0;
+    return result;
+  }
 
-  result.data.bsec_data.staticIaq = (data[idx] << 8) | data[idx + 1];
-  idx += 2;
+  DecoderResult result;
+  memset(&result, 0, sizeof(result));
 
-  result.data.bsec_data.co2Equivalent = (data[idx] << 8) | data[idx + 1];
-  idx += 2;
+  // NOTE: a batch holds several samples, it goes through decode_batch()
+  if (encoded.flag & FLAG_BATCH) {
+    result.status = DECODER_FAILURE;
+    return result;
+  }
 
-  result.data.bsec_data.breathVoc = (data[idx] << 8) | data[idx + 1];
-  idx += 2;
+  if (encoded.flag & FLAG_KEYFRAME) {
+    return decode_no_delta(encoded.data, encoded.len, encoded.flag);
+  }
 
-  result.data.bsec_data.gasPercentage = data[idx++];
-  result.data.bsec_data.stabStatus = (data[idx] >> 4) & 0x0F;
-  result.data.bsec_data.runInStatus = data[idx++] & 0x0F;
+  schema::PredictorMap predictors = state->predictors;
+  uint16_t len = 0;
+  if (encoded.flag & FLAG_PREDICT) {
+    if (encoded.len < schema::PRED_MAP_LEN ||
+        !schema::take_predictors(encoded.data, predictors)) {
+      result.status = DECODER_FAILURE;
+      return result;
+    }
+    len = schema::PRED_MAP_LEN;
+  }
 
-  result.data.mq135_data.analog =
-      ((uint16_t)data[idx] << 4) | ((data[idx + 1] >> 4) & 0x0F);
-  result.data.anemo_data =
-      (((uint16_t)data[idx + 1] & 0x0F) << 8) | data[idx + 2];
+  const bool ok = schema::with_fields(state->sensors, [&](auto fields) {
+    return decode_residuals(encoded, len, state->prev, state->data,
+                            predictors, result.data, fields);
+  });
 
-  state.data = result.data;
+  /* NOTE: a length mismatch means the flags and the payload disagree, the
+   * state is left untouched so the chain is not poisoned */
+  if (!ok || len != encoded.len) {
+    result.status = DECODER_FAILURE;
+    return result;
+  }
+
+  result.status = DECODER_OK;
+  state->prev = state->data;
+  state->data = result.data;
+  state->predictors = predictors;
   return result;
 }
 
-DecoderResult Decoder::decode(const EncoderResult &encoded) {
-  DecoderResult result;
-  result.status = DECODER_OK;
+DecoderBatch Decoder::decode_batch(const EncoderBatch &encoded) {
+  DecoderBatch batch;
+  memset(&batch, 0, sizeof(batch));
+  batch.status = DECODER_FAILURE;
 
-  if (encoded.flag & FLAG_PRESN_BME680) {
-    return decode_no_delta(encoded.data, encoded.flag);
+  if (!(encoded.flag & FLAG_BATCH) || encoded.len < schema::BATCH_HEADER_LEN ||
+      encoded.len > BATCH_MAX_LEN) {
+    return batch;
   }
 
+  // NOTE: no PRESN flags, a node of every sensor
+  const uint8_t sensors =
+      encoded.flag & FLAG_KEYFRAME
+          ? (encoded.flag & FLAG_KEYFRAME) >> FLAG_PRESN_SHIFT
+          : SENSOR_ALL;
+  const uint8_t *in = encoded.data;
   uint16_t idx = 0;
-  flag_t flags = encoded.flag;
-  SensorData delta;
-  memset(&delta, 0, sizeof(delta));
-
-  if (flags & FLAG_DELTA_TEMPR) {
-    delta.bsec_data.temperature = encoded.data[idx++];
-  } else {
-    delta.bsec_data.temperature =
-        (encoded.data[idx] << 8) | encoded.data[idx + 1];
-    idx += 2;
-  }
-  if (flags & FLAG_NEG_TEMPR) {
-    delta.bsec_data.temperature = -delta.bsec_data.temperature;
+  const uint8_t count = in[idx++];
+  if (!decodable(sensors) || count == 0 || count > BATCH_MAX_SAMPLES) {
+    return batch;
   }
+  batch.timestamp = schema::take<uint32_t>(in + idx);
+  idx += 4;
+  batch.interval = schema::take<uint16_t>(in + idx);
+  idx += 2;
 
-  if (flags & FLAG_DELTA_HUMID) {
-    delta.bsec_data.humidity = encoded.data[idx++];
-  } else {
-    delta.bsec_data.humidity = (encoded.data[idx] << 8) | encoded.data[idx + 1];
-    idx += 2;
-  }
-  if (flags & FLAG_NEG_HUMID) {
-    delta.bsec_data.humidity = -delta.bsec_data.humidity;
+  schema::PredictorMap predictors;
+  memset(&predictors, 0, sizeof(predictors));
+  if (encoded.flag & FLAG_PREDICT) {
+    if (!schema::take_predictors(in + idx, predictors)) {
+      return batch;
+    }
+    idx += schema::PRED_MAP_LEN;
   }
 
-  if (flags & FLAG_DELTA_PRESR) {
-    delta.bsec_data.pressure = encoded.data[idx++];
-  } else {
-    delta.bsec_data.pressure = ((uint32_t)encoded.data[idx] << 24) |
-                               ((uint32_t)encoded.data[idx + 1] << 16) |
-                               ((uint32_t)encoded.data[idx + 2] << 8) |
-                               encoded.data[idx + 3];
-    idx += 4;
-  }
-  if (flags & FLAG_NEG_PRESR) {
-    delta.bsec_data.pressure = -delta.bsec_data.pressure;
+  const uint16_t len = decode_keyframe(batch.data[0], in + idx,
+                                       encoded.len - idx, encoded.flag,
+                                       sensors);
+  if (len == 0) {
+    return batch;
   }
+  idx += len;
 
-  if (flags & FLAG_DELTA_IAQ) {
-    delta.bsec_data.iaq = encoded.data[idx++];
-  } else {
-    delta.bsec_data.iaq = (encoded.data[idx] << 8) | encoded.data[idx + 1];
-    idx += 2;
-  }
-  if (flags & FLAG_NEG_IAQ) {
-    delta.bsec_data.iaq = -delta.bsec_data.iaq;
+  const uint8_t i = schema::with_fields(sensors, [&](auto fields) {
+    return decode_records(encoded, idx, count, predictors, batch.data,
+                          fields);
+  });
+  if (i != count || idx != encoded.len) {
+    return batch;
   }
 
-  delta.bsec_data.iaqAccuracy = encoded.data[idx++];
+  batch.status = DECODER_OK;
+  batch.count = count;
+  state->prev = batch.data[count > 1 ? count - 2 : 0];
+  state->data = batch.data[count - 1];
+  state->predictors = predictors;
+  state->sensors = sensors;
+  return batch;
+}
 
-  if (flags & FLAG_DELTA_STIAQ) {
-    delta.bsec_data.staticIaq = encoded.data[idx++];
-  } else {
-    delta.bsec_data.staticIaq =
-        (encoded.data[idx] << 8) | encoded.data[idx + 1];
-    idx += 2;
+/* NOTE: sequence numbers wrap, a frame less than half the range ahead of
+ * the last one follows it (`missed` frames in between), anything else is a
+ * duplicate or came late and only a keyframe (eg. after a reboot of the
+ * node) is taken from it */
+bool Decoder::track(uint16_t sequence, uint8_t bits, bool keyframe,
+                    uint16_t &missed) {
+  // NOTE: ahead by less than half the range of the sequence
+  const uint16_t mask = (uint16_t)((1u << bits) - 1);
+  const uint16_t step = (uint16_t)(sequence - state->sequence) & mask;
+  const bool ahead = !state->tracking || (step != 0 && step <= mask >> 1);
+  missed = ahead && state->tracking ? step - 1 : 0;
+  if (!ahead && !keyframe) {
+    return false;
   }
-  if (flags & FLAG_NEG_STIAQ) {
-    delta.bsec_data.staticIaq = -delta.bsec_data.staticIaq;
+  state->sequence = sequence;
+  state->tracking = true;
+  if (missed) {
+    state->synced = false;
   }
+  return true;
+}
 
-  if (flags & FLAG_DELTA_CO2EQ) {
-    delta.bsec_data.co2Equivalent = encoded.data[idx++];
-  } else {
-    delta.bsec_data.co2Equivalent =
-        (encoded.data[idx] << 8) | encoded.data[idx + 1];
-    idx += 2;
-  }
-  if (flags & FLAG_NEG_CO2EQ) {
-    delta.bsec_data.co2Equivalent = -delta.bsec_data.co2Equivalent;
+DecoderResult Decoder::decode(const EncoderResult &encoded,
+                              uint16_t sequence, uint8_t sequence_bits) {
+  DecoderResult result;
+  memset(&result, 0, sizeof(result));
+  result.status = DECODER_FAILURE;
+
+  const bool keyframe = encoded.flag & FLAG_KEYFRAME;
+  uint16_t missed;
+  if (!track(sequence, sequence_bits, keyframe, missed)) {
+    return result;
   }
 
-  if (flags & FLAG_DELTA_BTVOC) {
-    delta.bsec_data.breathVoc = encoded.data[idx++];
+  if (!keyframe && !state->synced) {
+    result.status = DECODER_GAP;
   } else {
-    delta.bsec_data.breathVoc =
-        (encoded.data[idx] << 8) | encoded.data[idx + 1];
-    idx += 2;
-  }
-  if (flags & FLAG_NEG_BTVOC) {
-    delta.bsec_data.breathVoc = -delta.bsec_data.breathVoc;
+    result = decode(encoded);
   }
 
-  delta.bsec_data.gasPercentage = encoded.data[idx++];
-  delta.bsec_data.stabStatus = (encoded.data[idx] >> 4) & 0x0F;
-  delta.bsec_data.runInStatus = encoded.data[idx++] & 0x0F;
-
-  if ((flags & FLAG_DELTA_MQ135) && (flags & FLAG_DELTA_ANEMO)) {
-    delta.mq135_data.analog = (encoded.data[idx] >> 4) & 0x0F;
-    delta.anemo_data = encoded.data[idx++] & 0x0F;
-  } else {
-    delta.mq135_data.analog = ((uint16_t)encoded.data[idx] << 4) |
-                              ((encoded.data[idx + 1] >> 4) & 0x0F);
-    delta.anemo_data =
-        (((uint16_t)encoded.data[idx + 1] & 0x0F) << 8) | encoded.data[idx + 2];
-    idx += 3;
-  }
-  if (flags & FLAG_NEG_MQ135) {
-    delta.mq135_data.analog = -delta.mq135_data.analog;
-  }
-  if (flags & FLAG_NEG_ANEMO) {
-    delta.anemo_data = -delta.anemo_data;
-  }
-
-  result.data.bsec_data.temperature =
-      state.data.bsec_data.temperature + delta.bsec_data.temperature;
-  result.data.bsec_data.humidity =
-      state.data.bsec_data.humidity + delta.bsec_data.humidity;
-  result.data.bsec_data.pressure =
-      state.data.bsec_data.pressure + delta.bsec_data.pressure;
-  result.data.bsec_data.iaq = state.data.bsec_data.iaq + delta.bsec_data.iaq;
-  result.data.bsec_data.iaqAccuracy = delta.bsec_data.iaqAccuracy;
-  result.data.bsec_data.staticIaq =
-      state.data.bsec_data.staticIaq + delta.bsec_data.staticIaq;
-  result.data.bsec_data.co2Equivalent =
-      state.data.bsec_data.co2Equivalent + delta.bsec_data.co2Equivalent;
-  result.data.bsec_data.breathVoc =
-      state.data.bsec_data.breathVoc + delta.bsec_data.breathVoc;
-  result.data.bsec_data.gasPercentage = delta.bsec_data.gasPercentage;
-  result.data.bsec_data.stabStatus = delta.bsec_data.stabStatus;
-  result.data.bsec_data.runInStatus = delta.bsec_data.runInStatus;
-
-  result.data.mq135_data.analog =
-      state.data.mq135_data.analog + delta.mq135_data.analog;
-  result.data.anemo_data = state.data.anemo_data + delta.anemo_data;
-
-  state.data = result.data;
+  // NOTE: every frame but a batch carries a single sample
+  result.lost = missed + (result.status != DECODER_OK);
+  state->synced = result.status == DECODER_OK;
+  state->lost += result.lost;
   return result;
 }
+
+DecoderBatch Decoder::decode_batch(const EncoderBatch &encoded,
+                                   uint16_t sequence, uint8_t sequence_bits) {
+  // NOTE: every batch opens with a keyframe, there is nothing to resync
+  uint16_t missed;
+  track(sequence, sequence_bits, true, missed);
+  DecoderBatch batch = decode_batch(encoded);
+
+  /* NOTE: the node sends batches of the same size, the missed ones are
+   * counted as big as this one (or as full ones if it is corrupt) */
+  const uint32_t size =
+      batch.status == DECODER_OK ? batch.count : BATCH_MAX_SAMPLES;
+  batch.lost = missed * size + (batch.status != DECODER_OK) * size;
+  state->synced = batch.status == DECODER_OK;
+  state->lost += batch.lost;
+  return batch;
+}
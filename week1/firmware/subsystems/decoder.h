@@ -6,25 +6,65 @@
 
 struct DecoderState {
   SensorData data;
+  SensorData prev; // sample before data, for the linear predictor
+  schema::PredictorMap predictors;
+  uint8_t sensors;   // the node is built with, SENSOR_PROFILE until a keyframe
+  uint16_t sequence; // of the last frame seen, as it was received
+  bool tracking;     // a frame was seen, sequence is valid
+  bool synced;       // data is the node's state, deltas can be applied
+  uint32_t lost;     // samples lost since setup()
 };
 
 #define DECODER_OK 0x01
 #define DECODER_FAILURE 0x00
+#define DECODER_GAP 0x02 // delta after a lost frame, dropped until a keyframe
 
 struct DecoderResult {
   uint8_t status;
   SensorData data;
+  uint32_t lost; // samples lost right before this frame (this one included
+                 // unless the status is DECODER_OK)
+};
+
+struct DecoderBatch {
+  uint8_t status;
+  uint8_t count;
+  uint32_t timestamp; // of the first sample, sample i is at + i * interval
+  uint16_t interval;
+  SensorData data[BATCH_MAX_SAMPLES];
+  uint32_t lost; // as in DecoderResult
 };
 
 class Decoder : public Subsystem {
 private:
-  DecoderState state;
-  DecoderResult decode_no_delta(const uint8_t *encoded_data, flag_t flags);
+  DecoderState own;
+  DecoderState *state; // own, or the one of a node in a DecoderPool
+  uint16_t decode_keyframe(SensorData &data, const uint8_t *encoded_data,
+                           uint16_t len, flag_t flags, uint8_t sensors);
+  DecoderResult decode_no_delta(const uint8_t *encoded_data, uint16_t len,
+                                flag_t flags);
+  bool track(uint16_t sequence, uint8_t bits, bool keyframe,
+             uint16_t &missed);
 
 public:
+  Decoder() : state(&own) {}
+  Decoder(const Decoder &) = delete;
+  Decoder &operator=(const Decoder &) = delete;
+
   bool setup();
   void run(uint16_t dt);
+  /* decode into an outside state from now on (setup() clears it) */
+  void attach(DecoderState &node) { state = &node; }
   DecoderResult decode(const EncoderResult &result);
+  DecoderBatch decode_batch(const EncoderBatch &batch);
+  /* as above for a frame received with `sequence` (see FrameHeader), a gap
+   * in the sequence drops the deltas until the next keyframe. The sequence
+   * rolls over at `sequence_bits` (see sequence_bits() in framing.h) */
+  DecoderResult decode(const EncoderResult &result, uint16_t sequence,
+                       uint8_t sequence_bits = 16);
+  DecoderBatch decode_batch(const EncoderBatch &batch, uint16_t sequence,
+                            uint8_t sequence_bits = 16);
+  uint32_t lost() const { return state->lost; }
 };
 
 #endif // DECODER_H_
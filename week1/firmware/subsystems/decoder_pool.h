@@ -0,0 +1,171 @@
+/**
+ *  @file decoder_pool.h
+ *  @brief Decoder states of up to N nodes for a gateway, keyed by the device
+ *  id of the frame header. The ids live in an open addressing table of 4
+ *  byte entries (linear probing, at most half full) next to the states, the
+ *  least recently heard node gives its state up when the pool is full.
+ *  */
+
+#ifndef DECODER_POOL_H_
+#define DECODER_POOL_H_
+
+#include "decoder.h"
+#include "framing.h"
+#include <string.h>
+
+template <uint16_t N> class DecoderPool : public Subsystem {
+  static_assert(N > 0 && N < 0x8000, "DecoderPool holds 1 to 32767 nodes");
+
+private:
+  static constexpr uint16_t NONE = 0xFFFF;
+
+  static constexpr uint8_t table_bits() {
+    uint8_t bits = 1;
+    while (((uint32_t)1 << bits) < 2 * (uint32_t)N) {
+      bits++;
+    }
+    return bits;
+  }
+  static constexpr uint8_t BITS = table_bits();
+  static constexpr uint32_t MASK = ((uint32_t)1 << BITS) - 1;
+
+  struct Entry {
+    deviceid_t device;
+    uint16_t slot; // NONE: empty
+  };
+
+  Entry table[MASK + 1];
+  DecoderState states[N];
+  deviceid_t owner[N]; // device of every slot
+  uint16_t newer[N];   // LRU list, newest .. oldest
+  uint16_t older[N];
+  uint16_t newest;
+  uint16_t oldest;
+  uint16_t used;
+  uint32_t evictions;
+  Decoder worker;
+
+  /* fibonacci hashing, consecutive ids land far apart */
+  static uint32_t home(deviceid_t device) {
+    return ((uint32_t)device * 2654435769u) >> (32 - BITS);
+  }
+
+  uint32_t probe(deviceid_t device) const {
+    uint32_t i = home(device);
+    while (table[i].slot != NONE && table[i].device != device) {
+      i = (i + 1) & MASK;
+    }
+    return i;
+  }
+
+  void unlink(uint16_t slot) {
+    if (newer[slot] != NONE) {
+      older[newer[slot]] = older[slot];
+    } else {
+      newest = older[slot];
+    }
+    if (older[slot] != NONE) {
+      newer[older[slot]] = newer[slot];
+    } else {
+      oldest = newer[slot];
+    }
+  }
+
+  void push_newest(uint16_t slot) {
+    newer[slot] = NONE;
+    older[slot] = newest;
+    if (newest != NONE) {
+      newer[newest] = slot;
+    } else {
+      oldest = slot;
+    }
+    newest = slot;
+  }
+
+  /* NOTE: backward shift deletion (no tombstones), every entry after the
+   * hole that may live there moves up so the probes stay short */
+  void erase(uint32_t hole) {
+    uint32_t j = hole;
+    for (;;) {
+      j = (j + 1) & MASK;
+      if (table[j].slot == NONE) {
+        break;
+      }
+      const uint32_t k = home(table[j].device);
+      const bool stays = hole <= j ? (hole < k && k <= j) : (hole < k || k <= j);
+      if (!stays) {
+        table[hole] = table[j];
+        hole = j;
+      }
+    }
+    table[hole].slot = NONE;
+  }
+
+  /* state slot of a device, a new one starts from scratch (DECODER_GAP until
+   * its first keyframe) */
+  uint16_t acquire(deviceid_t device) {
+    uint32_t i = probe(device);
+    if (table[i].slot != NONE) {
+      const uint16_t slot = table[i].slot;
+      if (slot != newest) {
+        unlink(slot);
+        push_newest(slot);
+      }
+      return slot;
+    }
+
+    uint16_t slot;
+    if (used < N) {
+      slot = used++;
+    } else {
+      slot = oldest;
+      unlink(slot);
+      erase(probe(owner[slot]));
+      evictions++;
+      i = probe(device); // the erase may have moved the empty entry
+    }
+    table[i].device = device;
+    table[i].slot = slot;
+    owner[slot] = device;
+    push_newest(slot);
+    worker.attach(states[slot]);
+    worker.setup();
+    return slot;
+  }
+
+public:
+  bool setup() {
+    memset(table, 0xFF, sizeof(table));
+    newest = NONE;
+    oldest = NONE;
+    used = 0;
+    evictions = 0;
+    return true;
+  }
+
+  void run(uint16_t dt) { (void)dt; }
+
+  DecoderResult decode(deviceid_t device, const EncoderResult &result,
+                       uint16_t sequence, uint8_t sequence_bits = 16) {
+    worker.attach(states[acquire(device)]);
+    return worker.decode(result, sequence, sequence_bits);
+  }
+
+  DecoderBatch decode_batch(deviceid_t device, const EncoderBatch &batch,
+                            uint16_t sequence, uint8_t sequence_bits = 16) {
+    worker.attach(states[acquire(device)]);
+    return worker.decode_batch(batch, sequence, sequence_bits);
+  }
+
+  /* state of a device heard from, nullptr otherwise */
+  const DecoderState *find(deviceid_t device) const {
+    const uint32_t i = probe(device);
+    return table[i].slot != NONE ? &states[table[i].slot] : nullptr;
+  }
+
+  uint16_t size() const { return used; }
+  uint16_t capacity() const { return N; }
+  uint32_t evicted() const { return evictions; }
+};
+
+#endif // DECODER_POOL_H_
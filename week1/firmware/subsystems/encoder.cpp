@@ -1,250 +1,317 @@
 #include "encoder.h"
+#include <string.h>
 
-bool Encoder::setup() { return true; }
+bool Encoder::setup() {
+  memset(&state, 0, sizeof(state));
+  reset_stats();
+  // NOTE: the gateway can not know the state of a node that just booted
+  state.refresh = true;
+  keyframe_interval = KEYFRAME_INTERVAL;
+  return true;
+}
 
 void Encoder::run(uint16_t dt) { return; }
 
-EncoderResult Encoder::encode_no_delta(SensorData new_data) {
-  EncoderResult result;
-  flag_t flag = FLAG_PRESN_BME680 | FLAG_PRESN_MQ135 | FLAG_PRESN_ANEMO;
-  uint8_t byte_index = 0;
-
-  int16_t temp = new_data.bsec_data.temperature;
-  if (temp < 0) {
-    flag |= FLAG_NEG_TEMPR;
-    temp = -temp;
+bool Encoder::set_predictor(uint8_t field, uint8_t predictor) {
+  if (field >= FIELD_COUNT || !schema::DELTA[field] ||
+      predictor >= schema::PRED_COUNT) {
+    return false;
   }
-  result.data[byte_index++] = (temp >> 8) & 0xFF;
-  result.data[byte_index++] = temp & 0xFF;
+  if (state.predictors.field[field] != predictor) {
+    state.predictors.field[field] = predictor;
+    state.announce = true;
+  }
+  return true;
+}
 
-  result.data[byte_index++] = (new_data.bsec_data.humidity >> 8) & 0xFF;
-  result.data[byte_index++] = new_data.bsec_data.humidity & 0xFF;
+void Encoder::set_keyframe_interval(uint16_t frames) {
+  keyframe_interval = frames;
+}
 
-  result.data[byte_index++] = (new_data.bsec_data.pressure >> 24) & 0xFF;
-  result.data[byte_index++] = (new_data.bsec_data.pressure >> 16) & 0xFF;
-  result.data[byte_index++] = (new_data.bsec_data.pressure >> 8) & 0xFF;
-  result.data[byte_index++] = new_data.bsec_data.pressure & 0xFF;
+void Encoder::request_keyframe() { state.refresh = true; }
 
-  result.data[byte_index++] = (new_data.bsec_data.iaq >> 8) & 0xFF;
-  result.data[byte_index++] = new_data.bsec_data.iaq & 0xFF;
+const EncoderState &Encoder::save() const { return state; }
 
-  result.data[byte_index++] = new_data.bsec_data.iaqAccuracy;
+// NOTE: only sound once every frame encoded so far went out, see retained.h
+void Encoder::restore(const EncoderState &saved) { state = saved; }
 
-  result.data[byte_index++] = (new_data.bsec_data.staticIaq >> 8) & 0xFF;
-  result.data[byte_index++] = new_data.bsec_data.staticIaq & 0xFF;
+const EncoderStats &Encoder::stats() const { return counters; }
 
-  result.data[byte_index++] = (new_data.bsec_data.co2Equivalent >> 8) & 0xFF;
-  result.data[byte_index++] = new_data.bsec_data.co2Equivalent & 0xFF;
+void Encoder::reset_stats() { memset(&counters, 0, sizeof(counters)); }
 
-  result.data[byte_index++] = (new_data.bsec_data.breathVoc >> 8) & 0xFF;
-  result.data[byte_index++] = new_data.bsec_data.breathVoc & 0xFF;
+/* on request, every keyframe_interval frames, or before the streak wraps */
+bool Encoder::keyframe_due() const {
+  return state.refresh ||
+         (keyframe_interval && state.streak + 1 >= keyframe_interval) ||
+         state.streak == UINT16_MAX;
+}
 
-  result.data[byte_index++] = new_data.bsec_data.gasPercentage;
-  result.data[byte_index++] = ((new_data.bsec_data.stabStatus & 0x0F) << 4) |
-                              (new_data.bsec_data.runInStatus & 0x0F);
+/* a keyframe restarts the history on both ends, the decoder falls back to
+ * the default predictors until it is told otherwise */
+void Encoder::reset_history(const SensorData &data) {
+  state.data = data;
+  state.prev = data;
+  state.announce = !schema::default_predictors(state.predictors);
+}
 
-  result.data[byte_index++] = (new_data.mq135_data.analog >> 4) & 0xFF;
-  result.data[byte_index++] = (new_data.mq135_data.analog & 0x0F) << 4 |
-                              (new_data.anemo_data >> 8) & 0x0F;
-  result.data[byte_index++] = new_data.anemo_data & 0xFF;
+uint8_t Encoder::encode_predictors(uint8_t *out, flag_t &flag) {
+  if (!state.announce) {
+    return 0;
+  }
+  state.announce = false;
+  flag |= FLAG_PREDICT;
+  return schema::put_predictors(out, state.predictors);
+}
 
-  result.status = ENCODER_OK;
-  result.flag = flag;
-  result.streak = 0;
-  result.len = byte_index;
+uint8_t Encoder::hold(EncoderOutput &out) {
+  out.flag = FLAG_HOLD;
+  out.len = 0;
+  return ENCODER_HOLD;
+}
 
-  state.data = new_data;
+uint8_t Encoder::encode_keyframe(const SensorData &data, uint8_t *out,
+                                 flag_t &flag) {
+  uint8_t len = schema::encode_packed_keyframe(data, out, schema::Fields{});
+  stats::tally_keyframe(len != 0, counters, schema::Fields{});
+  if (len) {
+    flag |= FLAG_PACKED;
+    return len;
+  }
+  // NOTE: out of range reading (eg. sensor fault), send it at full width
+  return schema::encode_keyframe(data, out, schema::Fields{});
+}
+
+uint8_t Encoder::encode_no_delta(const SensorData &new_data,
+                                 EncoderOutput &out) {
+  out.flag = FLAG_PRESN_PROFILE;
+  out.len = encode_keyframe(new_data, out.data, out.flag);
+
+  reset_history(new_data);
   state.streak = 0;
+  state.silence = 0;
+  state.refresh = false;
 
-  return result;
+  return ENCODER_OK;
+}
+
+void Encoder::encode_residuals(const SensorData &prev2,
+                               const SensorData &prev, const SensorData &next,
+                               uint8_t flags, EncoderOutput &out) {
+  uint8_t *at = out.data + out.len;
+  stats::Coding coding;
+  if (flags & ENCODE_ENTROPY) {
+    out.flag |= FLAG_ENTROPY;
+    out.len += entropy::encode(prev2, prev, next, state.predictors, at,
+                               schema::Fields{});
+    coding = stats::CODING_ENTROPY;
+  } else if (flags & ENCODE_VARINT) {
+    out.flag |= FLAG_VARINT;
+    out.len += schema::encode_varints(prev2, prev, next, at, state.predictors,
+                                      schema::Fields{});
+    coding = stats::CODING_VARINT;
+  } else {
+    out.len += schema::encode_deltas(prev2, prev, next, at, out.flag,
+                                     state.predictors, schema::Fields{});
+    coding = stats::CODING_DELTA;
+  }
+  stats::tally(prev2, prev, next, state.predictors, coding, counters,
+               schema::Fields{});
 }
 
 EncoderResult Encoder::encode(SensorData new_data, uint8_t flags) {
-  flag_t flag = 0;
+  EncoderResult result;
+  EncoderOutput out = {result.data, 0, 0};
+  result.status = encode(new_data, flags, out);
+  result.flag = out.flag;
+  result.streak = state.streak;
+  result.len = out.len;
+  result.count = out.count;
+  return result;
+}
 
+uint8_t Encoder::encode(const SensorData &sample, uint8_t flags,
+                        EncoderOutput &out) {
+  const uint8_t status = encode_sample(sample, flags, out);
+  out.count = 1;
+  stats::tally_frame(status == ENCODER_HOLD, out.len, false, counters);
+  return status;
+}
+
+uint8_t Encoder::encode_sample(const SensorData &sample, uint8_t flags,
+                               EncoderOutput &out) {
   if (flags & ENCODE_NO_DELTA) {
     // don't need delta encoding
-    return encode_no_delta(new_data);
+    return encode_no_delta(sample, out);
   }
 
-  /* Update the deltas and flags */
-  if ((flags & ENCODE_NO_ANEMO_DATA) == 0) {
-    if (new_data.anemo_data >= state.data.anemo_data) {
-      state.delta.anemo_data = new_data.anemo_data - state.data.anemo_data;
-    } else {
-      state.delta.anemo_data = -new_data.anemo_data + state.data.anemo_data;
-      flag |= FLAG_NEG_ANEMO;
-    }
+  // NOTE: the modes below rewrite the sample into what the decoder rebuilds
+  SensorData new_data = sample;
+
+  /* NOTE: the fields of a missing sensor repeat the previous value, which
+   * costs a single zero byte each (nothing at all in varint mode) */
+  if (flags & ENCODE_NO_SENSORS & (SENSOR_PROFILE)) {
+    schema::hold_sensors(new_data, state.data, flags & ENCODE_NO_SENSORS,
+                         schema::Fields{});
   }
-  if ((flags & ENCODE_NO_MQ135_DATA) == 0) {
-    if (new_data.mq135_data.analog >= state.data.mq135_data.analog) {
-      state.delta.mq135_data.analog =
-          new_data.mq135_data.analog - state.data.mq135_data.analog;
-    } else {
-      state.delta.mq135_data.analog =
-          -new_data.mq135_data.analog + state.data.mq135_data.analog;
-      flag |= FLAG_NEG_MQ135;
+
+  /* NOTE: the held sample is not part of the history (the decoder may never
+   * see it), a long silence is broken by a keyframe as a heartbeat, a
+   * requested keyframe is never held */
+  if ((flags & ENCODE_DEADBAND) && !state.refresh) {
+    if (schema::deadband(new_data, state.data, schema::Fields{})) {
+      if (++state.silence < DEADBAND_MAX_SILENCE) {
+        return hold(out);
+      }
+      return encode_no_delta(new_data, out);
     }
+    state.silence = 0;
   }
-  // NOTE: the digital field is unused
-  if ((flags & ENCODE_NO_BSEC_DATA) == 0) {
-    if (new_data.bsec_data.breathVoc >= state.data.bsec_data.breathVoc) {
-      state.delta.bsec_data.breathVoc =
-          new_data.bsec_data.breathVoc - state.data.bsec_data.breathVoc;
-    } else {
-      state.delta.bsec_data.breathVoc =
-          -new_data.bsec_data.breathVoc + state.data.bsec_data.breathVoc;
-      flag |= FLAG_NEG_BTVOC;
-    }
-    if (new_data.bsec_data.co2Equivalent >=
-        state.data.bsec_data.co2Equivalent) {
-      state.delta.bsec_data.co2Equivalent =
-          new_data.bsec_data.co2Equivalent - state.data.bsec_data.co2Equivalent;
-    } else {
-      state.delta.bsec_data.co2Equivalent = -new_data.bsec_data.co2Equivalent +
-                                            state.data.bsec_data.co2Equivalent;
-      flag |= FLAG_NEG_CO2EQ;
-    }
-    if (new_data.bsec_data.iaq >= state.data.bsec_data.iaq) {
-      state.delta.bsec_data.iaq =
-          new_data.bsec_data.iaq - state.data.bsec_data.iaq;
-    } else {
-      state.delta.bsec_data.iaq =
-          -new_data.bsec_data.iaq + state.data.bsec_data.iaq;
-      flag |= FLAG_NEG_IAQ;
-    }
-
-    /* NOTE: the iaq accuracy is already 1 byte, (using as it is)*/
-    /* NOTE: using stab and run in status as it is */
 
-    if (new_data.bsec_data.staticIaq >= state.data.bsec_data.staticIaq) {
-      state.delta.bsec_data.staticIaq =
-          new_data.bsec_data.staticIaq - state.data.bsec_data.staticIaq;
-    } else {
-      state.delta.bsec_data.staticIaq =
-          -new_data.bsec_data.staticIaq + state.data.bsec_data.staticIaq;
-      flag |= FLAG_NEG_STIAQ;
-    }
+  if (keyframe_due()) {
+    return encode_no_delta(new_data, out);
+  }
 
-    /* NOTE: gas percentage is just 1 byte, using as it is*/
+  out.flag = 0;
+  out.len = encode_predictors(out.data, out.flag);
 
-    if (new_data.bsec_data.temperature >= state.data.bsec_data.temperature) {
-      state.delta.bsec_data.temperature =
-          new_data.bsec_data.temperature - state.data.bsec_data.temperature;
-    } else {
-      state.delta.bsec_data.temperature =
-          -new_data.bsec_data.temperature + state.data.bsec_data.temperature;
-      flag |= FLAG_NEG_TEMPR;
-    }
-    if (new_data.bsec_data.humidity >= state.data.bsec_data.humidity) {
-      state.delta.bsec_data.humidity =
-          new_data.bsec_data.humidity - state.data.bsec_data.humidity;
-    } else {
-      state.delta.bsec_data.humidity =
-          -new_data.bsec_data.humidity + state.data.bsec_data.humidity;
-      flag |= FLAG_NEG_HUMID;
-    }
-    if (new_data.bsec_data.pressure >= state.data.bsec_data.pressure) {
-      state.delta.bsec_data.pressure =
-          new_data.bsec_data.pressure - state.data.bsec_data.pressure;
-    } else {
-      state.delta.bsec_data.pressure =
-          -new_data.bsec_data.pressure + state.data.bsec_data.pressure;
-      flag |= FLAG_NEG_PRESR;
-    }
+  /* NOTE: in lossy mode the residuals are taken between quantization indices
+   * and the state keeps the dequantized value, exactly what the decoder
+   * rebuilds, so the error does not add up along the streak */
+  if (flags & ENCODE_LOSSY) {
+    SensorData prev2, prev;
+    schema::quantize(state.prev, prev2, schema::Fields{});
+    schema::quantize(state.data, prev, schema::Fields{});
+    schema::quantize(new_data, new_data, schema::Fields{});
+    out.flag |= FLAG_LOSSY;
+    encode_residuals(prev2, prev, new_data, flags, out);
+    schema::dequantize(new_data, new_data, schema::Fields{});
+  } else {
+    encode_residuals(state.prev, state.data, new_data, flags, out);
   }
 
   /* Update the state */
+  state.prev = state.data;
   state.data = new_data;
   /* Update the streak */
   state.streak++;
 
-  /* Return the result */
-  EncoderResult result;
+  return ENCODER_OK;
+}
 
-  /* Check the bounds of the delta and fill the result.data buffer */
-  /* NOTE: the deltas should be within one byte range*/
-
-  uint8_t byte_index = 0;
-  if ((flag & ENCODE_NO_BSEC_DATA) == 0) {
-    if ((state.delta.bsec_data.temperature & 0xFF00) == 0) {
-      result.data[byte_index++] = state.delta.bsec_data.temperature & 0xFF;
-      flag |= FLAG_DELTA_TEMPR;
-    } else {
-      result.data[byte_index++] =
-          (state.delta.bsec_data.temperature >> 8) & 0xFF;
-      result.data[byte_index++] = state.delta.bsec_data.temperature & 0xFF;
-    }
-    if ((state.delta.bsec_data.humidity & 0xFF00) == 0) {
-      result.data[byte_index++] = state.delta.bsec_data.humidity & 0xFF;
-      flag |= FLAG_DELTA_HUMID;
-    } else {
-      result.data[byte_index++] = (state.delta.bsec_data.humidity >> 8) & 0xFF;
-      result.data[byte_index++] = state.delta.bsec_data.humidity & 0xFF;
-    }
-    if ((state.delta.bsec_data.pressure & 0xFFFFFF00) == 0) {
-      result.data[byte_index++] = state.delta.bsec_data.pressure & 0xFF;
-      flag |= FLAG_DELTA_PRESR;
-    } else {
-      result.data[byte_index++] = (state.delta.bsec_data.pressure >> 24) & 0xFF;
-      result.data[byte_index++] = (state.delta.bsec_data.pressure >> 16) & 0xFF;
-      result.data[byte_index++] = (state.delta.bsec_data.pressure >> 8) & 0xFF;
-      result.data[byte_index++] = state.delta.bsec_data.pressure & 0xFF;
+EncoderBatch Encoder::encode_batch(const SensorData *samples, uint8_t count,
+                                   uint32_t timestamp, uint16_t interval,
+                                   uint8_t flags) {
+  EncoderBatch result;
+  EncoderOutput out = {result.data, 0, 0};
+  result.status = encode_batch(samples, count, timestamp, interval, flags, out);
+  result.flag = out.flag;
+  result.streak = state.streak;
+  result.len = out.len;
+  result.count = out.count;
+  return result;
+}
+
+uint8_t Encoder::encode_batch(const SensorData *samples, uint8_t count,
+                              uint32_t timestamp, uint16_t interval,
+                              uint8_t flags, EncoderOutput &out) {
+  const uint8_t status =
+      encode_records(samples, count, timestamp, interval, flags, out);
+  if (status != ENCODER_FAILURE) {
+    stats::tally_frame(status == ENCODER_HOLD, out.len, true, counters);
+  }
+  return status;
+}
+
+uint8_t Encoder::encode_records(const SensorData *samples, uint8_t count,
+                                uint32_t timestamp, uint16_t interval,
+                                uint8_t flags, EncoderOutput &out) {
+  out.flag = FLAG_BATCH | FLAG_PRESN_BATCH;
+  out.len = 0;
+  out.count = 0;
+
+  // NOTE: the records are varints, a batch has no entropy coding
+  if (count == 0 || count > BATCH_MAX_SAMPLES || (flags & ENCODE_ENTROPY)) {
+    return ENCODER_FAILURE;
+  }
+
+  /* the dead band and the quantization rewrite the samples into what the
+   * decoder will rebuild, in order since each one refers to the last */
+  const EncoderState saved = state;
+  const EncoderStats tallied = counters;
+  SensorData rebuilt[BATCH_MAX_SAMPLES];
+  memcpy(rebuilt, samples, count * sizeof(SensorData));
+  // NOTE: the fields of a missing sensor repeat those of the sample before
+  if (flags & ENCODE_NO_SENSORS & (SENSOR_PROFILE)) {
+    schema::hold_sensors(rebuilt[0], state.data, flags & ENCODE_NO_SENSORS,
+                         schema::Fields{});
+    for (uint8_t i = 1; i < count; i++) {
+      schema::hold_sensors(rebuilt[i], rebuilt[i - 1],
+                           flags & ENCODE_NO_SENSORS, schema::Fields{});
     }
-    if ((state.delta.bsec_data.iaq & 0xFF00) == 0) {
-      result.data[byte_index++] = state.delta.bsec_data.iaq & 0xFF;
-      flag |= FLAG_DELTA_IAQ;
-    } else {
-      result.data[byte_index++] = (state.delta.bsec_data.iaq >> 8) & 0xFF;
-      result.data[byte_index++] = state.delta.bsec_data.iaq & 0xFF;
+  }
+  bool quiet = !state.refresh;
+  if ((flags & ENCODE_DEADBAND) && quiet) {
+    quiet = schema::deadband(rebuilt[0], state.data, schema::Fields{});
+  }
+
+  uint16_t idx = 0;
+  out.data[idx++] = count;
+  idx += schema::put<uint32_t>(out.data + idx, timestamp);
+  idx += schema::put<uint16_t>(out.data + idx, interval);
+
+  /* NOTE: every batch opens with a keyframe so a lost batch does not break
+   * the following ones, the deltas only chain inside the batch */
+  reset_history(rebuilt[0]);
+  idx += encode_predictors(out.data + idx, out.flag);
+  idx += encode_keyframe(rebuilt[0], out.data + idx, out.flag);
+  if (flags & ENCODE_LOSSY) {
+    out.flag |= FLAG_LOSSY;
+  }
+
+  /* NOTE: a record goes in only while the longest one would still fit, the
+   * rest of the samples are left to the next batch */
+  for (uint8_t i = 1; i < count; i++) {
+    if (idx + schema::varint_payload_len(schema::Fields{}) > BATCH_MAX_LEN) {
+      count = i;
+      break;
     }
-    /* NOTE: simply place iaq accuracy*/
-    result.data[byte_index++] = new_data.bsec_data.iaqAccuracy;
-    if ((state.delta.bsec_data.staticIaq & 0xFF00) == 0) {
-      result.data[byte_index++] = state.delta.bsec_data.staticIaq & 0xFF;
-      flag |= FLAG_DELTA_STIAQ;
-    } else {
-      result.data[byte_index++] = (state.delta.bsec_data.staticIaq >> 8) & 0xFF;
-      result.data[byte_index++] = state.delta.bsec_data.staticIaq & 0xFF;
+    SensorData &next = rebuilt[i];
+    SensorData prev2 = rebuilt[i > 1 ? i - 2 : 0], prev = rebuilt[i - 1];
+    if (flags & ENCODE_DEADBAND) {
+      quiet &= schema::deadband(next, prev, schema::Fields{});
     }
-    if ((state.delta.bsec_data.co2Equivalent & 0xFF00) == 0) {
-      result.data[byte_index++] = state.delta.bsec_data.co2Equivalent & 0xFF;
-      flag |= FLAG_DELTA_CO2EQ;
-    } else {
-      result.data[byte_index++] =
-          (state.delta.bsec_data.co2Equivalent >> 8) & 0xFF;
-      result.data[byte_index++] = state.delta.bsec_data.co2Equivalent & 0xFF;
+    if (flags & ENCODE_LOSSY) {
+      schema::quantize(prev2, prev2, schema::Fields{});
+      schema::quantize(prev, prev, schema::Fields{});
+      schema::quantize(next, next, schema::Fields{});
     }
-    if ((state.delta.bsec_data.breathVoc & 0xFF00) == 0) {
-      result.data[byte_index++] = state.delta.bsec_data.breathVoc & 0xFF;
-      flag |= FLAG_DELTA_BTVOC;
-    } else {
-      result.data[byte_index++] = (state.delta.bsec_data.breathVoc >> 8) & 0xFF;
-      result.data[byte_index++] = state.delta.bsec_data.breathVoc & 0xFF;
+    idx += schema::encode_varints(prev2, prev, next, out.data + idx,
+                                  state.predictors, schema::Fields{});
+    stats::tally(prev2, prev, next, state.predictors, stats::CODING_VARINT,
+                 counters, schema::Fields{});
+    if (flags & ENCODE_LOSSY) {
+      schema::dequantize(next, next, schema::Fields{});
     }
-    /* NOTE: encode gas percentage directly */
-    result.data[byte_index++] = new_data.bsec_data.gasPercentage & 0xFF;
-    result.data[byte_index++] = ((new_data.bsec_data.stabStatus & 0x0F) << 4) |
-                                (new_data.bsec_data.runInStatus & 0x0F);
-  }
-
-  if ((state.delta.mq135_data.analog & 0xFFF0) == 0 &&
-      (state.delta.anemo_data & 0xFFF0) == 0) {
-    result.data[byte_index++] = ((state.delta.mq135_data.analog & 0x0F) << 4) |
-                                (state.delta.anemo_data & 0x0F);
-    flag |= FLAG_DELTA_MQ135;
-    flag |= FLAG_DELTA_ANEMO;
-  } else {
-    /* fit the two 12 bit values in 3 byte */
-    result.data[byte_index++] = (state.delta.mq135_data.analog >> 4) & 0xFF;
-    result.data[byte_index++] = (state.delta.mq135_data.analog & 0x0F) |
-                                ((state.delta.anemo_data >> 8) & 0x0F);
-    result.data[byte_index++] = state.delta.anemo_data & 0xFF;
   }
 
-  result.status = ENCODER_OK;
-  result.flag = flag;
-  result.streak = state.streak;
-  result.len = byte_index;
-  return result;
+  out.data[0] = count;
+  out.count = count;
+
+  // NOTE: nothing left the dead band, drop the batch until the heartbeat
+  if ((flags & ENCODE_DEADBAND) && quiet &&
+      saved.silence + count < DEADBAND_MAX_SILENCE) {
+    state = saved;
+    state.silence += count;
+    counters = tallied; // none of the records went out
+    return hold(out);
+  }
+
+  state.prev = rebuilt[count > 1 ? count - 2 : 0];
+  state.data = rebuilt[count - 1];
+  state.streak = count - 1;
+  state.silence = 0;
+  state.refresh = false;
+
+  out.len = idx;
+  return ENCODER_OK;
 }
@@ -1,73 +1,191 @@
 #ifndef ENCODER_H_
 #define ENCODER_H_
 
-#include "sensor.h"
+#include "../meta.h"
+#include "entropy.h"
+#include "frame_len.h"
+#include "lora.h"
+#include "schema.h"
+#include "stats.h"
 #include "subsystem.h"
 
 /* flag macros */
-#define FLAG_DELTA_MQ135 1 << 0
-#define FLAG_DELTA_ANEMO 1 << 1
-#define FLAG_DELTA_BTVOC 1 << 2
-#define FLAG_DELTA_CO2EQ 1 << 3
-#define FLAG_DELTA_STIAQ 1 << 4
-#define FLAG_DELTA_IAQ 1 << 5
-#define FLAG_DELTA_PRESR 1 << 6
-#define FLAG_DELTA_HUMID 1 << 7
-#define FLAG_DELTA_TEMPR 1 << 8
-#define FLAG_PRESN_BTVOC 1 << 9
-#define FLAG_PRESN_CO2EQ 1 << 10
-#define FLAG_PRESN_STIAQ 1 << 11
-#define FLAG_PRESN_BME680 1 << 12
-#define FLAG_PRESN_MQ135 1 << 13
-#define FLAG_PRESN_ANEMO 1 << 14
-#define FLAG_PACKED_MQ135_ANEMO 1 << 15
-#define FLAG_NEG_MQ135 1 << 16
-#define FLAG_NEG_ANEMO 1 << 17
-#define FLAG_NEG_BTVOC 1 << 18
-#define FLAG_NEG_CO2EQ 1 << 19
-#define FLAG_NEG_STIAQ 1 << 20
-#define FLAG_NEG_IAQ 1 << 21
-#define FLAG_NEG_PRESR 1 << 22
-#define FLAG_NEG_HUMID 1 << 23
-#define FLAG_NEG_TEMPR 1 << 24
-
-typedef uint32_t flag_t; // flag interface
+// NOTE: the per field delta and sign bits are generated, see schema.h
+#define FLAG_DELTA(field) schema::delta_flag(field)
+#define FLAG_NEG(field) schema::neg_flag(field)
+#define FLAG_PRESN_BTVOC (1 << 9)
+#define FLAG_PRESN_CO2EQ (1 << 10)
+#define FLAG_PRESN_STIAQ (1 << 11)
+#define FLAG_PRESN_SHIFT 12
+#define FLAG_PRESN_BME680 (1 << 12)
+#define FLAG_PRESN_MQ135 (1 << 13)
+#define FLAG_PRESN_ANEMO (1 << 14)
+// NOTE: a keyframe carries the PRESN flags of the sensors in SENSOR_PROFILE
+#define FLAG_KEYFRAME (FLAG_PRESN_BME680 | FLAG_PRESN_MQ135 | FLAG_PRESN_ANEMO)
+#define FLAG_PRESN_PROFILE                                                     \
+  ((((SENSOR_PROFILE) & SENSOR_BME680) ? FLAG_PRESN_BME680 : 0) |              \
+   (((SENSOR_PROFILE) & SENSOR_MQ135) ? FLAG_PRESN_MQ135 : 0) |                \
+   (((SENSOR_PROFILE) & SENSOR_ANEMO) ? FLAG_PRESN_ANEMO : 0))
+#define FLAG_PACKED (1 << 15) // keyframe is bit packed to the field ranges
+#define FLAG_VARINT (1 << 25) // zigzag varint deltas, no per field flags
+#define FLAG_BATCH (1 << 26)  // keyframe then varint records, see schema.h
+#define FLAG_PREDICT (1 << 27) // payload opens with a new predictor map
+#define FLAG_ENTROPY (1 << 28) // huffman coded residuals, see entropy.h
+#define FLAG_HOLD (1 << 29)    // empty payload, nothing left the dead band
+#define FLAG_LOSSY (1 << 30)   // residuals of quantization indices
+
+/* NOTE: a batch opens with a keyframe and names the sensors as one does,
+ * but a node of every sensor leaves them out (a byte less in a v2 header) */
+#define FLAG_PRESN_BATCH                                                       \
+  (FLAG_PRESN_PROFILE == FLAG_KEYFRAME ? 0 : FLAG_PRESN_PROFILE)
+
+// NOTE: the PRESN bits are in the order of the SENSOR_* bits
+static_assert(FLAG_PRESN_PROFILE == (flag_t)(SENSOR_PROFILE)
+                                        << FLAG_PRESN_SHIFT,
+              "a keyframe claims the sensors of the profile, no other");
+static_assert(FLAG_KEYFRAME == (flag_t)SENSOR_ALL << FLAG_PRESN_SHIFT,
+              "a PRESN bit for every sensor");
 
 /* definition of the state structure of the encoder */
 struct EncoderState {
   SensorData data;
-  SensorData delta;
-  uint16_t streak; // steps since the delta encoding started
+  SensorData prev; // sample before data, for the linear predictor
+  schema::PredictorMap predictors;
+  bool announce;    // predictors differ from what the decoder knows
+  uint16_t streak;  // steps since the delta encoding started
+  uint16_t silence; // samples held by the dead band since the last report
+  bool refresh;     // the next frame must be a keyframe
 };
 
 #define ENCODER_OK 0x01
 #define ENCODER_FAILURE 0x00
+#define ENCODER_HOLD 0x02 // nothing to report, result is an empty FLAG_HOLD
+
+/* samples the dead band may hold in a row before a keyframe is forced as a
+ * heartbeat */
+#ifndef DEADBAND_MAX_SILENCE
+#define DEADBAND_MAX_SILENCE 60
+#endif
+
+/* frames from one keyframe to the next, a lost delta frame breaks the chain
+ * at the gateway until then (0: only on request or streak overflow) */
+#ifndef KEYFRAME_INTERVAL
+#define KEYFRAME_INTERVAL 32
+#endif
+
+// NOTE: a single sample in any mode, a batch has BATCH_MAX_LEN
+#define MAX_ENCODED_DATA_LEN                                                   \
+  schema::max_len(schema::MAX_PAYLOAD_LEN,                                     \
+                  schema::PRED_MAP_LEN + entropy::payload_len(schema::Fields{}))
 
-#define MAX_ENCODED_DATA_LEN 36
+/* payload bytes of a batch at most, encode_batch() ends a batch before a
+ * record could go past them and the samples left open the next one. By
+ * default a full batch, or as much of one as keeps its frame within a radio
+ * packet under the framing and the FEC built in */
+#ifndef BATCH_MAX_LEN
+#define BATCH_MAX_LEN                                                          \
+  (schema::batch_payload_len(BATCH_MAX_SAMPLES) <                              \
+           frame_payload_room(LORA_MAX_PAYLOAD)                                \
+       ? schema::batch_payload_len(BATCH_MAX_SAMPLES)                          \
+       : frame_payload_room(LORA_MAX_PAYLOAD))
+#endif
+static_assert(BATCH_MAX_LEN >= schema::batch_payload_len(1),
+              "a batch holds its first sample");
 
-struct EncoderResult {
+// NOTE: of any frame, what the queue and the gateway make room for
+#define MAX_FRAME_PAYLOAD_LEN                                                  \
+  (BATCH_MAX_LEN > MAX_ENCODED_DATA_LEN ? BATCH_MAX_LEN : MAX_ENCODED_DATA_LEN)
+
+/* a payload of N bytes at most, of a single sample (EncoderResult) or of a
+ * batch (EncoderBatch) */
+template <size_t N> struct Encoded {
   uint8_t status;
-  uint8_t data[MAX_ENCODED_DATA_LEN];
+  uint8_t data[N];
   flag_t flag;
   uint16_t streak;
-  uint8_t len;
+  uint16_t len;
+  uint8_t count; // samples it took, see encode_batch()
+};
+typedef Encoded<MAX_ENCODED_DATA_LEN> EncoderResult;
+typedef Encoded<BATCH_MAX_LEN> EncoderBatch;
+
+/* where a payload is encoded in place: MAX_ENCODED_DATA_LEN bytes at data
+ * (BATCH_MAX_LEN for a batch), eg. the payload of a queued Frame (see
+ * framing.h) */
+struct EncoderOutput {
+  uint8_t *data;
+  flag_t flag;
+  uint16_t len;
+  uint8_t count; // samples it took, see encode_batch()
 };
 
-#define ENCODE_NO_BSEC_DATA 1 << 0
-#define ENCODE_NO_MQ135_DATA 1 << 1
-#define ENCODE_NO_ANEMO_DATA 1 << 2
-#define ENCODE_NO_DELTA 1 << 3
+// NOTE: the sensor bits match SENSOR_*, the fields of a missing sensor are
+// held at their previous value
+#define ENCODE_NO_BSEC_DATA SENSOR_BME680
+#define ENCODE_NO_MQ135_DATA SENSOR_MQ135
+#define ENCODE_NO_ANEMO_DATA SENSOR_ANEMO
+#define ENCODE_NO_SENSORS                                                      \
+  (ENCODE_NO_BSEC_DATA | ENCODE_NO_MQ135_DATA | ENCODE_NO_ANEMO_DATA)
+#define ENCODE_NO_DELTA (1 << 3)
+#define ENCODE_VARINT (1 << 4)
+#define ENCODE_ENTROPY (1 << 5)
+#define ENCODE_DEADBAND (1 << 6) // report by exception, see SENSOR_FIELDS
+#define ENCODE_LOSSY (1 << 7)    // quantized to the steps of SENSOR_FIELDS
 
 class Encoder : public Subsystem {
 private:
   static Encoder *instance;
   EncoderState state;
-  EncoderResult encode_no_delta(SensorData new_state);
+  EncoderStats counters;
+  uint16_t keyframe_interval;
+  uint8_t encode_keyframe(const SensorData &data, uint8_t *out, flag_t &flag);
+  uint8_t encode_predictors(uint8_t *out, flag_t &flag);
+  void reset_history(const SensorData &data);
+  uint8_t hold(EncoderOutput &out);
+  uint8_t encode_no_delta(const SensorData &new_state, EncoderOutput &out);
+  bool keyframe_due() const;
+  uint8_t encode_sample(const SensorData &sample, uint8_t flags,
+                        EncoderOutput &out);
+  uint8_t encode_records(const SensorData *samples, uint8_t count,
+                         uint32_t timestamp, uint16_t interval, uint8_t flags,
+                         EncoderOutput &out);
+  void encode_residuals(const SensorData &prev2, const SensorData &prev,
+                        const SensorData &next, uint8_t flags,
+                        EncoderOutput &out);
 
 public:
   bool setup();
   void run(uint16_t dt);
   EncoderResult encode(SensorData new_state, uint8_t flags);
+  /* as above without the EncoderResult staging copy, returns the status */
+  uint8_t encode(const SensorData &new_state, uint8_t flags,
+                 EncoderOutput &out);
+  /* predictor (schema::PRED_*) of a delta field, announced to the decoder
+   * in the next delta frame */
+  bool set_predictor(uint8_t field, uint8_t predictor);
+  /* frames between periodic keyframes, 0 disables them */
+  void set_keyframe_interval(uint16_t frames);
+  /* the next frame is a keyframe (eg. the gateway lost track of the node) */
+  void request_keyframe();
+  /* the delta chain, to carry it through a deep sleep (see retained.h) */
+  const EncoderState &save() const;
+  void restore(const EncoderState &saved);
+  /* what went on the air since setup() or reset_stats() (see stats.h) */
+  const EncoderStats &stats() const;
+  void reset_stats();
+  /* `count` consecutive samples in a single payload, `timestamp` is the time
+   * of the first one and `interval` the spacing between them. A batch that
+   * would outgrow BATCH_MAX_LEN ends early, `count` of the result tells how
+   * many samples it took (held ones included). `flags` takes the
+   * ENCODE_NO_*_DATA flags, ENCODE_DEADBAND and ENCODE_LOSSY, the records
+   * are always varints after a keyframe (ENCODE_NO_DELTA and ENCODE_VARINT
+   * change nothing) and ENCODE_ENTROPY fails with ENCODER_FAILURE */
+  EncoderBatch encode_batch(const SensorData *samples, uint8_t count,
+                             uint32_t timestamp, uint16_t interval,
+                             uint8_t flags = 0);
+  uint8_t encode_batch(const SensorData *samples, uint8_t count,
+                       uint32_t timestamp, uint16_t interval, uint8_t flags,
+                       EncoderOutput &out);
 };
 
 #endif // ENCODER_H_
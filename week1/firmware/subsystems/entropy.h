@@ -0,0 +1,234 @@
+/**
+ *  @file entropy.h
+ *  @brief Canonical Huffman stage for the delta residuals. The code lengths
+ *  are trained offline from the base station captures (bench/entropy_train)
+ *  and compiled in, the codes themselves are rebuilt at compile time.
+ *
+ *  Payload, MSB first after the optional predictor map:
+ *    mask code           which fields differ from their prediction
+ *                        (escape: FIELD_COUNT raw bits follow)
+ *    residual code, ...  one per set mask bit, in table order: the code of
+ *                        the bit length of the residual, then its bits below
+ *                        the leading one (as in JPEG's magnitude categories)
+ *  */
+
+#ifndef ENTROPY_H_
+#define ENTROPY_H_
+
+#include "bits.h"
+#include "schema.h"
+
+namespace entropy {
+
+constexpr uint8_t MAX_CODE_LEN = 15;
+
+/* the trained masks plus an escape for every other one */
+constexpr uint8_t MASK_SYMBOLS = 16;
+constexpr uint8_t MASK_ESCAPE = MASK_SYMBOLS - 1;
+
+/* bit length of the residual value - 1, lengths beyond the field width
+ * never occur and have no code */
+constexpr uint8_t RESIDUAL_SYMBOLS = 32;
+
+} // namespace entropy
+
+#include "entropy_tables.h"
+
+namespace entropy {
+
+static_assert(MASK_TRAINED > 0 && MASK_TRAINED <= MASK_ESCAPE,
+              "the trained masks leave the escape its symbol");
+
+template <size_t N> struct Huffman {
+  uint16_t code[N];                 // canonical code of every symbol
+  uint8_t len[N];                   // its length in bits
+  uint16_t count[MAX_CODE_LEN + 1]; // number of codes of every length
+  uint8_t sorted[N];                // symbols by (length, value)
+};
+
+/* deflate style canonical code assignment (RFC 1951, 3.2.2) */
+template <size_t N>
+constexpr Huffman<N> build(const uint8_t (&len)[N]) {
+  Huffman<N> h{};
+  for (size_t s = 0; s < N; s++) {
+    h.len[s] = len[s];
+    h.count[len[s]]++;
+  }
+  h.count[0] = 0; // unused symbols
+
+  uint16_t next[MAX_CODE_LEN + 1] = {};
+  uint16_t code = 0;
+  for (uint8_t l = 1; l <= MAX_CODE_LEN; l++) {
+    code = (uint16_t)((code + h.count[l - 1]) << 1);
+    next[l] = code;
+  }
+  for (size_t s = 0; s < N; s++) {
+    if (len[s]) {
+      h.code[s] = next[len[s]]++;
+    }
+  }
+
+  size_t k = 0;
+  for (uint8_t l = 1; l <= MAX_CODE_LEN; l++) {
+    for (size_t s = 0; s < N; s++) {
+      if (len[s] == l) {
+        h.sorted[k++] = (uint8_t)s;
+      }
+    }
+  }
+  return h;
+}
+
+/* the lengths must describe a complete prefix code (Kraft sum of one) */
+template <size_t N> constexpr bool complete(const uint8_t (&len)[N]) {
+  uint32_t kraft = 0;
+  for (size_t s = 0; s < N; s++) {
+    if (len[s] > MAX_CODE_LEN) {
+      return false;
+    }
+    if (len[s]) {
+      kraft += (uint32_t)1 << (MAX_CODE_LEN - len[s]);
+    }
+  }
+  return kraft == (uint32_t)1 << MAX_CODE_LEN;
+}
+
+static_assert(complete(MASK_LENGTHS), "bad mask code lengths");
+
+struct ResidualCodes {
+  Huffman<RESIDUAL_SYMBOLS> field[FIELD_COUNT];
+};
+
+constexpr ResidualCodes build_residuals() {
+  ResidualCodes c{};
+  for (size_t f = 0; f < FIELD_COUNT; f++) {
+    c.field[f] = build(RESIDUAL_LENGTHS[f]);
+  }
+  return c;
+}
+
+constexpr bool residuals_complete() {
+  for (size_t f = 0; f < FIELD_COUNT; f++) {
+    if (!complete(RESIDUAL_LENGTHS[f])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(residuals_complete(), "bad residual code lengths");
+
+constexpr Huffman<MASK_SYMBOLS> MASK_CODE = build(MASK_LENGTHS);
+constexpr ResidualCodes RESIDUAL_CODE = build_residuals();
+
+template <size_t N>
+static inline void put_symbol(const Huffman<N> &h, uint8_t s, BitWriter &w) {
+  w.write(h.code[s], h.len[s]);
+}
+
+/* bit at a time canonical decode (as in zlib's puff.c), the payloads are a
+ * few bytes long so no lookup table is worth its RAM */
+template <size_t N>
+static inline uint8_t take_symbol(const Huffman<N> &h, BitReader &r) {
+  uint16_t code = 0, first = 0, index = 0;
+  for (uint8_t l = 1; l <= MAX_CODE_LEN; l++) {
+    code |= (uint16_t)r.read(1);
+    const uint16_t count = h.count[l];
+    if ((uint16_t)(code - first) < count) {
+      return h.sorted[index + (code - first)];
+    }
+    index += count;
+    first = (uint16_t)((first + count) << 1);
+    code = (uint16_t)(code << 1);
+  }
+  return 0; // unreachable for a complete code
+}
+
+/* worst case: escaped mask and every residual at full width */
+template <size_t... I>
+constexpr size_t payload_len(std::index_sequence<I...>) {
+  return (MAX_CODE_LEN + FIELD_COUNT +
+          ((MAX_CODE_LEN + 8 * schema::Field<I>::width - 1) + ... + 0) + 7) /
+         8;
+}
+
+/* number of significant bits, v > 0 */
+static inline uint8_t bit_length(uint32_t v) {
+  return (uint8_t)(32 - __builtin_clz(v));
+}
+
+template <size_t I>
+static inline void encode_residual(const uint32_t *values, BitWriter &w) {
+  const uint32_t v = values[I];
+  if (v == 0) {
+    return;
+  }
+  const uint8_t n = bit_length(v);
+  put_symbol(RESIDUAL_CODE.field[I], n - 1, w);
+  w.write(v, n - 1); // the leading one is implied
+}
+
+template <size_t I>
+static inline void decode_residual(const SensorData &prev2,
+                                   const SensorData &prev, SensorData &next,
+                                   schema::changed_t mask,
+                                   const schema::PredictorMap &map,
+                                   BitReader &r) {
+  uint32_t v = 0;
+  if (mask & ((schema::changed_t)1 << I)) {
+    const uint8_t n = take_symbol(RESIDUAL_CODE.field[I], r);
+    v = ((uint32_t)1 << n) | r.read(n);
+  }
+  schema::apply_residual<I>(prev2, prev, next, v, map);
+}
+
+template <size_t... I>
+static inline uint8_t encode(const SensorData &prev2, const SensorData &prev,
+                             const SensorData &next,
+                             const schema::PredictorMap &map, uint8_t *out,
+                             std::index_sequence<I...> fields) {
+  uint32_t values[FIELD_COUNT];
+  schema::residual_values(prev2, prev, next, map, values, fields);
+
+  schema::changed_t mask = 0;
+  ((mask |= (schema::changed_t)(values[I] != 0) << I), ...);
+
+  BitWriter w(out, payload_len(fields));
+  uint8_t s = 0;
+  // NOTE: the trained masks may name fields outside the profile
+  while (s < MASK_TRAINED &&
+         (MASKS[s] & schema::field_mask(fields)) != mask) {
+    s++;
+  }
+  s = s < MASK_TRAINED ? s : MASK_ESCAPE;
+  put_symbol(MASK_CODE, s, w);
+  if (s == MASK_ESCAPE) {
+    w.write(mask, FIELD_COUNT);
+  }
+  (encode_residual<I>(values, w), ...);
+  return (uint8_t)w.flush();
+}
+
+/* returns the bytes consumed, 0 if the payload ran out early or names a
+ * mask symbol that is never sent */
+template <size_t... I>
+static inline uint8_t decode(const SensorData &prev2, const SensorData &prev,
+                             SensorData &next, const schema::PredictorMap &map,
+                             const uint8_t *in, uint16_t len,
+                             std::index_sequence<I...> fields) {
+  BitReader r(in, len);
+  const uint8_t s = take_symbol(MASK_CODE, r);
+  if (s >= MASK_TRAINED && s != MASK_ESCAPE) {
+    return 0;
+  }
+  // NOTE: of the fields of the node, the gateway may have more
+  const schema::changed_t mask =
+      s < MASK_ESCAPE ? MASKS[s] & schema::field_mask(fields)
+                      : (schema::changed_t)r.read(FIELD_COUNT);
+  (decode_residual<I>(prev2, prev, next, mask, map, r), ...);
+  return r.overflow() ? 0 : (uint8_t)r.consumed();
+}
+
+} // namespace entropy
+
+#endif // ENTROPY_H_
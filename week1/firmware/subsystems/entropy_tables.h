@@ -0,0 +1,70 @@
+/**
+ *  @file entropy_tables.h
+ *  @brief Huffman code lengths of the entropy stage, generated by
+ *  bench/entropy_train from 6370 samples (make tables), do not edit
+ *  */
+
+#ifndef ENTROPY_TABLES_H_
+#define ENTROPY_TABLES_H_
+
+namespace entropy {
+
+/* changed field masks by frequency, the escape covers the rest. The symbols
+ * between the last trained mask and the escape are never sent */
+constexpr uint8_t MASK_TRAINED = 11;
+
+constexpr schema::changed_t MASKS[MASK_TRAINED] = {
+    0x1800, 0x1000, 0x0800, 0x0000, 0x1AEF, 0x0803, 0x0AEF, 0x1003,
+    0x12EF, 0x1803, 0x1C13,
+};
+
+constexpr uint8_t MASK_LENGTHS[MASK_SYMBOLS] = {
+    1, 2, 3, 4, 6, 7, 8, 8, 8, 8, 7, 8, 8, 9, 9, 8,
+};
+
+/* per field, by bit length of the residual (0: no code) */
+constexpr uint8_t RESIDUAL_LENGTHS[FIELD_COUNT][RESIDUAL_SYMBOLS] = {
+    // TEMPR
+    {5, 5, 5, 4, 5, 4, 5, 3, 5, 5, 5, 4, 2, 4, 4, 4,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // HUMID
+    {5, 5, 4, 5, 5, 5, 5, 4, 3, 5, 5, 4, 4, 2, 4, 4,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // PRESR
+    {6, 6, 6, 6, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+     5, 3, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 5},
+    // IAQ
+    {5, 5, 5, 5, 4, 4, 2, 4, 4, 4, 4, 4, 4, 5, 5, 4,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // IAQAC
+    {3, 2, 3, 3, 3, 4, 4, 3, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // STIAQ
+    {5, 5, 5, 5, 4, 4, 2, 4, 4, 4, 4, 4, 4, 5, 5, 4,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // CO2EQ
+    {5, 5, 5, 5, 4, 4, 4, 4, 4, 2, 4, 4, 4, 5, 5, 4,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // BTVOC
+    {5, 5, 5, 5, 4, 4, 2, 4, 4, 4, 4, 4, 4, 5, 5, 4,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // GASPC
+    {3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // STABS
+    {2, 2, 3, 3, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // RUNIN
+    {3, 2, 3, 3, 3, 4, 4, 3, 0, 0, 0, 0, 0, 0, 0, 0,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // MQ135
+    {2, 2, 2, 3, 4, 5, 6, 7, 9, 10, 10, 10, 10, 11, 11, 10,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    // ANEMO
+    {5, 3, 3, 2, 2, 3, 4, 6, 7, 10, 9, 9, 10, 11, 11, 10,
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+};
+
+} // namespace entropy
+
+#endif // ENTROPY_TABLES_H_
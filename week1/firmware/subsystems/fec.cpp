@@ -0,0 +1,197 @@
+#include "fec.h"
+#include <string.h>
+
+using fec::GF;
+
+void ReedSolomon::begin(uint8_t parity) {
+  this->parity = parity <= FEC_MAX_PARITY ? parity & ~1 : FEC_MAX_PARITY;
+  // NOTE: g(x) = (x - 1)(x - a)..(x - a^(parity - 1)), highest degree first
+  uint8_t g[FEC_MAX_PARITY + 1] = {1};
+  for (uint8_t i = 0; i < this->parity; i++) {
+    g[i + 1] = 0;
+    for (uint8_t j = i + 1; j > 0; j--) {
+      g[j] ^= fec::mul(g[j - 1], GF.exp[i]);
+    }
+  }
+  for (uint8_t j = 0; j <= this->parity; j++) {
+    generator[j] = g[j] ? GF.log[g[j]] : 512;
+  }
+}
+
+void ReedSolomon::encode_block(const uint8_t *data, uint16_t count,
+                               uint16_t stride, uint8_t *out) const {
+  // NOTE: the remainder of data(x) x^parity / g(x), shifted through a byte
+  // at a time
+  uint8_t r[FEC_MAX_PARITY] = {0};
+  for (uint16_t i = 0; i < count; i++) {
+    const uint8_t feedback = data[i * stride] ^ r[0];
+    if (feedback == 0) {
+      memmove(r, r + 1, parity - 1);
+      r[parity - 1] = 0;
+      continue;
+    }
+    const uint16_t f = GF.log[feedback];
+    for (uint8_t j = 0; j + 1 < parity; j++) {
+      r[j] = r[j + 1] ^ GF.exp[f + generator[j + 1]];
+    }
+    r[parity - 1] = GF.exp[f + generator[parity]];
+  }
+  for (uint8_t j = 0; j < parity; j++) {
+    out[j * stride] = r[j];
+  }
+}
+
+uint16_t ReedSolomon::encode(uint8_t *data, uint16_t len) const {
+  if (parity == 0) {
+    return len;
+  }
+  const uint16_t blocks = overhead(len) / parity;
+  for (uint16_t b = 0; b < blocks; b++) {
+    encode_block(data + b, (len - b + blocks - 1) / blocks, blocks,
+                 data + len + b);
+  }
+  return len + blocks * parity;
+}
+
+int16_t ReedSolomon::decode_block(uint8_t *block, uint16_t len) const {
+  // NOTE: syndromes, S_i = c(a^i) for the roots of g(x), all 0 for a
+  // codeword, the common case ends here
+  uint8_t s[FEC_MAX_PARITY];
+  uint8_t any = 0;
+  for (uint8_t i = 0; i < parity; i++) {
+    uint8_t v = 0;
+    for (uint16_t k = 0; k < len; k++) {
+      v = (v ? GF.exp[GF.log[v] + i] : 0) ^ block[k];
+    }
+    s[i] = v;
+    any |= v;
+  }
+  if (!any) {
+    return 0;
+  }
+
+  /* NOTE: Berlekamp-Massey, the error locator L(x) = prod(1 - X_k x), low
+   * degree first, X_k = a^e for an error at degree e of c(x) */
+  uint8_t locator[FEC_MAX_PARITY + 1] = {1};
+  uint8_t previous[FEC_MAX_PARITY + 1] = {1};
+  uint8_t errors = 0;
+  uint8_t shift = 1;
+  uint8_t last = 1;
+  for (uint8_t n = 0; n < parity; n++) {
+    uint8_t d = s[n];
+    for (uint8_t i = 1; i <= errors; i++) {
+      d ^= fec::mul(locator[i], s[n - i]);
+    }
+    if (d == 0) {
+      shift++;
+      continue;
+    }
+    const uint8_t scale = fec::div(d, last);
+    uint8_t copy[FEC_MAX_PARITY + 1];
+    const bool grow = 2 * errors <= n;
+    if (grow) {
+      memcpy(copy, locator, sizeof(copy));
+    }
+    for (uint8_t i = 0; i + shift <= parity; i++) {
+      locator[i + shift] ^= fec::mul(scale, previous[i]);
+    }
+    if (grow) {
+      errors = n + 1 - errors;
+      memcpy(previous, copy, sizeof(copy));
+      last = d;
+      shift = 1;
+    } else {
+      shift++;
+    }
+  }
+  if (errors > parity / 2) {
+    return -1;
+  }
+
+  // NOTE: evaluator O(x) = S(x) L(x) mod x^parity
+  uint8_t evaluator[FEC_MAX_PARITY];
+  for (uint8_t i = 0; i < parity; i++) {
+    uint8_t v = 0;
+    for (uint8_t j = 0; j <= i && j <= errors; j++) {
+      v ^= fec::mul(locator[j], s[i - j]);
+    }
+    evaluator[i] = v;
+  }
+
+  /* NOTE: Chien search, the roots of L(x) are the X_k^-1, then Forney,
+   * e_k = X_k O(X_k^-1) / L'(X_k^-1) */
+  uint8_t found = 0;
+  for (uint16_t e = 0; e < len && found < errors; e++) {
+    const uint16_t inverse = (255 - e) % 255; // log of X^-1
+    uint8_t v = 0;
+    for (uint8_t i = 0; i <= errors; i++) {
+      if (locator[i]) {
+        v ^= GF.exp[GF.log[locator[i]] + inverse * i % 255];
+      }
+    }
+    if (v) {
+      continue;
+    }
+    uint8_t o = 0;
+    for (uint8_t i = 0; i < parity; i++) {
+      if (evaluator[i]) {
+        o ^= GF.exp[GF.log[evaluator[i]] + inverse * i % 255];
+      }
+    }
+    uint8_t derivative = 0; // odd terms only in GF(2^m)
+    for (uint8_t i = 1; i <= errors; i += 2) {
+      if (locator[i]) {
+        derivative ^= GF.exp[GF.log[locator[i]] + inverse * (i - 1) % 255];
+      }
+    }
+    if (derivative == 0) {
+      return -1;
+    }
+    block[len - 1 - e] ^= fec::mul(GF.exp[e], fec::div(o, derivative));
+    found++;
+  }
+  // NOTE: fewer roots in the block than the degree, too many errors
+  return found == errors ? errors : -1;
+}
+
+uint16_t ReedSolomon::decode(uint8_t *data, uint16_t len,
+                             uint16_t &corrected) const {
+  corrected = 0;
+  if (parity == 0) {
+    return len;
+  }
+  // NOTE: every block but the last is full, see encode()
+  const uint16_t blocks = (len + FEC_BLOCK_LEN - 1) / FEC_BLOCK_LEN;
+  if (len <= blocks * parity) {
+    return 0;
+  }
+  const uint16_t data_len = len - blocks * parity;
+  if (blocks == 1) {
+    const int16_t fixed = decode_block(data, len);
+    corrected = fixed > 0 ? fixed : 0;
+    return fixed < 0 ? 0 : data_len;
+  }
+
+  uint8_t block[FEC_BLOCK_LEN];
+  for (uint16_t b = 0; b < blocks; b++) {
+    const uint16_t count = (data_len - b + blocks - 1) / blocks;
+    for (uint16_t k = 0; k < count; k++) {
+      block[k] = data[b + k * blocks];
+    }
+    for (uint8_t j = 0; j < parity; j++) {
+      block[count + j] = data[data_len + b + j * blocks];
+    }
+    const int16_t fixed = decode_block(block, count + parity);
+    if (fixed < 0) {
+      return 0;
+    }
+    corrected += fixed;
+    for (uint16_t k = 0; fixed && k < count; k++) {
+      data[b + k * blocks] = block[k];
+    }
+    for (uint8_t j = 0; fixed && j < parity; j++) {
+      data[data_len + b + j * blocks] = block[count + j];
+    }
+  }
+  return data_len;
+}
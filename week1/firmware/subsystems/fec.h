@@ -0,0 +1,95 @@
+/**
+ *  @file fec.h
+ *  @brief Reed-Solomon forward error correction over GF(256), for the frame
+ *  body (see Framing): `parity` bytes per block of at most 255 correct up to
+ *  parity / 2 bad bytes anywhere in it. A longer body is cut into as few
+ *  blocks as it takes, interleaved byte by byte so that a burst is spread
+ *  over all of them. The field arithmetic goes through log and exp tables
+ *  generated at compile time (768 bytes).
+ *  */
+
+#ifndef FEC_H_
+#define FEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* parity bytes per block a node adds to its frames, 0: none. Both ends of
+ * a link must agree on it, see LORA_CRC_ON */
+#ifndef FEC_PARITY
+#define FEC_PARITY 0
+#endif
+
+#define FEC_MAX_PARITY 32
+#define FEC_BLOCK_LEN 255
+
+static_assert(FEC_PARITY % 2 == 0 && FEC_PARITY <= FEC_MAX_PARITY,
+              "FEC_PARITY is even and FEC_MAX_PARITY at most");
+
+/* parity bytes of `len` bytes of data */
+#define FEC_LEN(parity, len)                                                   \
+  ((parity) ? (parity) * (((len) + FEC_BLOCK_LEN - (parity) - 1) /             \
+                          (FEC_BLOCK_LEN - (parity)))                          \
+            : 0)
+
+namespace fec {
+
+/* GF(2^8) modulo x^8 + x^4 + x^3 + x^2 + 1 (0x11D), generated by x */
+struct Tables {
+  uint8_t exp[768]; // NOTE: 0 past 509, see ReedSolomon::begin()
+  uint8_t log[256];
+};
+
+constexpr Tables build() {
+  Tables t{};
+  uint16_t x = 1;
+  for (uint16_t i = 0; i < 255; i++) {
+    t.exp[i] = (uint8_t)x;
+    t.exp[i + 255] = (uint8_t)x;
+    t.log[x] = (uint8_t)i;
+    x <<= 1;
+    if (x & 0x100) {
+      x ^= 0x11D;
+    }
+  }
+  return t;
+}
+
+static constexpr Tables GF = build();
+
+static inline uint8_t mul(uint8_t a, uint8_t b) {
+  return a && b ? GF.exp[GF.log[a] + GF.log[b]] : 0;
+}
+
+static inline uint8_t div(uint8_t a, uint8_t b) {
+  return a ? GF.exp[GF.log[a] + 255 - GF.log[b]] : 0;
+}
+
+} // namespace fec
+
+class ReedSolomon {
+private:
+  uint8_t parity;
+  // NOTE: log of the generator coefficients, highest degree first, the
+  // zero ones as 512 so that any exp[log + 512] reads 0
+  uint16_t generator[FEC_MAX_PARITY + 1];
+  void encode_block(const uint8_t *data, uint16_t count, uint16_t stride,
+                    uint8_t *out) const;
+  int16_t decode_block(uint8_t *block, uint16_t len) const;
+
+public:
+  /* generator polynomial for `parity` bytes per block (even, at most
+   * FEC_MAX_PARITY), 0 turns the code off */
+  void begin(uint8_t parity);
+  uint8_t parity_bytes() const { return parity; }
+  /* parity bytes of `len` bytes of data */
+  uint16_t overhead(uint16_t len) const { return FEC_LEN(parity, len); }
+  /* appends the parity of data[0..len) behind it, returns the new length */
+  uint16_t encode(uint8_t *data, uint16_t len) const;
+  /* corrects data[0..len) (parity included) in place, returns the length
+   * of the data without the parity, 0 when a block has more errors than
+   * it can correct. `corrected` counts the bytes fixed */
+  uint16_t decode(uint8_t *data, uint16_t len, uint16_t &corrected) const;
+};
+
+#endif // FEC_H_
@@ -0,0 +1,59 @@
+/**
+ *  @file frame_len.h
+ *  @brief Lengths of a frame on the air for a payload of a given length,
+ *  under the framing and the FEC the node is built with (see framing.h).
+ *  Free of the codec, so the encoder can bound a batch by them.
+ *  */
+
+#ifndef FRAME_LEN_H_
+#define FRAME_LEN_H_
+
+#include "fec.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* 1: COBS, the frame (after its first byte) is stuffed so that it holds
+ * no 0x00 and a 0x00 ends it, at most one byte more per 254. 0: the SOF
+ * byte starts a frame and ESC precedes every SOF or ESC inside it, up to
+ * twice as long. Both ends of a link must agree on it */
+#ifndef FRAMING_COBS
+#define FRAMING_COBS 1
+#endif
+
+#define FRAME_HEADER_LEN 11 // v1, SOF included
+#define FRAME_CRC_LEN 2
+/* v2: version and sequence, device id and flag word as varints (3 and 5
+ * bytes at most) then, only with escaped framing, the payload length (2) */
+#define FRAME_V2_HEADER_MAX (2 + 3 + 5 + (FRAMING_COBS ? 0 : 2))
+// NOTE: room in front of the payload of a Frame, the longer header fits
+#define FRAME_HEADER_ROOM                                                      \
+  (1 + (FRAME_HEADER_LEN - 1 > FRAME_V2_HEADER_MAX ? FRAME_HEADER_LEN - 1      \
+                                                   : FRAME_V2_HEADER_MAX))
+// NOTE: the longest body (header without the SOF, payload and crc)
+#define FRAME_BODY_LEN(payload)                                                \
+  (FRAME_HEADER_ROOM - 1 + (payload) + FRAME_CRC_LEN)
+// NOTE: the body and the FEC_PARITY bytes per block behind it (see fec.h)
+#define FRAME_CODED_LEN(payload)                                               \
+  (FRAME_BODY_LEN(payload) + FEC_LEN(FEC_PARITY, FRAME_BODY_LEN(payload)))
+/* room a frame of `payload` bytes needs to be sealed in place, from the
+ * start of the header room */
+#if FRAMING_COBS
+// NOTE: the first code byte takes the place of the SOF, one more code byte
+// per 254 bytes of body, then the delimiter
+#define FRAME_MAX_LEN(payload)                                                 \
+  (1 + FRAME_CODED_LEN(payload) + FRAME_CODED_LEN(payload) / 254 + 1)
+#else
+#define FRAME_MAX_LEN(payload)                                                 \
+  (2 * (1 + FRAME_CODED_LEN(payload))) // assuming every byte is escaped
+#endif
+
+/* longest payload whose frame is `bytes` long at most, whatever it holds */
+constexpr size_t frame_payload_room(size_t bytes) {
+  size_t payload = 0;
+  while (FRAME_MAX_LEN(payload + 1) <= bytes) {
+    payload++;
+  }
+  return payload;
+}
+
+#endif // FRAME_LEN_H_
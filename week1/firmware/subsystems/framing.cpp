@@ -1,81 +1,426 @@
 #include "framing.h"
+#include "crc.h"
 #include <string.h>
 
 #ifndef DEVICE_ID
-#define DEVICE_ID 0x01
+#define DEVICE_ID 0x0001
 #endif
 
-static uint16_t calculate_crc16(const uint8_t *data, uint16_t len) {
-  uint16_t crc = 0xFFFF;
-  for (uint16_t i = 0; i < len; i++) {
-    crc ^= data[i];
-    for (uint8_t j = 0; j < 8; j++) {
-      if (crc & 0x0001) {
-        crc = (crc >> 1) ^ 0xA001;
-      } else {
-        crc = crc >> 1;
-      }
-    }
-  }
-  return crc;
-}
+#if FRAME_VERSION == 1
+// NOTE: the device id gives the version nibble of a v1 frame (0)
+static_assert(DEVICE_ID < 0x1000, "v1 device ids have to stay below 0x1000");
+#endif
 
-bool Framing::setup() { return true; }
+bool Framing::setup() {
+  version = FRAME_VERSION;
+  fec.begin(FEC_PARITY);
+  return true;
+}
 
 void Framing::run(uint16_t dt) { (void)dt; }
 
-FrameHeader Framing::frame(EncoderResult &result, uint16_t sequence,
-                           FrameBuffer_t &buffer, uint16_t &crc) {
+void Framing::set_fec(uint8_t parity) {
+  fec.begin(parity < FEC_PARITY ? parity : FEC_PARITY);
+}
+
+FrameHeader Framing::header_for(flag_t flags, uint16_t sequence,
+                                uint16_t len) const {
   FrameHeader header;
   header.sof = SOF;
+  header.version = version;
   header.deviceid = DEVICE_ID;
-  header.flags = result.flag;
-  header.sequence = sequence;
-  header.len = result.len;
+  header.flags = flags;
+  header.sequence =
+      version >= 2
+          ? (uint16_t)(sequence & ((1u << FRAME_V2_SEQUENCE_BITS) - 1))
+          : sequence;
+  header.len = len;
+  return header;
+}
 
-  uint16_t idx = 0;
-  buffer[idx++] = header.sof;
-  buffer[idx++] = header.deviceid;
+uint8_t Framing::put_header(uint8_t *out, const FrameHeader &header) {
+  uint8_t idx = 0;
+  if (header.version < 2) {
+    out[idx++] = (header.deviceid >> 8) & 0xFF;
+    out[idx++] = header.deviceid & 0xFF;
 
-  buffer[idx++] = (header.flags >> 24) & 0xFF;
-  buffer[idx++] = (header.flags >> 16) & 0xFF;
-  buffer[idx++] = (header.flags >> 8) & 0xFF;
-  buffer[idx++] = header.flags & 0xFF;
+    out[idx++] = (header.flags >> 24) & 0xFF;
+    out[idx++] = (header.flags >> 16) & 0xFF;
+    out[idx++] = (header.flags >> 8) & 0xFF;
+    out[idx++] = header.flags & 0xFF;
 
-  buffer[idx++] = (header.sequence >> 8) & 0xFF;
-  buffer[idx++] = header.sequence & 0xFF;
+    out[idx++] = (header.sequence >> 8) & 0xFF;
+    out[idx++] = header.sequence & 0xFF;
 
-  buffer[idx++] = (header.len >> 8) & 0xFF;
-  buffer[idx++] = header.len & 0xFF;
+    out[idx++] = (header.len >> 8) & 0xFF;
+    out[idx++] = header.len & 0xFF;
+    return idx;
+  }
+  out[idx++] = (uint8_t)(header.version << 4 | (header.sequence >> 8 & 0x0F));
+  out[idx++] = header.sequence & 0xFF;
+  idx += schema::put_varint<deviceid_t>(out + idx, header.deviceid);
+  idx += schema::put_varint<uint32_t>(out + idx, pack_flags(header.flags));
+#if !FRAMING_COBS
+  idx += schema::put_varint<uint16_t>(out + idx, header.len);
+#endif
+  return idx;
+}
 
-  memcpy(&buffer[idx], result.data, result.len);
-  idx += result.len;
+uint8_t Framing::header_len(const FrameHeader &header) {
+  if (header.version < 2) {
+    return FRAME_HEADER_LEN - 1;
+  }
+  uint8_t len = 2 + schema::varint_size<deviceid_t>(header.deviceid) +
+                schema::varint_size<uint32_t>(pack_flags(header.flags));
+#if !FRAMING_COBS
+  len += schema::varint_size<uint16_t>(header.len);
+#endif
+  return len;
+}
 
-  crc = calculate_crc16(buffer, idx);
-  buffer[idx++] = (crc >> 8) & 0xFF;
-  buffer[idx++] = crc & 0xFF;
+/* SOF (or the slot of the first code byte) in front of a header and its
+ * payload, crc behind them, the FEC parity of the body after that, then the
+ * escaping (or stuffing), returns the final length */
+uint16_t Framing::seal(uint8_t *frame, uint16_t len, uint16_t &crc) {
+  frame[0] = SOF;
+#if FRAMING_COBS
+  // NOTE: the first byte becomes a code byte, the crc covers the body only
+  crc = crc::Modbus::compute(frame + 1, len - 1);
+#else
+  crc = crc::Modbus::compute(frame, len);
+#endif
+  frame[len++] = (crc >> 8) & 0xFF;
+  frame[len++] = crc & 0xFF;
+  len = 1 + fec.encode(frame + 1, len - 1);
 
-  uint16_t final_len = escape(buffer, idx);
+#if FRAMING_COBS
+  return stuff(frame, len);
+#else
+  return escape(frame, len);
+#endif
+}
 
-  header.len = final_len;
+FrameHeader Framing::frame(flag_t flag, const uint8_t *payload, uint16_t len,
+                           uint16_t sequence, FrameBuffer_t &buffer,
+                           uint16_t &crc) {
+  FrameHeader header = header_for(flag, sequence, len);
+  const uint8_t head = 1 + put_header(buffer + 1, header);
+  memcpy(&buffer[head], payload, len);
+  header.len = seal(buffer, head + len, crc);
   return header;
 }
 
-uint16_t Framing::escape(FrameBuffer_t &buffer, uint16_t len) {
-  uint8_t temp[MAX_FRAME_LEN];
-  uint16_t write_idx = 0;
+FrameHeader Framing::finalize(Frame &frame, uint16_t sequence, uint16_t &crc) {
+  FrameHeader header = header_for(frame.flag, sequence, frame.len);
+  // NOTE: the header goes right in front of the payload, which stays put
+  const uint8_t len = header_len(header);
+  frame.start = FRAME_HEADER_ROOM - 1 - len;
+  put_header(frame.data() + 1, header);
 
-  temp[write_idx++] = buffer[0];
+  header.len = seal(frame.data(), 1 + len + frame.len, crc);
+  frame.len = header.len;
+  frame.sealed = true;
+  return header;
+}
 
-  for (uint16_t read_idx = 1; read_idx < len; read_idx++) {
-    if (buffer[read_idx] == SOF || buffer[read_idx] == ESC) {
-      temp[write_idx++] = ESC;
-      temp[write_idx++] = buffer[read_idx];
-    } else {
-      temp[write_idx++] = buffer[read_idx];
+/* NOTE: in place from the back, the buffer has room for every byte to be
+ * escaped (MAX_FRAME_LEN) */
+uint16_t Framing::escape(uint8_t *buffer, uint16_t len) {
+  uint16_t escapes = 0;
+  for (uint16_t i = 1; i < len; i++) {
+    escapes += buffer[i] == SOF || buffer[i] == ESC;
+  }
+
+  const uint16_t final_len = len + escapes;
+  uint16_t write_idx = final_len;
+  // NOTE: once the last escape is in, the bytes in front are in place
+  for (uint16_t read_idx = len; escapes > 0;) {
+    const uint8_t b = buffer[--read_idx];
+    buffer[--write_idx] = b;
+    if (b == SOF || b == ESC) {
+      buffer[--write_idx] = ESC;
+      escapes--;
+    }
+  }
+  return final_len;
+}
+
+/* NOTE: every 0x00 of the body turns into the length of the block after
+ * it, written over the zero itself, so the bytes stay where they are. Only
+ * a block of 254 non zero bytes needs a code byte of its own, the rest of
+ * the body then moves up by one (MAX_FRAME_LEN has the room) */
+uint16_t Framing::stuff(uint8_t *buffer, uint16_t len) {
+  uint16_t code_at = 0;
+  uint8_t code = 1;
+  for (uint16_t i = 1; i < len; i++) {
+    if (buffer[i] == COBS_DELIMITER) {
+      buffer[code_at] = code;
+      code_at = i;
+      code = 1;
+      continue;
+    }
+    if (++code == 0xFF && i + 1 < len) {
+      buffer[code_at] = code;
+      memmove(&buffer[i + 2], &buffer[i + 1], len - i - 1);
+      len++;
+      code_at = ++i;
+      code = 1;
     }
   }
+  buffer[code_at] = code;
+  buffer[len++] = COBS_DELIMITER;
+  return len;
+}
+
+void CobsDecoder::begin(uint8_t *out, uint16_t capacity) {
+  this->out = out;
+  this->capacity = capacity;
+  len = 0;
+  done = 0;
+  left = 0;
+  code = 0;
+  failed = false;
+}
+
+uint8_t CobsDecoder::push(uint8_t b) {
+  if (b == COBS_DELIMITER) {
+    // NOTE: back to back delimiters are an idle line, not empty frames
+    const uint8_t status = failed || left ? COBS_ERROR
+                           : code == 0    ? COBS_MORE
+                                          : COBS_FRAME;
+    done = status == COBS_FRAME ? len : 0;
+    len = 0;
+    left = 0;
+    code = 0;
+    failed = false;
+    return status;
+  }
+  if (failed) {
+    return COBS_MORE;
+  }
+  if (left == 0) {
+    // NOTE: a block shorter than 254 bytes stood for a zero after it
+    if (code != 0 && code != 0xFF) {
+      if (len == capacity) {
+        failed = true;
+        return COBS_MORE;
+      }
+      out[len++] = 0;
+    }
+    code = b;
+    left = b - 1;
+    return COBS_MORE;
+  }
+  if (len == capacity) {
+    failed = true;
+    return COBS_MORE;
+  }
+  out[len++] = b;
+  left--;
+  return COBS_MORE;
+}
+
+uint16_t CobsDecoder::length() const { return done; }
+
+void Deframer::begin(uint8_t parity) {
+  fec.begin(parity < FEC_PARITY ? parity : FEC_PARITY);
+#if FRAMING_COBS
+  cobs.begin(body, sizeof(body));
+#else
+  filled = 0;
+  expected = sizeof(body);
+  escaped = false;
+  hunting = true;
+#endif
+  run = 0;
+  memset(&last, 0, sizeof(last));
+  memset(&counters, 0, sizeof(counters));
+}
 
-  memcpy(buffer, temp, write_idx);
-  return write_idx;
+void Deframer::drop(uint32_t &error) {
+  error++;
+  counters.dropped += run;
+  run = 0;
+}
+
+/* NOTE: bytes of a varint that starts at body[idx], 0 while it is not all
+ * in (or runs longer than max) */
+static uint8_t varint_length(const uint8_t *body, uint16_t len, uint16_t idx,
+                             uint8_t max) {
+  for (uint8_t n = 1; n <= max && idx < len; n++) {
+    if ((body[idx++] & 0x80) == 0) {
+      return n;
+    }
+  }
+  return 0;
+}
+
+/* header at the front of `len` bytes of body, returns its length, 0 while
+ * it is not all in, -1 for a version this gateway does not read */
+int8_t Deframer::take_header(const uint8_t *body, uint16_t len,
+                             FrameHeader &header) {
+  if (len == 0) {
+    return 0;
+  }
+  header.sof = SOF;
+  header.version = body[0] >> 4;
+  if (header.version == 0) {
+    if (len < FRAME_HEADER_LEN - 1) {
+      return 0;
+    }
+    header.version = 1;
+    header.deviceid = (deviceid_t)(body[0] << 8 | body[1]);
+    header.flags = (flag_t)body[2] << 24 | (flag_t)body[3] << 16 |
+                   (flag_t)body[4] << 8 | body[5];
+    header.sequence = (uint16_t)(body[6] << 8 | body[7]);
+    header.len = (uint16_t)(body[8] << 8 | body[9]);
+    return FRAME_HEADER_LEN - 1;
+  }
+  if (header.version != 2) {
+    return -1;
+  }
+
+  // NOTE: device id, flag word and (escaped) payload length, a varint that
+  // runs longer than its type is as bad as an unknown version
+  static const uint8_t VARINTS[] = {3, 5, 2};
+  uint16_t end = 2;
+  for (uint8_t i = 0; i < (FRAMING_COBS ? 2 : 3); i++) {
+    const uint8_t n = varint_length(body, len, end, VARINTS[i]);
+    if (!n) {
+      return len >= end + VARINTS[i] ? -1 : 0;
+    }
+    end += n;
+  }
+  uint8_t idx = 2;
+  header.sequence = (uint16_t)((body[0] & 0x0F) << 8 | body[1]);
+  header.deviceid = schema::take_varint<deviceid_t>(body, idx);
+  header.flags = unpack_flags(schema::take_varint<uint32_t>(body, idx));
+#if !FRAMING_COBS
+  header.len = schema::take_varint<uint16_t>(body, idx);
+#endif
+  return (int8_t)idx;
+}
+
+/* corrects a whole body, checks it and parses its header */
+uint8_t Deframer::finish(uint16_t len) {
+  // NOTE: the header and the crc are only read once the FEC had its go
+  uint16_t corrected = 0;
+  if (fec.parity_bytes()) {
+    len = fec.decode(body, len, corrected);
+    if (len == 0) {
+      drop(counters.fec_errors);
+      return DEFRAME_MORE;
+    }
+  }
+  FrameHeader &header = last.header;
+  const int8_t head = take_header(body, len, header);
+#if FRAMING_COBS
+  // NOTE: v2 carries no length, the body ends where the frame does
+  if (head > 0 && header.version >= 2) {
+    header.len = len >= head + FRAME_CRC_LEN ? len - head - FRAME_CRC_LEN
+                                             : MAX_FRAME_PAYLOAD_LEN + 1;
+  }
+#endif
+  // NOTE: the length field has to account for every byte received
+  if (head <= 0 || header.len > MAX_FRAME_PAYLOAD_LEN ||
+      head + header.len + FRAME_CRC_LEN != len) {
+    drop(counters.framing_errors);
+    return DEFRAME_MORE;
+  }
+  const uint16_t end = len - FRAME_CRC_LEN;
+#if FRAMING_COBS
+  const uint16_t crc = crc::Modbus::compute(body, end);
+#else
+  // NOTE: the escaped format covers the SOF, which is not in the body
+  const uint8_t sof = SOF;
+  const uint16_t crc = crc::Modbus::finish(crc::Modbus::update(
+      crc::Modbus::update(crc::Modbus::begin(), &sof, 1), body, end));
+#endif
+  if (crc != (uint16_t)(body[end] << 8 | body[end + 1])) {
+    drop(counters.crc_errors);
+    return DEFRAME_MORE;
+  }
+
+  last.payload = body + head;
+  counters.frames++;
+  counters.repaired += corrected > 0;
+  run = 0;
+  return DEFRAME_FRAME;
+}
+
+uint8_t Deframer::push(uint8_t b) {
+#if FRAMING_COBS
+  run++;
+  switch (cobs.push(b)) {
+  case COBS_FRAME:
+    return finish(cobs.length());
+  case COBS_ERROR:
+    drop(counters.framing_errors);
+    break;
+  default:
+    if (b == COBS_DELIMITER) {
+      counters.dropped += run; // idle line
+      run = 0;
+    }
+  }
+  return DEFRAME_MORE;
+#else
+  // NOTE: a SOF inside a frame is always escaped, one without an ESC in
+  // front starts a frame whatever came before it, which is how a broken
+  // frame is left behind
+  if (b == SOF && !escaped) {
+    if (!hunting) {
+      drop(counters.framing_errors);
+    }
+    filled = 0;
+    expected = sizeof(body);
+    escaped = false;
+    hunting = false;
+    run = 1;
+    return DEFRAME_MORE;
+  }
+  if (hunting) {
+    counters.dropped++;
+    return DEFRAME_MORE;
+  }
+  run++;
+  if (b == ESC && !escaped) {
+    escaped = true;
+    return DEFRAME_MORE;
+  }
+  escaped = false;
+  body[filled++] = b;
+  // NOTE: the length is in the header, which can only end on the last byte
+  // of a varint (v2, 5 bytes at least) or on the tenth (v1)
+  if (expected == sizeof(body) && filled >= 5 &&
+      (!(b & 0x80) || filled >= FRAME_HEADER_LEN - 1)) {
+    const int8_t head = take_header(body, filled, last.header);
+    if (head < 0 || (head > 0 && last.header.len > MAX_FRAME_PAYLOAD_LEN)) {
+      hunting = true;
+      drop(counters.framing_errors);
+      return DEFRAME_MORE;
+    }
+    if (head > 0) {
+      // NOTE: read before the FEC, a header hit by an error is lost
+      expected = head + last.header.len + FRAME_CRC_LEN;
+      expected += fec.overhead(expected);
+    }
+  }
+  if (filled == expected) {
+    hunting = true;
+    return finish(filled);
+  }
+  return DEFRAME_MORE;
+#endif
+}
+
+size_t Deframer::feed(const uint8_t *data, size_t len, uint8_t &status) {
+  for (size_t i = 0; i < len; i++) {
+    if (push(data[i]) == DEFRAME_FRAME) {
+      status = DEFRAME_FRAME;
+      return i + 1;
+    }
+  }
+  status = DEFRAME_MORE;
+  return len;
 }
@@ -2,34 +2,201 @@
 #define FRAMING_H_
 
 #include "encoder.h"
+#include "fec.h"
+#include "frame_len.h"
 #include "subsystem.h"
 
+/* header a node sends, gateways read both (see FrameHeader) */
+#ifndef FRAME_VERSION
+#define FRAME_VERSION 2
+#endif
+
 #define SOF 0x7E
 #define ESC 0x7F
+#define COBS_DELIMITER 0x00
+
+#define FRAME_V2_SEQUENCE_BITS 12
+// NOTE: the longest frame, a full batch (see BATCH_MAX_LEN)
+#define MAX_FRAME_LEN FRAME_MAX_LEN(MAX_FRAME_PAYLOAD_LEN)
 
-#define MAX_FRAME_LEN 72 // assuming every byte is escaped
+// NOTE: 16 bits as in the base station packets, a gateway serves thousands
+typedef uint16_t deviceid_t;
 
+/* v1, 10 bytes after the SOF: device id, flags, sequence and payload
+ * length, all big endian.
+ * v2, 3 to 10 bytes: version in the high nibble of the first byte and a 12
+ * bit rolling sequence in the rest of it and the next, then the device id
+ * and the flag word (see pack_flags) as varints, the payload length (a
+ * varint) only with escaped framing, COBS frames end where the body does.
+ * The high nibble of a v1 frame is that of the device id, so a fleet that
+ * mixes both keeps its v1 nodes below device id 0x1000 */
 struct FrameHeader {
   uint8_t sof;
-  uint8_t deviceid;
+  uint8_t version;
+  deviceid_t deviceid;
   uint32_t flags;
-  uint16_t sequence;
+  uint16_t sequence; // FRAME_V2_SEQUENCE_BITS of it in v2, see sequence_bits()
   uint16_t len;
   // variable length payload
   // 16 bit crc
 };
 
+/* flag word of a v2 header: the mode bits, FLAG_PACKED and the presence bits
+ * first, so that varint, entropy and batch frames take a single byte and
+ * keyframes two, the per field bits of the delta mode come last */
+static inline uint32_t pack_flags(flag_t f) {
+  return (f >> 25 & 0x3F) | (f >> 15 & 0x1) << 6 | (f >> 9 & 0x3F) << 7 |
+         (f & 0x1FF) << 13 | (f >> 16 & 0x1FF) << 22 | (f & 0x80000000);
+}
+
+static inline flag_t unpack_flags(uint32_t v) {
+  return (v & 0x3F) << 25 | (v >> 6 & 0x1) << 15 | (v >> 7 & 0x3F) << 9 |
+         (v >> 13 & 0x1FF) | (v >> 22 & 0x1FF) << 16 | (v & 0x80000000);
+}
+
+/* width of the sequence of a frame, for Decoder::decode() */
+static inline uint8_t sequence_bits(const FrameHeader &header) {
+  return header.version >= 2 ? FRAME_V2_SEQUENCE_BITS : 16;
+}
+
 typedef uint8_t FrameBuffer_t[MAX_FRAME_LEN];
 
+/* a frame built in place: the payload is encoded straight into payload()
+ * with the header room left in front, Framing::finalize() then fills in
+ * the header and the crc and escapes the frame without copying it out. A
+ * header shorter than the room leaves the frame starting at data().
+ * Only the metadata is in the struct, the bytes follow it in the Queue
+ * arena, FRAME_MAX_LEN(payload) of them */
+struct Frame {
+  flag_t flag;
+  uint16_t len;  // of the payload, of the whole frame once finalized
+  uint16_t size; // the record takes in the queue, see Queue::commit()
+  uint8_t start; // of the finalized frame in bytes()
+  bool sealed;   // finalized, see Queue::reserve()
+
+  uint8_t *bytes() { return (uint8_t *)(this + 1); }
+  uint8_t *payload() { return bytes() + FRAME_HEADER_ROOM; }
+  uint8_t *data() { return bytes() + start; }
+};
+
 class Framing : public Subsystem {
+private:
+  uint8_t version;
+  ReedSolomon fec;
+  FrameHeader header_for(flag_t flags, uint16_t sequence, uint16_t len) const;
+  uint16_t seal(uint8_t *frame, uint16_t len, uint16_t &crc);
+
 public:
   bool setup();
   void run(uint16_t dt);
-  FrameHeader frame(EncoderResult &result, uint16_t sequence,
-                    FrameBuffer_t &buffer, uint16_t &crc);
-  uint16_t escape(FrameBuffer_t &buffer,
+  /* header version of the frames from now on (setup() sets FRAME_VERSION) */
+  void set_version(uint8_t version) { this->version = version; }
+  /* FEC parity bytes per block from now on, FEC_PARITY at most (setup()
+   * sets it), 0: none */
+  void set_fec(uint8_t parity);
+  /* a copy of the payload of a single sample or of a batch, framed */
+  template <size_t N>
+  FrameHeader frame(const Encoded<N> &result, uint16_t sequence,
+                    FrameBuffer_t &buffer, uint16_t &crc) {
+    return frame(result.flag, result.data, result.len, sequence, buffer, crc);
+  }
+  FrameHeader frame(flag_t flag, const uint8_t *payload, uint16_t len,
+                    uint16_t sequence, FrameBuffer_t &buffer, uint16_t &crc);
+  /* finalize a frame whose payload is in place (once), frame.len becomes
+   * the length to transmit from frame.data() */
+  FrameHeader finalize(Frame &frame, uint16_t sequence, uint16_t &crc);
+  /* header without the SOF (of header.version), returns its length */
+  static uint8_t put_header(uint8_t *out, const FrameHeader &header);
+  /* the length put_header() returns, without writing it */
+  static uint8_t header_len(const FrameHeader &header);
+  uint16_t escape(uint8_t *frame,
                   uint16_t len); // escape the escape byte and the sof byte (
                                  // returns the final len)
+  /* COBS in place in one pass, the body is frame[1..len), frame[0] takes
+   * the first code byte, returns the final len (delimiter included) */
+  uint16_t stuff(uint8_t *frame, uint16_t len);
+};
+
+#define COBS_MORE 0x00
+#define COBS_FRAME 0x01 // a whole body is in the output, see length()
+#define COBS_ERROR 0x02 // truncated or too long, dropped up to the delimiter
+
+/* receiving end of FRAMING_COBS, one byte at a time straight off the radio
+ * or a serial port, decodes the frame body (header without the SOF, payload
+ * and crc) into `out` */
+class CobsDecoder {
+private:
+  uint8_t *out;
+  uint16_t capacity;
+  uint16_t len;
+  uint16_t done; // length of the last frame
+  uint8_t left;  // data bytes left in the block, 0: a code byte is next
+  uint8_t code; // of the current block, 0: before the first one
+  bool failed;
+
+public:
+  void begin(uint8_t *out, uint16_t capacity);
+  /* COBS_FRAME once the delimiter of a frame is in, the body must be used
+   * before the next byte (the next frame is decoded over it) */
+  uint8_t push(uint8_t b);
+  uint16_t length() const;
+};
+
+#define DEFRAME_MORE 0x00
+#define DEFRAME_FRAME 0x01 // a frame passed its checks, see frame()
+
+struct DeframerStats {
+  uint32_t frames;         // handed out
+  uint32_t crc_errors;     // whole frames with a bad crc
+  uint32_t framing_errors; // truncated, too long or a wrong length field
+  uint32_t dropped;        // stream bytes that ended up in no frame
+  uint32_t repaired;       // frames the FEC corrected
+  uint32_t fec_errors;     // frames with more errors than the FEC corrects
+};
+
+/* a received frame of either version, header.len is the payload length
+ * and payload points into the Deframer (valid until the next byte is
+ * pushed) */
+struct DeframedFrame {
+  FrameHeader header;
+  const uint8_t *payload;
+};
+
+/* inverse of Framing for gateways and host tools: takes the byte stream in
+ * chunks of any size (LoRa packets, a UART, a pty), so a frame may span
+ * several of them, unstuffs (or unescapes) it straight into its own body
+ * buffer, corrects it (FEC), checks the length and the crc and hands out
+ * the header and a view of the payload. A corrupted frame is dropped and
+ * the stream picks up again at the next delimiter (or SOF) */
+class Deframer {
+private:
+  uint8_t body[FRAME_CODED_LEN(MAX_FRAME_PAYLOAD_LEN)];
+  ReedSolomon fec;
+#if FRAMING_COBS
+  CobsDecoder cobs;
+#else
+  uint16_t filled;
+  uint16_t expected; // body length, known once the header is in
+  bool escaped;      // the last byte was an ESC
+  bool hunting;      // outside a frame, waiting for a SOF
+#endif
+  uint16_t run; // bytes since the frame started
+  DeframedFrame last;
+  DeframerStats counters;
+  uint8_t finish(uint16_t len);
+  void drop(uint32_t &error);
+  static int8_t take_header(const uint8_t *body, uint16_t len,
+                            FrameHeader &header);
+
+public:
+  /* `parity`: FEC parity bytes per block of the frames, as the sender's */
+  void begin(uint8_t parity = FEC_PARITY);
+  uint8_t push(uint8_t b);
+  /* pushes bytes up to the end of the next good frame, returns how many
+   * were taken, `status` tells if the last one completed a frame */
+  size_t feed(const uint8_t *data, size_t len, uint8_t &status);
+  const DeframedFrame &frame() const { return last; }
+  const DeframerStats &stats() const { return counters; }
 };
 
 #endif // FRAMING_H_
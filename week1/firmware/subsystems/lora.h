@@ -0,0 +1,69 @@
+/**
+ *  @file lora.h
+ *  @brief LoRa PHY settings of the node (used by Transmission) and the time
+ *  on air of a packet under them, after the Semtech SX1261/2 datasheet
+ *  (6.1.4). Free of the radio driver, so the host benches can use it.
+ *  */
+
+#ifndef LORA_H_
+#define LORA_H_
+
+#include "fec.h"
+#include <stdint.h>
+
+/* Transmission Configuration Macros */
+#ifndef RF_FREQUENCY
+#define RF_FREQUENCY 865000000
+#endif
+#ifndef TX_OUTPUT_POWER
+#define TX_OUTPUT_POWER 21
+#endif
+#ifndef LORA_BANDWIDTH
+#define LORA_BANDWIDTH 0 // 0: 125 kHz, 1: 250 kHz, 2: 500 kHz
+#endif
+#ifndef LORA_SPREADING_FACTOR
+#define LORA_SPREADING_FACTOR 7
+#endif
+#ifndef LORA_CODINGRATE
+#define LORA_CODINGRATE 1 // 1: 4/5 .. 4: 4/8
+#endif
+#define LORA_PREAMBLE_LENGTH 8
+#define LORA_FIX_LENGTH_PAYLOAD_ON false
+#define LORA_IQ_INVERSION_ON false
+// NOTE: off under FEC, the radio would drop the frames it can still correct
+#ifndef LORA_CRC_ON
+#define LORA_CRC_ON (FEC_PARITY == 0)
+#endif
+#define RX_TIMEOUT_VALUE 1000
+
+/* the radio length field is a byte */
+#define LORA_MAX_PAYLOAD 255
+
+namespace lora {
+
+constexpr uint32_t bandwidth_hz(uint8_t bw) {
+  return bw == 2 ? 500000 : bw == 1 ? 250000 : 125000;
+}
+
+/* time on air in us of a packet of `len` bytes */
+constexpr uint32_t airtime_us(uint16_t len, uint8_t sf = LORA_SPREADING_FACTOR,
+                              uint8_t bw = LORA_BANDWIDTH,
+                              uint8_t cr = LORA_CODINGRATE) {
+  const uint32_t symbol_us = ((uint32_t)1000000 << sf) / bandwidth_hz(bw);
+  // NOTE: low data rate optimization once a symbol takes over 16 ms
+  const int32_t de = symbol_us > 16000;
+  const int32_t ih = LORA_FIX_LENGTH_PAYLOAD_ON;
+  const int32_t bits = 8 * len - 4 * sf + 28 + 16 * LORA_CRC_ON - 20 * ih;
+  const int32_t per_block = 4 * (sf - 2 * de);
+  const int32_t blocks = bits > 0 ? (bits + per_block - 1) / per_block : 0;
+  const uint32_t payload_symbols = 8 + blocks * (cr + 4);
+  // NOTE: in quarter symbols, the preamble takes 4.25 symbols more
+  return (4 * (LORA_PREAMBLE_LENGTH + payload_symbols) + 17) * symbol_us / 4;
+}
+
+// NOTE: SF7 at 125 kHz, 4/5: 41 ms for 12 bytes
+static_assert(airtime_us(12, 7, 0, 1) == 41216, "time on air");
+
+} // namespace lora
+
+#endif // LORA_H_
@@ -1,61 +1,159 @@
 #include "queue.h"
-#include <string.h>
+
+#define QUEUE_MASK (QUEUE_ARENA_BYTES - 1)
 
 bool Queue::setup() {
-  head = 0;
-  tail = 0;
-  count = 0;
-  memset(buffer, 0, sizeof(buffer));
+  clear();
+  high_water = 0;
+  most_frames = 0;
+  dropped = 0;
   return true;
 }
 
 void Queue::run(uint16_t dt) { (void)dt; }
 
-bool Queue::push(const EncoderResult &result) {
-  memcpy(&buffer[head], &result, sizeof(EncoderResult));
-  head = (head + 1) % QUEUE_MAX_SIZE;
+/* NOTE: a record past the wrap when `counter` is at one: the end of the
+ * arena is too short for a Frame or a Frame of size 0 marks it */
+uint32_t Queue::skip(uint32_t counter) {
+  const uint32_t end = QUEUE_ARENA_BYTES - (counter & QUEUE_MASK);
+  return end < sizeof(Frame) || record(counter)->size == 0 ? counter + end
+                                                            : counter;
+}
+
+/* NOTE: the record of the oldest frame, the write end `h` when there is
+ * none (the tail may only be at a wrap reserve() published) */
+uint32_t Queue::oldest(uint32_t h) {
+  const uint32_t t = tail.load(std::memory_order_relaxed);
+  return t == h ? t : skip(t);
+}
+
+/* NOTE: room for reserve() at the write end `h`, with the end of the arena
+ * skipped if the longest record does not fit in front of it */
+bool Queue::fits(uint32_t h) const {
+  const uint32_t end = QUEUE_ARENA_BYTES - (h & QUEUE_MASK);
+  const uint32_t need =
+      (end < QUEUE_RECORD_MAX ? end : 0) + QUEUE_RECORD_MAX;
+  return QUEUE_ARENA_BYTES - (h - tail.load(std::memory_order_acquire)) >=
+         need;
+}
 
-  if (count < QUEUE_MAX_SIZE) {
-    count++;
-  } else {
-    tail = (tail + 1) % QUEUE_MAX_SIZE;
+Frame *Queue::reserve() {
+  uint32_t h = head.load(std::memory_order_relaxed);
+  if (!fits(h)) {
+    return nullptr;
   }
+  const uint32_t end = QUEUE_ARENA_BYTES - (h & QUEUE_MASK);
+  if (end < QUEUE_RECORD_MAX) {
+    if (end >= sizeof(Frame)) {
+      record(h)->size = 0;
+    }
+    h += end;
+    head.store(h, std::memory_order_release);
+  }
+  Frame *frame = record(h);
+  frame->sealed = false;
+  return frame;
+}
 
-  return true;
+void Queue::commit() {
+  const uint32_t h = head.load(std::memory_order_relaxed);
+  Frame *frame = record(h);
+  frame->size = QUEUE_RECORD_LEN(frame->len);
+  head.store(h + frame->size, std::memory_order_release);
+  const uint16_t c = committed.load(std::memory_order_relaxed) + 1;
+  committed.store(c, std::memory_order_release);
+
+  // NOTE: the counters at hand, stats() would load every one of them again
+  const uint32_t bytes =
+      h + frame->size - tail.load(std::memory_order_acquire);
+  const uint16_t frames = c - released.load(std::memory_order_acquire);
+  high_water = bytes > high_water ? bytes : high_water;
+  most_frames = frames > most_frames ? frames : most_frames;
+}
+
+Frame *Queue::front() {
+  const uint32_t h = head.load(std::memory_order_acquire);
+  const uint32_t t = oldest(h);
+  return t == h ? nullptr : record(t);
 }
 
-bool Queue::pop(EncoderResult &result) {
-  if (isEmpty()) {
-    return false;
+Frame *Queue::peek(uint16_t i) {
+  const uint32_t h = head.load(std::memory_order_acquire);
+  uint32_t t = tail.load(std::memory_order_relaxed);
+  for (uint16_t n = 0; t != h; n++) {
+    t = skip(t);
+    if (t == h) {
+      break; // NOTE: a wrap reserve() published, nothing behind it yet
+    }
+    if (n == i) {
+      return record(t);
+    }
+    t += record(t)->size;
   }
+  return nullptr;
+}
+
+Frame *Queue::next(const Frame *frame) {
+  // NOTE: on the masked counters, the records of the queue never overlap
+  const uint32_t h = head.load(std::memory_order_acquire) & QUEUE_MASK;
+  uint32_t t = (uint32_t)((const uint8_t *)frame - arena) + frame->size;
+  if ((t & QUEUE_MASK) == h) {
+    return nullptr;
+  }
+  t = skip(t);
+  return (t & QUEUE_MASK) == h ? nullptr : record(t);
+}
 
-  memcpy(&result, &buffer[tail], sizeof(EncoderResult));
-  tail = (tail + 1) % QUEUE_MAX_SIZE;
-  count--;
+void Queue::release() {
+  const uint32_t h = head.load(std::memory_order_acquire);
+  const uint32_t t = oldest(h);
+  if (t == h) {
+    return;
+  }
 
-  return true;
+  tail.store(t + record(t)->size, std::memory_order_release);
+  released.store(released.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_release);
 }
 
-bool Queue::peek(EncoderResult &result) const {
-  if (isEmpty()) {
-    return false;
+void Queue::drop() {
+  if (!isEmpty()) {
+    release();
+    dropped++;
   }
+}
 
-  memcpy(&result, &buffer[tail], sizeof(EncoderResult));
-  return true;
+uint16_t Queue::size() const {
+  return committed.load(std::memory_order_acquire) -
+         released.load(std::memory_order_acquire);
 }
 
-uint16_t Queue::size() const { return count; }
+uint16_t Queue::releases() const {
+  return released.load(std::memory_order_relaxed);
+}
 
-bool Queue::isEmpty() const { return count == 0; }
+bool Queue::isEmpty() const { return size() == 0; }
 
-bool Queue::isFull() const { return count == QUEUE_MAX_SIZE; }
+bool Queue::isFull() const {
+  return !fits(head.load(std::memory_order_acquire));
+}
 
 void Queue::clear() {
-  head = 0;
-  tail = 0;
-  count = 0;
-  memset(buffer, 0, sizeof(buffer));
+  head.store(0, std::memory_order_relaxed);
+  tail.store(0, std::memory_order_relaxed);
+  committed.store(0, std::memory_order_relaxed);
+  released.store(0, std::memory_order_relaxed);
 }
 
-uint16_t Queue::capacity() const { return QUEUE_MAX_SIZE; }
+uint16_t Queue::capacity() const { return QUEUE_ARENA_BYTES; }
+
+QueueStats Queue::stats() const {
+  QueueStats s;
+  s.bytes = head.load(std::memory_order_acquire) -
+            tail.load(std::memory_order_acquire);
+  s.frames = size();
+  s.high_water = high_water;
+  s.most_frames = most_frames;
+  s.dropped = dropped;
+  return s;
+}
@@ -1,33 +1,96 @@
 #ifndef QUEUE_H_
 #define QUEUE_H_
 
-#include "encoder.h"
+#include "framing.h"
 #include "subsystem.h"
+#include <atomic>
 
-#ifndef QUEUE_MAX_SIZE
-#define QUEUE_MAX_SIZE 16
+/* bytes of frames the node holds on to, a power of two. A frame takes what
+ * its payload needs to be sealed in place (QUEUE_RECORD_LEN), not the
+ * longest one */
+#ifndef QUEUE_ARENA_BYTES
+#define QUEUE_ARENA_BYTES 4096
 #endif
 
+/* NOTE: a record is the Frame and the bytes behind it, rounded up so that
+ * the next Frame is aligned */
+#define QUEUE_ALIGN alignof(Frame)
+#define QUEUE_RECORD_LEN(payload)                                              \
+  ((sizeof(Frame) + FRAME_MAX_LEN(payload) + QUEUE_ALIGN - 1) &                \
+   ~(QUEUE_ALIGN - 1))
+#define QUEUE_RECORD_MAX QUEUE_RECORD_LEN(MAX_FRAME_PAYLOAD_LEN)
+
+static_assert((QUEUE_ARENA_BYTES & (QUEUE_ARENA_BYTES - 1)) == 0,
+              "QUEUE_ARENA_BYTES is a power of two");
+/* NOTE: the newest frame, the room to encode the next and what a wrap may
+ * skip in front of it (less than one record) */
+static_assert(QUEUE_ARENA_BYTES >= 3 * QUEUE_RECORD_MAX,
+              "the arena holds a frame and the room to encode the next");
+
+struct QueueStats {
+  uint32_t bytes;       // taken now, the space skipped at a wrap included
+  uint16_t frames;      // queued now
+  uint32_t high_water;  // most bytes ever taken
+  uint16_t most_frames; // most frames ever queued
+  uint32_t dropped;     // frames given up before they went out, see drop()
+};
+
+/* the frames waiting for the radio, back to back in one byte ring. The
+ * encoder is the producer: reserve() hands out room for the longest frame
+ * at the write end, commit() keeps only what the payload needs. A record
+ * never wraps, one that does not fit before the end of the arena starts
+ * over at its front and the rest is skipped (a Frame of size 0 marks it,
+ * when there is room for one). The aggregator is the consumer, and only it
+ * gives frames up: a full queue is spilled to flash (see spool.h) or its
+ * oldest frames dropped before the next reserve(). Each end only moves its
+ * own counter, published with release order and read with acquire order,
+ * as in SpscRing */
 class Queue : public Subsystem {
 private:
-  EncoderResult buffer[QUEUE_MAX_SIZE];
-  uint16_t head;
-  uint16_t tail;
-  uint16_t count;
+  alignas(Frame) uint8_t arena[QUEUE_ARENA_BYTES];
+  std::atomic<uint32_t> head; // producer's, free running byte counters
+  std::atomic<uint32_t> tail; // consumer's
+  std::atomic<uint16_t> committed;
+  std::atomic<uint16_t> released;
+  uint32_t high_water;
+  uint16_t most_frames;
+  uint32_t dropped;
+
+  Frame *record(uint32_t counter) {
+    return (Frame *)(arena + (counter & (QUEUE_ARENA_BYTES - 1)));
+  }
+  uint32_t skip(uint32_t counter);
+  uint32_t oldest(uint32_t h);
+  bool fits(uint32_t h) const;
 
 public:
   bool setup();
   void run(uint16_t dt);
 
-  bool push(const EncoderResult &result);
-  bool pop(EncoderResult &result);
-  bool peek(EncoderResult &result) const;
+  /* producer: frame to encode the next payload into, nullptr while the
+   * queue is full. Queued by commit() */
+  Frame *reserve();
+  void commit();
+  /* oldest frame, it stays queued until release() */
+  Frame *front();
+  /* i-th oldest frame, nullptr past the last one */
+  Frame *peek(uint16_t i);
+  /* the frame queued behind `frame` (still queued), nullptr if none */
+  Frame *next(const Frame *frame);
+  void release();
+  /* consumer: releases the oldest frame unsent, counted as dropped */
+  void drop();
 
   uint16_t size() const;
+  /* frames released so far, wrapping, a change means the front moved */
+  uint16_t releases() const;
   bool isEmpty() const;
+  /* reserve() has no room for a frame of the longest kind */
   bool isFull() const;
   void clear();
+  /* bytes, see stats() for the occupancy */
   uint16_t capacity() const;
+  QueueStats stats() const;
 };
 
 #endif // QUEUE_H_
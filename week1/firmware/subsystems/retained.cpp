@@ -0,0 +1,99 @@
+#include "retained.h"
+#include <stddef.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <esp_attr.h>
+#else
+#include <stdio.h>
+#define RTC_NOINIT_ATTR
+#endif
+
+#define RETAINED_MAGIC 0x52544E31 // "RTN1"
+
+// NOTE: a build with another EncoderState or sensor profile does not take
+// over the state of the previous one
+static constexpr uint32_t RETAINED_LAYOUT =
+    RETAINED_MAGIC ^ (uint32_t)sizeof(RetainedState) << 8 ^
+    (uint32_t)(SENSOR_PROFILE) << 24;
+
+/* RTC slow memory, neither cleared by the startup code nor powered down in
+ * deep sleep, garbage after a power on (which the checksum tells) */
+static RTC_NOINIT_ATTR RetainedState rtc_state;
+
+static uint32_t retained_checksum(const RetainedState &s) {
+  const uint8_t *p = (const uint8_t *)&s;
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < offsetof(RetainedState, checksum); i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+#ifdef ARDUINO
+
+bool Retained::setup() { return true; }
+
+#else
+
+/* the file stands in for the RTC memory, read back at every "wake up" */
+bool Retained::setup() {
+  FILE *f = fopen(path, "rb");
+  if (!f || fread(&rtc_state, sizeof(rtc_state), 1, f) != 1) {
+    memset(&rtc_state, 0, sizeof(rtc_state));
+  }
+  if (f) {
+    fclose(f);
+  }
+  return true;
+}
+
+void Retained::store() {
+  FILE *f = fopen(path, "wb");
+  if (f) {
+    fwrite(&rtc_state, sizeof(rtc_state), 1, f);
+    fclose(f);
+  }
+}
+
+#endif
+
+void Retained::run(uint16_t dt) { (void)dt; }
+
+bool Retained::restore(Encoder &encoder, uint16_t &sequence,
+                       OpenBatch *batch) {
+  if (rtc_state.layout != RETAINED_LAYOUT ||
+      rtc_state.checksum != retained_checksum(rtc_state) ||
+      rtc_state.batch.count > BATCH_MAX_SAMPLES) {
+    return false;
+  }
+  encoder.restore(rtc_state.encoder);
+  sequence = rtc_state.sequence;
+  if (batch) {
+    *batch = rtc_state.batch;
+  }
+  invalidate();
+  return true;
+}
+
+void Retained::save(const Encoder &encoder, uint16_t sequence,
+                    const OpenBatch *batch) {
+  memset(&rtc_state, 0, sizeof(rtc_state));
+  rtc_state.layout = RETAINED_LAYOUT;
+  rtc_state.sequence = sequence;
+  rtc_state.encoder = encoder.save();
+  if (batch) {
+    rtc_state.batch = *batch;
+  }
+  rtc_state.checksum = retained_checksum(rtc_state);
+#ifndef ARDUINO
+  store();
+#endif
+}
+
+void Retained::invalidate() {
+  rtc_state.layout = 0;
+#ifndef ARDUINO
+  store();
+#endif
+}
@@ -0,0 +1,64 @@
+/**
+ *  @file retained.h
+ *  @brief What a node carries through a deep sleep: the encoder delta chain,
+ *  the frame sequence and the samples of a batch not sent yet, kept in RTC
+ *  memory that the wake up does not clear (a file on the host) and guarded
+ *  by a checksum, so a node that wakes up carries on with delta frames
+ *  instead of a keyframe and fills its batch a sample per wake up.
+ *  */
+
+#ifndef RETAINED_H_
+#define RETAINED_H_
+
+#include "encoder.h"
+#include "subsystem.h"
+
+#ifndef RETAINED_FILE
+#define RETAINED_FILE "retained.bin"
+#endif
+
+/* the samples of a batch taken so far, see Encoder::encode_batch() */
+struct OpenBatch {
+  SensorData samples[BATCH_MAX_SAMPLES];
+  uint8_t count;
+  uint32_t timestamp; // of the first sample, node time in ms
+  // NOTE: millis() starts over at every wake up, the node time goes on
+  uint32_t clock; // node time in ms at the wake up, millis() counts on
+};
+
+struct RetainedState {
+  uint32_t layout; // RETAINED_MAGIC mixed with the size and SENSOR_PROFILE
+  uint16_t sequence;
+  EncoderState encoder;
+  OpenBatch batch;
+  uint32_t checksum; // fnv-1a of everything above
+};
+
+/* NOTE: save() right before the deep sleep and only with the queue empty,
+ * the queue does not survive the sleep and a delta frame the gateway never
+ * saw (not even as a sequence gap) leaves it decoding garbage. restore()
+ * consumes the state, a reset before the next save() starts over with a
+ * keyframe instead of replaying a stale chain */
+class Retained : public Subsystem {
+private:
+#ifndef ARDUINO
+  const char *path;
+  void store();
+#endif
+
+public:
+#ifndef ARDUINO
+  explicit Retained(const char *path = RETAINED_FILE) : path(path) {}
+#endif
+  bool setup();
+  void run(uint16_t dt);
+  /* true if a state survived intact, `encoder`, `sequence` and `batch`
+   * (if any) then carry on from it, all are left alone otherwise */
+  bool restore(Encoder &encoder, uint16_t &sequence,
+               OpenBatch *batch = nullptr);
+  void save(const Encoder &encoder, uint16_t sequence,
+            const OpenBatch *batch = nullptr);
+  void invalidate();
+};
+
+#endif // RETAINED_H_
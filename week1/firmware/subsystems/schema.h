@@ -0,0 +1,783 @@
+/**
+ *  @file schema.h
+ *  @brief Single description of the SensorData fields that travel over the
+ *  air. The encoder, the decoder, the flag layout and the payload bound are
+ *  all generated from SENSOR_FIELDS at compile time.
+ *  */
+
+#ifndef SCHEMA_H_
+#define SCHEMA_H_
+
+#include "../meta.h"
+#include "bits.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+typedef uint32_t flag_t; // flag interface
+
+/* sensor a field is read from */
+#define SENSOR_BME680 (1u << 0)
+#define SENSOR_MQ135 (1u << 1)
+#define SENSOR_ANEMO (1u << 2)
+
+#define SENSOR_ALL (SENSOR_BME680 | SENSOR_MQ135 | SENSOR_ANEMO)
+
+/* sensors the node variant is built with, the fields of the others are
+ * compiled out of the codec and never sent (eg. -DSENSOR_PROFILE=SENSOR_BME680
+ * for a node without the MQ135 and the anemometer, or
+ * -DSENSOR_PROFILE=SENSOR_BME680|SENSOR_MQ135). A gateway decodes the nodes
+ * of any profile within its own, see with_fields() */
+#ifndef SENSOR_PROFILE
+#define SENSOR_PROFILE SENSOR_ALL
+#endif
+
+/* The field table, in payload order. Adding a field to SensorData only needs
+ * one more line here.
+ *   id       : suffix of the FIELD_* identifier
+ *   member   : path of the member inside SensorData
+ *   scale    : fixed point divisor to get back the physical unit
+ *   delta    : field is delta encoded (otherwise always sent as it is)
+ *   sensor   : SENSOR_* the value comes from
+ *   min, max : physical range (in fixed point), sizes the packed keyframe
+ *   band     : dead band (in fixed point), changes up to it are not reported
+ *              with ENCODE_DEADBAND
+ *   quant    : quantization step of ENCODE_LOSSY (in fixed point), the error
+ *              stays within quant / 2 */
+#define SENSOR_FIELDS(X)                                                        \
+  X(TEMPR, bsec_data.temperature, 100, true, SENSOR_BME680, -4000, 8500, 5, 10) \
+  X(HUMID, bsec_data.humidity, 100, true, SENSOR_BME680, 0, 10000, 20, 10)      \
+  X(PRESR, bsec_data.pressure, 1, true, SENSOR_BME680, 0, 131071, 2, 4)         \
+  X(IAQ, bsec_data.iaq, 1, true, SENSOR_BME680, 0, 511, 1, 1)                   \
+  X(IAQAC, bsec_data.iaqAccuracy, 1, false, SENSOR_BME680, 0, 3, 0, 1)          \
+  X(STIAQ, bsec_data.staticIaq, 1, true, SENSOR_BME680, 0, 511, 1, 1)           \
+  X(CO2EQ, bsec_data.co2Equivalent, 1, true, SENSOR_BME680, 0, 16383, 2, 4)     \
+  X(BTVOC, bsec_data.breathVoc, 100, true, SENSOR_BME680, 0, 65535, 2, 5)       \
+  X(GASPC, bsec_data.gasPercentage, 1, false, SENSOR_BME680, 0, 100, 0, 1)      \
+  X(STABS, bsec_data.stabStatus, 1, false, SENSOR_BME680, 0, 1, 0, 1)           \
+  X(RUNIN, bsec_data.runInStatus, 1, false, SENSOR_BME680, 0, 1, 0, 1)          \
+  X(MQ135, mq135_data.analog, 1, true, SENSOR_MQ135, 0, 4095, 2, 4)             \
+  X(ANEMO, anemo_data, 1, true, SENSOR_ANEMO, 0, 4095, 0, 1)
+
+enum FieldId : uint8_t {
+#define X(id, ...) FIELD_##id,
+  SENSOR_FIELDS(X)
+#undef X
+      FIELD_COUNT
+};
+
+namespace schema {
+
+/* compile time descriptor of one field */
+template <size_t I> struct Field;
+
+/* number of bits needed to hold 0..range */
+constexpr uint8_t bits_for(uint32_t range) {
+  uint8_t n = 0;
+  for (; range; range >>= 1) {
+    n++;
+  }
+  return n;
+}
+
+#define X(id, member, scale_, delta_, sensor_, min_, max_, band_, quant_)      \
+  template <> struct Field<FIELD_##id> {                                       \
+    typedef decltype(((SensorData *)0)->member) type;                          \
+    typedef typename std::make_unsigned<type>::type wire;                      \
+    static constexpr size_t offset = offsetof(SensorData, member);             \
+    static constexpr uint8_t width = sizeof(type);                             \
+    static constexpr bool is_signed = std::is_signed<type>::value;             \
+    static constexpr uint16_t scale = scale_;                                  \
+    static constexpr bool delta = delta_;                                      \
+    static constexpr uint8_t sensor = sensor_;                                 \
+    static constexpr int32_t min = min_;                                       \
+    static constexpr int32_t max = max_;                                       \
+    static constexpr uint8_t bits = bits_for((uint32_t)(max_ - min_));        \
+    static constexpr int32_t band = band_;                                     \
+    static constexpr int32_t quant = quant_;                                   \
+    static_assert(quant >= 1, "quantization step of at least one");           \
+    static_assert(bits <= 8 * sizeof(type), "range wider than the member");   \
+    static type get(const SensorData &d) { return d.member; }                  \
+    static type &ref(SensorData &d) { return d.member; }                       \
+  };
+SENSOR_FIELDS(X)
+#undef X
+
+constexpr uint8_t SENSOR[] = {
+#define X(id, member, scale, delta, sensor, ...) sensor,
+    SENSOR_FIELDS(X)
+#undef X
+};
+
+constexpr bool present(size_t field, uint8_t sensors = SENSOR_PROFILE) {
+  return (SENSOR[field] & sensors) != 0;
+}
+
+template <typename A, typename B> struct concat;
+template <size_t... A, size_t... B>
+struct concat<std::index_sequence<A...>, std::index_sequence<B...>> {
+  typedef std::index_sequence<A..., B...> type;
+};
+
+/* indices of the fields of the sensors `S`, from `I` on */
+template <uint8_t S, size_t I, size_t N> struct present_from {
+  typedef typename concat<
+      typename std::conditional<present(I, S), std::index_sequence<I>,
+                                std::index_sequence<>>::type,
+      typename present_from<S, I + 1, N>::type>::type type;
+};
+template <uint8_t S, size_t N> struct present_from<S, N, N> {
+  typedef std::index_sequence<> type;
+};
+
+template <uint8_t S>
+using FieldsOf = typename present_from<S, 0, FIELD_COUNT>::type;
+
+/* NOTE: the codec folds over these, a field outside the profile costs no
+ * code, no cycles and no payload, FIELD_* and the flag bits keep their
+ * table positions so the wire layout of the other fields does not move */
+typedef FieldsOf<(SENSOR_PROFILE)> Fields;
+static_assert(Fields::size() > 0, "SENSOR_PROFILE has no field");
+static_assert(((SENSOR_PROFILE) & ~SENSOR_ALL) == 0, "unknown sensor");
+
+/* calls fn with the fields of a node built with the sensors `sensors`, one
+ * instance of it for every profile within SENSOR_PROFILE so the folds stay
+ * compile time. NOTE: the caller checks `sensors` is one of them, anything
+ * else gets the fields of the profile */
+template <uint8_t S = SENSOR_ALL, typename Fn>
+static inline auto with_fields(uint8_t sensors, Fn &&fn) {
+  if constexpr (S == 0) {
+    return fn(Fields{});
+  } else if constexpr ((S & ~(SENSOR_PROFILE)) != 0) {
+    return with_fields<S - 1>(sensors, fn);
+  } else {
+    if (sensors == S) {
+      return fn(FieldsOf<S>{});
+    }
+    return with_fields<S - 1>(sensors, fn);
+  }
+}
+
+/* flag layout: delta eligible field k (in table order) owns bit k for "sent
+ * as one byte" and bit NEG_SHIFT + k for "negative delta" */
+#define FLAG_NEG_SHIFT 16
+
+constexpr bool DELTA[] = {
+#define X(id, member, scale, delta, ...) delta,
+    SENSOR_FIELDS(X)
+#undef X
+};
+
+constexpr uint8_t delta_index(size_t field) {
+  uint8_t n = 0;
+  for (size_t i = 0; i < field; i++) {
+    n += DELTA[i];
+  }
+  return n;
+}
+
+constexpr uint8_t DELTA_FIELDS = delta_index(FIELD_COUNT);
+static_assert(DELTA_FIELDS <= 9, "delta flags would overlap FLAG_PRESN_*");
+
+constexpr flag_t delta_flag(size_t field) {
+  return (flag_t)1 << delta_index(field);
+}
+constexpr flag_t neg_flag(size_t field) {
+  return (flag_t)1 << (FLAG_NEG_SHIFT + delta_index(field));
+}
+
+template <size_t... I>
+constexpr size_t payload_len(std::index_sequence<I...>) {
+  return (Field<I>::width + ... + 0);
+}
+
+template <size_t... I>
+constexpr size_t packed_bits(std::index_sequence<I...>) {
+  return (Field<I>::bits + ... + 0);
+}
+
+/* packed keyframe: every field at the bit width of its physical range */
+template <size_t... I>
+constexpr size_t packed_len(std::index_sequence<I...> fields) {
+  return (packed_bits(fields) + 7) / 8;
+}
+constexpr size_t PACKED_KEYFRAME_LEN = packed_len(Fields{});
+
+/* varint mode: a bitmap of the changed fields leads the payload */
+typedef uint16_t changed_t;
+static_assert(FIELD_COUNT <= 8 * sizeof(changed_t), "widen changed_t");
+constexpr uint8_t CHANGED_LEN = (FIELD_COUNT + 7) / 8;
+
+template <size_t... I>
+constexpr changed_t field_mask(std::index_sequence<I...>) {
+  return (changed_t)((((changed_t)1 << I) | ... | 0));
+}
+
+/* longest LEB128 form of an integer of the given width */
+constexpr uint8_t varint_len(size_t width) { return (8 * width + 6) / 7; }
+
+template <size_t... I>
+constexpr size_t varint_payload_len(std::index_sequence<I...>) {
+  return CHANGED_LEN + ((Field<I>::delta ? varint_len(Field<I>::width)
+                                         : Field<I>::width) +
+                        ... + 0);
+}
+
+constexpr size_t max_len(size_t a, size_t b) { return a > b ? a : b; }
+
+/* predictors: the guess the decoder makes from the history, only the
+ * residual against it goes over the air (delta fields only) */
+enum Predictor : uint8_t {
+  PRED_PREV = 0,   // previous value, plain delta
+  PRED_LINEAR = 1, // linear extrapolation of the last two, delta of delta
+  PRED_XOR = 2,    // xor with the previous value, for float derived fields
+  PRED_COUNT
+};
+
+/* PRED_* of every field, zeroed it is PRED_PREV everywhere (the default) */
+struct PredictorMap {
+  uint8_t field[FIELD_COUNT];
+};
+
+/* sent in front of a delta payload when the map changes (FLAG_PREDICT),
+ * PRED_BITS per delta field */
+constexpr uint8_t PRED_BITS = 2;
+constexpr uint8_t PRED_MAP_LEN = (PRED_BITS * DELTA_FIELDS + 7) / 8;
+
+/* batch mode: sample count, timestamp base (ms) and sample interval (ms),
+ * then a keyframe of the first sample and a varint record for each of the
+ * others */
+#ifndef BATCH_MAX_SAMPLES
+#define BATCH_MAX_SAMPLES 10
+#endif
+static_assert(BATCH_MAX_SAMPLES >= 1 && BATCH_MAX_SAMPLES <= 0xFF,
+              "the sample count travels in one byte");
+constexpr uint8_t BATCH_HEADER_LEN = 1 + 4 + 2;
+
+constexpr size_t batch_payload_len(size_t samples) {
+  return BATCH_HEADER_LEN + PRED_MAP_LEN +
+         max_len(PACKED_KEYFRAME_LEN, payload_len(Fields{})) +
+         (samples - 1) * varint_payload_len(Fields{});
+}
+
+/* largest payload of a single sample: every field at its widest form (the
+ * entropy coder can go past it, see MAX_ENCODED_DATA_LEN). A batch has a
+ * bound of its own, BATCH_MAX_LEN */
+constexpr size_t MAX_PAYLOAD_LEN =
+    PRED_MAP_LEN + max_len(payload_len(Fields{}), varint_payload_len(Fields{}));
+
+/* big endian helpers, the loops have a constant trip count and unroll */
+template <typename U> static inline uint8_t put(uint8_t *out, U v) {
+  for (size_t b = sizeof(U); b-- > 0;) {
+    *out++ = (uint8_t)(v >> (8 * b));
+  }
+  return sizeof(U);
+}
+
+template <typename U> static inline U take(const uint8_t *in) {
+  U v = 0;
+  for (size_t b = 0; b < sizeof(U); b++) {
+    v = (U)((v << 8) | in[b]);
+  }
+  return v;
+}
+
+/* full width keyframe: two's complement for signed fields, used when a value
+ * falls outside the range of the packed keyframe */
+template <size_t I>
+static inline void encode_raw(const SensorData &d, uint8_t *out, uint8_t &idx) {
+  typedef Field<I> F;
+  idx += put<typename F::wire>(out + idx, (typename F::wire)F::get(d));
+}
+
+template <size_t I>
+static inline void decode_raw(SensorData &d, const uint8_t *in, uint8_t &idx) {
+  typedef Field<I> F;
+  F::ref(d) = (typename F::type)take<typename F::wire>(in + idx);
+  idx += F::width;
+}
+
+/* packed keyframe, values are stored as an offset from the range minimum */
+template <size_t I> static inline bool in_range(const SensorData &d) {
+  typedef Field<I> F;
+  return (int64_t)F::get(d) >= F::min && (int64_t)F::get(d) <= F::max;
+}
+
+template <size_t I>
+static inline void encode_packed(const SensorData &d, BitWriter &w) {
+  typedef Field<I> F;
+  w.write((uint32_t)((int64_t)F::get(d) - F::min), F::bits);
+}
+
+template <size_t I>
+static inline void decode_packed(SensorData &d, BitReader &r) {
+  typedef Field<I> F;
+  F::ref(d) = (typename F::type)((int64_t)r.read(F::bits) + F::min);
+}
+
+static inline bool default_predictors(const PredictorMap &map) {
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    if (map.field[i] != PRED_PREV) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline uint8_t put_predictors(uint8_t *out, const PredictorMap &map) {
+  BitWriter w(out, PRED_MAP_LEN);
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    if (DELTA[i]) {
+      w.write(map.field[i], PRED_BITS);
+    }
+  }
+  return (uint8_t)w.flush();
+}
+
+/* returns false on an unknown predictor id, map is then left half written */
+static inline bool take_predictors(const uint8_t *in, PredictorMap &map) {
+  BitReader r(in, PRED_MAP_LEN);
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    map.field[i] = DELTA[i] ? (uint8_t)r.read(PRED_BITS) : (uint8_t)PRED_PREV;
+    if (map.field[i] >= PRED_COUNT) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* NOTE: all predictor arithmetic wraps at the field width, the decoder
+ * undoes it the same way so no range check is needed */
+template <size_t I>
+static inline typename Field<I>::wire predict(const SensorData &prev2,
+                                              const SensorData &prev,
+                                              uint8_t pred) {
+  typedef typename Field<I>::wire U;
+  const U p = (U)Field<I>::get(prev);
+  if (pred == PRED_LINEAR) {
+    return (U)(p + (U)(p - (U)Field<I>::get(prev2)));
+  }
+  return p;
+}
+
+template <typename U> static inline U residual(U next, U base, uint8_t pred) {
+  return pred == PRED_XOR ? (U)(next ^ base) : (U)(next - base);
+}
+
+template <typename U> static inline U restore(U res, U base, uint8_t pred) {
+  return pred == PRED_XOR ? (U)(res ^ base) : (U)(base + res);
+}
+
+/* delta frame: magnitude of the residual as one byte when it fits, otherwise
+ * at full width; the sign travels in the flag word (never set for xor) */
+template <size_t I>
+static inline void encode_delta(const SensorData &prev2, const SensorData &prev,
+                                const SensorData &next, uint8_t *out,
+                                uint8_t &idx, flag_t &flag,
+                                const PredictorMap &map) {
+  typedef Field<I> F;
+  typedef typename F::wire U;
+  typedef typename std::make_signed<U>::type S;
+  if constexpr (!F::delta) {
+    encode_raw<I>(next, out, idx);
+  } else {
+    const uint8_t pred = map.field[I];
+    U mag = residual<U>((U)F::get(next), predict<I>(prev2, prev, pred), pred);
+    if (pred != PRED_XOR && (S)mag < 0) {
+      mag = (U)(0 - mag);
+      flag |= neg_flag(I);
+    }
+    if (mag <= 0xFF) {
+      out[idx++] = (uint8_t)mag;
+      flag |= delta_flag(I);
+    } else {
+      idx += put<U>(out + idx, mag);
+    }
+  }
+}
+
+template <size_t I>
+static inline void decode_delta(const SensorData &prev2, const SensorData &prev,
+                                SensorData &next, const uint8_t *in,
+                                uint8_t &idx, flag_t flag,
+                                const PredictorMap &map) {
+  typedef Field<I> F;
+  typedef typename F::wire U;
+  if constexpr (!F::delta) {
+    decode_raw<I>(next, in, idx);
+  } else {
+    U mag;
+    if (flag & delta_flag(I)) {
+      mag = in[idx++];
+    } else {
+      mag = take<U>(in + idx);
+      idx += F::width;
+    }
+    if (flag & neg_flag(I)) {
+      mag = (U)(0 - mag);
+    }
+    const uint8_t pred = map.field[I];
+    F::ref(next) = (typename F::type)restore<U>(
+        mag, predict<I>(prev2, prev, pred), pred);
+  }
+}
+
+/* zigzag folds the sign into the lowest bit so small negative deltas stay
+ * small: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ... (modulo the field width) */
+template <typename U> static inline U zigzag(U delta) {
+  typedef typename std::make_signed<U>::type S;
+  return (U)((U)(delta << 1) ^ (U)((S)delta >> (8 * sizeof(U) - 1)));
+}
+
+template <typename U> static inline U unzigzag(U z) {
+  return (U)((U)(z >> 1) ^ (U)(0 - (U)(z & 1)));
+}
+
+/* LEB128: 7 bits per byte, least significant group first, high bit set on
+ * every byte but the last */
+template <typename U> static inline uint8_t put_varint(uint8_t *out, U v) {
+  uint8_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (uint8_t)(v | 0x80);
+    v = (U)(v >> 7);
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+/* bytes put_varint() takes for `v` */
+template <typename U> static inline uint8_t varint_size(U v) {
+  uint8_t n = 1;
+  for (; v >= 0x80; n++) {
+    v = (U)(v >> 7);
+  }
+  return n;
+}
+
+/* NOTE: reads at most varint_len(sizeof(U)) bytes even on corrupt input */
+template <typename U> static inline U take_varint(const uint8_t *in,
+                                                  uint8_t &idx) {
+  U v = 0;
+  for (uint8_t shift = 0, n = 0; n < varint_len(sizeof(U)); n++, shift += 7) {
+    const uint8_t b = in[idx++];
+    v |= (U)((U)(b & 0x7F) << shift);
+    if ((b & 0x80) == 0) {
+      break;
+    }
+  }
+  return v;
+}
+
+/* varint frame: only the fields that differ from their prediction are
+ * written, delta fields as a varint of the residual (zigzag unless xor) and
+ * the others at full width */
+template <size_t I>
+static inline void encode_varint(const SensorData &prev2, const SensorData &prev,
+                                 const SensorData &next, uint8_t *out,
+                                 uint8_t &idx, changed_t &changed,
+                                 const PredictorMap &map) {
+  typedef Field<I> F;
+  typedef typename F::wire U;
+  if constexpr (!F::delta) {
+    if (F::get(next) != F::get(prev)) {
+      changed |= (changed_t)1 << I;
+      encode_raw<I>(next, out, idx);
+    }
+  } else {
+    const uint8_t pred = map.field[I];
+    const U res =
+        residual<U>((U)F::get(next), predict<I>(prev2, prev, pred), pred);
+    if (res != 0) {
+      changed |= (changed_t)1 << I;
+      idx += put_varint<U>(out + idx, pred == PRED_XOR ? res : zigzag<U>(res));
+    }
+  }
+}
+
+template <size_t I>
+static inline void decode_varint(const SensorData &prev2, const SensorData &prev,
+                                 SensorData &next, const uint8_t *in,
+                                 uint8_t &idx, changed_t changed,
+                                 const PredictorMap &map) {
+  typedef Field<I> F;
+  typedef typename F::wire U;
+  const bool is_changed = changed & ((changed_t)1 << I);
+  if constexpr (!F::delta) {
+    if (is_changed) {
+      decode_raw<I>(next, in, idx);
+    } else {
+      F::ref(next) = F::get(prev);
+    }
+  } else {
+    const uint8_t pred = map.field[I];
+    U res = 0;
+    if (is_changed) {
+      res = take_varint<U>(in, idx);
+      res = pred == PRED_XOR ? res : unzigzag<U>(res);
+    }
+    F::ref(next) = (typename F::type)restore<U>(
+        res, predict<I>(prev2, prev, pred), pred);
+  }
+}
+
+/* residual of one field as an unsigned value (zigzag unless xor), 0 when
+ * the prediction is exact; non delta fields always use PRED_PREV. Used by
+ * the entropy stage (entropy.h) and its training tool */
+template <size_t I>
+static inline uint32_t residual_value(const SensorData &prev2,
+                                      const SensorData &prev,
+                                      const SensorData &next,
+                                      const PredictorMap &map) {
+  typedef Field<I> F;
+  typedef typename F::wire U;
+  const uint8_t pred = F::delta ? map.field[I] : (uint8_t)PRED_PREV;
+  const U res =
+      residual<U>((U)F::get(next), predict<I>(prev2, prev, pred), pred);
+  return pred == PRED_XOR ? res : zigzag<U>(res);
+}
+
+template <size_t I>
+static inline void apply_residual(const SensorData &prev2,
+                                  const SensorData &prev, SensorData &next,
+                                  uint32_t value, const PredictorMap &map) {
+  typedef Field<I> F;
+  typedef typename F::wire U;
+  const uint8_t pred = F::delta ? map.field[I] : (uint8_t)PRED_PREV;
+  const U res = pred == PRED_XOR ? (U)value : unzigzag<U>((U)value);
+  F::ref(next) =
+      (typename F::type)restore<U>(res, predict<I>(prev2, prev, pred), pred);
+}
+
+/* dead band: a field that moved by no more than its band since ref is held
+ * at the ref value, so the error never exceeds the band (ref is what the
+ * decoder reconstructed, not the previous raw sample) */
+template <size_t I>
+static inline bool hold_in_band(SensorData &next, const SensorData &ref) {
+  typedef Field<I> F;
+  const int64_t d = (int64_t)F::get(next) - (int64_t)F::get(ref);
+  if (d > F::band || d < -F::band) {
+    return false;
+  }
+  F::ref(next) = F::get(ref);
+  return true;
+}
+
+template <size_t I>
+static inline bool in_band(const SensorData &a, const SensorData &b) {
+  typedef Field<I> F;
+  const int64_t d = (int64_t)F::get(a) - (int64_t)F::get(b);
+  return d <= F::band && d >= -F::band;
+}
+
+/* lossy mode: the deltas are taken between quantization indices, round to
+ * nearest (floor division, so negative values round the same way) */
+template <size_t I>
+static inline void quantize_field(const SensorData &in, SensorData &out) {
+  typedef Field<I> F;
+  if constexpr (F::quant == 1) {
+    F::ref(out) = F::get(in);
+  } else {
+    const int64_t v = (int64_t)F::get(in) + F::quant / 2;
+    const int64_t k = (v >= 0 ? v : v - (F::quant - 1)) / F::quant;
+    F::ref(out) = (typename F::type)k;
+  }
+}
+
+/* NOTE: the top index may land past the end of the type, the clamped value
+ * is still within quant / 2 of the sample since the sample was in range */
+template <size_t I>
+static inline void dequantize_field(const SensorData &in, SensorData &out) {
+  typedef Field<I> F;
+  typedef typename F::type T;
+  if constexpr (F::quant == 1) {
+    F::ref(out) = F::get(in);
+  } else {
+    int64_t v = (int64_t)F::get(in) * F::quant;
+    v = v > (int64_t)std::numeric_limits<T>::max()
+            ? (int64_t)std::numeric_limits<T>::max()
+            : v;
+    v = v < (int64_t)std::numeric_limits<T>::min()
+            ? (int64_t)std::numeric_limits<T>::min()
+            : v;
+    F::ref(out) = (T)v;
+  }
+}
+
+template <size_t I>
+static inline bool in_quant(const SensorData &a, const SensorData &b) {
+  typedef Field<I> F;
+  const int64_t d = (int64_t)F::get(a) - (int64_t)F::get(b);
+  return d <= F::quant / 2 && d >= -(F::quant / 2);
+}
+
+/* copy the fields of the masked sensors from prev (used for absent data) */
+template <size_t I>
+static inline void hold(SensorData &next, const SensorData &prev,
+                        uint8_t sensors) {
+  if (Field<I>::sensor & sensors) {
+    Field<I>::ref(next) = Field<I>::get(prev);
+  }
+}
+
+/* whole record generators */
+template <size_t... I>
+static inline uint8_t encode_keyframe(const SensorData &d, uint8_t *out,
+                                      std::index_sequence<I...>) {
+  uint8_t idx = 0;
+  (encode_raw<I>(d, out, idx), ...);
+  return idx;
+}
+
+template <size_t... I>
+static inline uint8_t decode_keyframe(SensorData &d, const uint8_t *in,
+                                      std::index_sequence<I...>) {
+  uint8_t idx = 0;
+  (decode_raw<I>(d, in, idx), ...);
+  return idx;
+}
+
+/* NOTE: returns 0 when a value is outside its range, the caller falls back
+ * to the full width keyframe */
+template <size_t... I>
+static inline uint8_t encode_packed_keyframe(const SensorData &d, uint8_t *out,
+                                             std::index_sequence<I...> fields) {
+  if (!(in_range<I>(d) && ...)) {
+    return 0;
+  }
+  BitWriter w(out, packed_len(fields));
+  (encode_packed<I>(d, w), ...);
+  return (uint8_t)w.flush();
+}
+
+template <size_t... I>
+static inline uint8_t decode_packed_keyframe(SensorData &d, const uint8_t *in,
+                                             uint16_t len,
+                                             std::index_sequence<I...>) {
+  BitReader r(in, len);
+  (decode_packed<I>(d, r), ...);
+  return r.overflow() ? 0 : (uint8_t)r.consumed();
+}
+
+/* NOTE: prev2 is the sample before prev (the linear predictor needs both),
+ * pass prev again right after a keyframe */
+template <size_t... I>
+static inline uint8_t encode_deltas(const SensorData &prev2,
+                                    const SensorData &prev,
+                                    const SensorData &next, uint8_t *out,
+                                    flag_t &flag, const PredictorMap &map,
+                                    std::index_sequence<I...>) {
+  /* NOTE: stores through the byte pointer may alias anything, local copies
+   * keep the compiler from reloading the records after every byte */
+  const SensorData p2 = prev2, p = prev, n = next;
+  const PredictorMap m = map;
+  uint8_t idx = 0;
+  flag_t f = flag;
+  (encode_delta<I>(p2, p, n, out, idx, f, m), ...);
+  flag = f;
+  return idx;
+}
+
+template <size_t... I>
+static inline uint8_t decode_deltas(const SensorData &prev2,
+                                    const SensorData &prev, SensorData &next,
+                                    const uint8_t *in, flag_t flag,
+                                    const PredictorMap &map,
+                                    std::index_sequence<I...>) {
+  uint8_t idx = 0;
+  (decode_delta<I>(prev2, prev, next, in, idx, flag, map), ...);
+  return idx;
+}
+
+template <size_t... I>
+static inline uint8_t encode_varints(const SensorData &prev2,
+                                     const SensorData &prev,
+                                     const SensorData &next, uint8_t *out,
+                                     const PredictorMap &map,
+                                     std::index_sequence<I...>) {
+  const SensorData p2 = prev2, p = prev, n = next;
+  const PredictorMap m = map;
+  uint8_t idx = CHANGED_LEN;
+  changed_t changed = 0;
+  (encode_varint<I>(p2, p, n, out, idx, changed, m), ...);
+  for (uint8_t b = 0; b < CHANGED_LEN; b++) {
+    out[b] = (uint8_t)(changed >> (8 * b));
+  }
+  return idx;
+}
+
+template <size_t... I>
+static inline uint8_t decode_varints(const SensorData &prev2,
+                                     const SensorData &prev, SensorData &next,
+                                     const uint8_t *in, const PredictorMap &map,
+                                     std::index_sequence<I...>) {
+  changed_t changed = 0;
+  for (uint8_t b = 0; b < CHANGED_LEN; b++) {
+    changed |= (changed_t)in[b] << (8 * b);
+  }
+  uint8_t idx = CHANGED_LEN;
+  (decode_varint<I>(prev2, prev, next, in, idx, changed, map), ...);
+  return idx;
+}
+
+template <size_t... I>
+static inline void hold_sensors(SensorData &next, const SensorData &prev,
+                                uint8_t sensors, std::index_sequence<I...>) {
+  (hold<I>(next, prev, sensors), ...);
+}
+
+/* returns true when every field was held, ie. there is nothing to report */
+template <size_t... I>
+static inline bool deadband(SensorData &next, const SensorData &ref,
+                            std::index_sequence<I...>) {
+  return (hold_in_band<I>(next, ref) & ...);
+}
+
+/* every field of a within its band of b */
+template <size_t... I>
+static inline bool within_bands(const SensorData &a, const SensorData &b,
+                                std::index_sequence<I...>) {
+  return (in_band<I>(a, b) && ...);
+}
+
+/* NOTE: in and out may be the same record */
+template <size_t... I>
+static inline void quantize(const SensorData &in, SensorData &out,
+                            std::index_sequence<I...>) {
+  (quantize_field<I>(in, out), ...);
+}
+
+template <size_t... I>
+static inline void dequantize(const SensorData &in, SensorData &out,
+                              std::index_sequence<I...>) {
+  (dequantize_field<I>(in, out), ...);
+}
+
+/* every field on the air equal */
+template <size_t... I>
+static inline bool same(const SensorData &a, const SensorData &b,
+                        std::index_sequence<I...>) {
+  return ((Field<I>::get(a) == Field<I>::get(b)) && ...);
+}
+
+/* every field of a within half a quantization step of b */
+template <size_t... I>
+static inline bool within_quant(const SensorData &a, const SensorData &b,
+                                std::index_sequence<I...>) {
+  return (in_quant<I>(a, b) && ...);
+}
+
+template <size_t... I>
+static inline void residual_values(const SensorData &prev2,
+                                   const SensorData &prev,
+                                   const SensorData &next,
+                                   const PredictorMap &map, uint32_t *out,
+                                   std::index_sequence<I...>) {
+  // NOTE: fields outside the profile are left as they are
+  ((out[I] = residual_value<I>(prev2, prev, next, map)), ...);
+}
+
+} // namespace schema
+
+#endif // SCHEMA_H_
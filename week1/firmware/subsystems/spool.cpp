@@ -0,0 +1,338 @@
+#include "spool.h"
+#include "crc.h"
+#include <stddef.h>
+#include <string.h>
+
+#define SPOOL_MAGIC 0x53504C31 // "SPL1"
+#define SPOOL_LIVE 0xFFFFFFFFu
+#define SPOOL_END 0xFFFF
+#define SPOOL_FIRST sizeof(SpoolSector) // offset of the first record
+
+/* NOTE: the sector a record at `at` is in, or ends, a position right at the
+ * end of a sector belongs to it and not to the next one (whose header is
+ * there) */
+static uint16_t sector_of(uint32_t at) {
+  return (at - 1) / SPOOL_SECTOR_BYTES;
+}
+
+static uint32_t sector_check(const SpoolSector &h) {
+  return ~(h.magic ^ h.number ^ h.erases);
+}
+
+static uint16_t record_crc(const SpoolRecord &r, const uint8_t *bytes) {
+  return crc::Modbus::finish(crc::Modbus::update(
+      crc::Modbus::update(crc::Modbus::begin(), (const uint8_t *)&r,
+                          offsetof(SpoolRecord, state)),
+      bytes, r.len));
+}
+
+#ifdef ARDUINO
+
+bool Spool::attach() {
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                       ESP_PARTITION_SUBTYPE_ANY,
+                                       SPOOL_PARTITION);
+  return partition && partition->size >= SPOOL_BYTES;
+}
+
+bool Spool::read(uint32_t at, void *out, uint32_t len) {
+  counters.read += len;
+  return esp_partition_read(partition, at, out, len) == ESP_OK;
+}
+
+bool Spool::program(uint32_t at, const void *data, uint32_t len) {
+  counters.programmed += len;
+  return esp_partition_write(partition, at, data, len) == ESP_OK;
+}
+
+bool Spool::erase(uint16_t s) {
+  counters.erased++;
+  return esp_partition_erase_range(partition, s * SPOOL_SECTOR_BYTES,
+                                   SPOOL_SECTOR_BYTES) == ESP_OK;
+}
+
+#else
+
+Spool::~Spool() {
+  if (file) {
+    fclose(file);
+  }
+}
+
+/* the file stands in for the partition, a new (or short) one is erased
+ * flash */
+bool Spool::attach() {
+  if (file) {
+    fclose(file);
+  }
+  file = fopen(path, "r+b");
+  if (!file) {
+    file = fopen(path, "w+b");
+  }
+  if (!file || fseek(file, 0, SEEK_END) != 0) {
+    return false;
+  }
+  uint8_t erased[256];
+  memset(erased, 0xFF, sizeof(erased));
+  for (long size = ftell(file); size < (long)SPOOL_BYTES;
+       size += sizeof(erased)) {
+    if (fwrite(erased, sizeof(erased), 1, file) != 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Spool::read(uint32_t at, void *out, uint32_t len) {
+  counters.read += len;
+  return fseek(file, at, SEEK_SET) == 0 && fread(out, 1, len, file) == len;
+}
+
+/* NOTE: as NOR flash, programming only clears bits */
+bool Spool::program(uint32_t at, const void *data, uint32_t len) {
+  uint8_t cells[SPOOL_RECORD_MAX];
+  const uint32_t n = len < power ? len : power;
+  power -= n;
+  if (n > sizeof(cells) || fseek(file, at, SEEK_SET) != 0 ||
+      fread(cells, 1, n, file) != n) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    cells[i] &= ((const uint8_t *)data)[i];
+  }
+  counters.programmed += n;
+  return fseek(file, at, SEEK_SET) == 0 && fwrite(cells, 1, n, file) == n &&
+         n == len;
+}
+
+bool Spool::erase(uint16_t s) {
+  uint8_t erased[SPOOL_SECTOR_BYTES];
+  memset(erased, 0xFF, sizeof(erased));
+  if (power == 0) {
+    return false;
+  }
+  counters.erased++;
+  return fseek(file, s * SPOOL_SECTOR_BYTES, SEEK_SET) == 0 &&
+         fwrite(erased, sizeof(erased), 1, file) == 1;
+}
+
+#endif
+
+bool Spool::setup() {
+  memset(&counters, 0, sizeof(counters));
+  ready = attach() && recover();
+  return ready;
+}
+
+void Spool::run(uint16_t dt) { (void)dt; }
+
+/* NOTE: the header of the record at `at`, false at the end of its sector:
+ * erased (r.len is SPOOL_END) or a length no record has */
+bool Spool::record(uint32_t at, SpoolRecord &r) {
+  const uint32_t end = (sector_of(at) + 1) * SPOOL_SECTOR_BYTES;
+  if (end - at < sizeof(r) || !read(at, &r, sizeof(r))) {
+    r.len = SPOOL_END;
+    return false;
+  }
+  return r.len != SPOOL_END && r.len <= MAX_FRAME_LEN &&
+         at + SPOOL_RECORD_LEN(r.len) <= end;
+}
+
+bool Spool::intact(uint32_t at, const SpoolRecord &r, uint8_t *bytes) {
+  return read(at + sizeof(r), bytes, r.len) && record_crc(r, bytes) == r.crc;
+}
+
+/* NOTE: the write end moves on to the next sector, erased and numbered
+ * first. The frames it still holds are dropped, the log is full */
+bool Spool::open() {
+  const uint16_t s = (sector + 1) % SPOOL_SECTORS;
+  if (counters.frames && sector_of(tail) == s) {
+    uint8_t bytes[MAX_FRAME_LEN];
+    SpoolRecord r;
+    for (uint32_t at = tail; record(at, r); at += SPOOL_RECORD_LEN(r.len)) {
+      if (r.state == SPOOL_LIVE && intact(at, r, bytes)) {
+        counters.frames--;
+        counters.dropped++;
+      }
+    }
+    tail = (s + 1) % SPOOL_SECTORS * SPOOL_SECTOR_BYTES + SPOOL_FIRST;
+  }
+
+  // NOTE: an erase cut short leaves a free sector, its count starts over
+  const uint32_t wear = erases[s] + 1;
+  if (!erase(s)) {
+    return false;
+  }
+  erases[s] = wear;
+  SpoolSector h = {SPOOL_MAGIC, number + 1, wear, 0};
+  h.check = sector_check(h);
+  if (!program(s * SPOOL_SECTOR_BYTES, &h, sizeof(h))) {
+    return false;
+  }
+  sector = s;
+  number = h.number;
+  head = s * SPOOL_SECTOR_BYTES + SPOOL_FIRST;
+  if (!counters.frames) {
+    tail = head;
+  }
+  return true;
+}
+
+/* NOTE: the newest sector has the highest number, the log runs back from
+ * it as long as the numbers count down. Every record in it is read once */
+bool Spool::recover() {
+  uint32_t numbers[SPOOL_SECTORS];
+  int16_t newest = -1;
+  for (uint16_t s = 0; s < SPOOL_SECTORS; s++) {
+    SpoolSector h;
+    const bool valid = read(s * SPOOL_SECTOR_BYTES, &h, sizeof(h)) &&
+                       h.magic == SPOOL_MAGIC && h.check == sector_check(h);
+    numbers[s] = valid ? h.number : 0;
+    erases[s] = valid ? h.erases : 0;
+    if (valid && (newest < 0 || h.number > numbers[newest])) {
+      newest = s;
+    }
+  }
+  if (newest < 0) {
+    sector = SPOOL_SECTORS - 1;
+    number = 0;
+    return open();
+  }
+
+  uint16_t oldest = newest;
+  uint16_t used = 1;
+  for (; used < SPOOL_SECTORS; used++) {
+    const uint16_t prev = (oldest + SPOOL_SECTORS - 1) % SPOOL_SECTORS;
+    if (numbers[prev] == 0 || numbers[prev] != numbers[oldest] - 1) {
+      break;
+    }
+    oldest = prev;
+  }
+
+  sector = newest;
+  number = numbers[newest];
+  bool found = false;
+  uint8_t bytes[MAX_FRAME_LEN];
+  for (uint16_t i = 0; i < used; i++) {
+    const uint16_t s = (oldest + i) % SPOOL_SECTORS;
+    uint32_t at = s * SPOOL_SECTOR_BYTES + SPOOL_FIRST;
+    SpoolRecord r;
+    for (; record(at, r); at += SPOOL_RECORD_LEN(r.len)) {
+      if (!intact(at, r, bytes)) {
+        counters.torn++;
+      } else if (r.state == SPOOL_LIVE) {
+        tail = found ? tail : at;
+        found = true;
+        counters.frames++;
+      }
+    }
+    // NOTE: past a length no record has, the rest of the sector is lost
+    head = r.len == SPOOL_END ? at : (s + 1) * SPOOL_SECTOR_BYTES;
+  }
+  tail = found ? tail : head;
+  return true;
+}
+
+bool Spool::append(Frame &frame) {
+  if (!ready) {
+    return false;
+  }
+  alignas(SpoolRecord) uint8_t buffer[SPOOL_RECORD_MAX];
+  SpoolRecord &r = *(SpoolRecord *)buffer;
+  const uint32_t len = SPOOL_RECORD_LEN(frame.len);
+  memset(buffer + len - 4, 0xFF, 4); // NOTE: the padding stays erased
+  r.len = frame.len;
+  r.sealed = frame.sealed;
+  r.reserved = 0xFF;
+  r.flag = frame.flag;
+  r.state = SPOOL_LIVE;
+  r.reserved2 = 0xFFFF;
+  memcpy(buffer + sizeof(r), frame.sealed ? frame.data() : frame.payload(),
+         frame.len);
+  r.crc = record_crc(r, buffer + sizeof(r));
+
+  if (head + len > (sector + 1u) * SPOOL_SECTOR_BYTES && !open()) {
+    return false;
+  }
+  // NOTE: a record that failed halfway is skipped by take() and setup()
+  const bool ok = program(head, buffer, len);
+  head += len;
+  if (ok) {
+    counters.frames++;
+    counters.written++;
+  }
+  return ok;
+}
+
+bool Spool::take(Queue &queue) {
+  SpoolRecord r;
+  while (ready && counters.frames && tail != head) {
+    if (!record(tail, r)) {
+      if (sector_of(tail) == sector) {
+        break;
+      }
+      tail = (sector_of(tail) + 1) % SPOOL_SECTORS * SPOOL_SECTOR_BYTES +
+             SPOOL_FIRST;
+      continue;
+    }
+    const uint32_t at = tail;
+    tail += SPOOL_RECORD_LEN(r.len);
+    if (r.state != SPOOL_LIVE) {
+      continue;
+    }
+
+    Frame *room = queue.reserve();
+    if (room == nullptr) {
+      tail = at;
+      return false;
+    }
+    Frame &frame = *room;
+    if (!intact(at, r, r.sealed ? frame.bytes() : frame.payload())) {
+      continue; // NOTE: cut short, setup() did not count it
+    }
+    // NOTE: given back to the log if it cannot be marked taken
+    const uint32_t taken = 0;
+    if (!program(at + offsetof(SpoolRecord, state), &taken, sizeof(taken))) {
+      tail = at;
+      return false;
+    }
+    frame.flag = r.flag;
+    frame.len = r.len;
+    frame.start = 0;
+    frame.sealed = r.sealed;
+    queue.commit();
+    counters.frames--;
+    counters.taken++;
+    return true;
+  }
+  return false;
+}
+
+uint16_t Spool::spill(Queue &queue, bool all) {
+  uint16_t n = 0;
+  while ((all ? !queue.isEmpty() : queue.isFull()) &&
+         append(*queue.front())) {
+    queue.release();
+    n++;
+  }
+  return n;
+}
+
+uint16_t Spool::refill(Queue &queue) {
+  uint16_t n = 0;
+  while (queue.stats().bytes < SPOOL_REFILL_BYTES && take(queue)) {
+    n++;
+  }
+  return n;
+}
+
+SpoolStats Spool::stats() const {
+  SpoolStats s = counters;
+  s.min_erases = erases[0];
+  s.max_erases = erases[0];
+  for (uint16_t i = 1; i < SPOOL_SECTORS; i++) {
+    s.min_erases = erases[i] < s.min_erases ? erases[i] : s.min_erases;
+    s.max_erases = erases[i] > s.max_erases ? erases[i] : s.max_erases;
+  }
+  return s;
+}
@@ -0,0 +1,151 @@
+/**
+ *  @file spool.h
+ *  @brief Store and forward of the queued frames through a long outage or
+ *  a reset: the frames the RAM queue (queue.h) has no room for are written
+ *  back to a log in flash (a data partition, a file on the host) instead of
+ *  being dropped, and come back into the queue once it ran empty.
+ *
+ *  The log is a ring of erase sectors. Each one starts with a header that
+ *  numbers it, records of one frame under a CRC follow it in the order they
+ *  were written, and a sector is only erased again once the write end comes
+ *  round to it, so all of them wear the same. Taking a frame back clears
+ *  the state word of its record in place (flash programs bits from 1 to 0
+ *  without an erase). setup() finds the write end and the oldest frame
+ *  again from the headers and the records alone: a record cut short by a
+ *  power loss fails its CRC and is skipped, a frame taken back is not sent
+ *  twice. The queue in front is a write back cache, what it holds at a
+ *  power loss is lost, what went to flash is not.
+ *  */
+
+#ifndef SPOOL_H_
+#define SPOOL_H_
+
+#include "queue.h"
+#include "subsystem.h"
+
+#ifdef ARDUINO
+#include <esp_partition.h>
+#else
+#include <stdio.h>
+#endif
+
+#ifndef SPOOL_FILE
+#define SPOOL_FILE "spool.bin"
+#endif
+
+/* data partition of the log: the spiffs one of the default partition
+ * tables, which the sketch never mounts */
+#ifndef SPOOL_PARTITION
+#define SPOOL_PARTITION "spiffs"
+#endif
+
+#ifndef SPOOL_SECTOR_BYTES
+#define SPOOL_SECTOR_BYTES 4096 // the erase unit of the flash
+#endif
+#ifndef SPOOL_SECTORS
+#define SPOOL_SECTORS 16
+#endif
+#define SPOOL_BYTES ((uint32_t)SPOOL_SECTORS * SPOOL_SECTOR_BYTES)
+
+/* queue bytes refill() fills at most, the rest stays free for the frames
+ * encoded while the backlog goes out */
+#ifndef SPOOL_REFILL_BYTES
+#define SPOOL_REFILL_BYTES (QUEUE_ARENA_BYTES / 2)
+#endif
+
+struct SpoolSector {
+  uint32_t magic;  // SPOOL_MAGIC, anything else: a free sector
+  uint32_t number; // in the log, one more than the sector written before
+  uint32_t erases; // of this sector
+  uint32_t check;  // of the fields above, a header cut short fails it
+};
+
+struct SpoolRecord {
+  uint16_t len;   // of the bytes behind it, 0xFFFF: erased, the end
+  uint8_t sealed; // the bytes are a finalized frame, not a payload
+  uint8_t reserved;
+  flag_t flag;
+  uint32_t state; // SPOOL_LIVE as written, 0 once taken back
+  uint16_t crc;   // of len to flag and the bytes
+  uint16_t reserved2;
+};
+
+/* NOTE: records start on a word, the header of the next one included */
+#define SPOOL_RECORD_LEN(len) ((sizeof(SpoolRecord) + (len) + 3) & ~3u)
+#define SPOOL_RECORD_MAX SPOOL_RECORD_LEN(MAX_FRAME_LEN)
+
+static_assert(SPOOL_SECTORS >= 2, "the write end opens a sector of its own");
+static_assert(SPOOL_SECTOR_BYTES >= sizeof(SpoolSector) + SPOOL_RECORD_MAX,
+              "a sector holds the longest frame");
+
+struct SpoolStats {
+  uint32_t frames;     // in the log now
+  uint32_t written;    // frames written back since setup()
+  uint32_t taken;      // frames back in the queue
+  uint32_t dropped;    // erased before they were taken, the log was full
+  uint32_t torn;       // records setup() found cut short
+  uint32_t read;       // flash bytes read
+  uint32_t programmed; // flash bytes programmed
+  uint32_t erased;     // sectors erased
+  uint32_t min_erases; // of any sector, the gap to max_erases is the wear
+  uint32_t max_erases; // spread
+};
+
+class Spool : public Subsystem {
+private:
+#ifdef ARDUINO
+  const esp_partition_t *partition;
+#else
+  const char *path;
+  FILE *file;
+  uint32_t power; // bytes it programs before the power goes
+#endif
+  bool ready;
+  uint16_t sector; // the write end is in
+  uint32_t number; // of that sector
+  uint32_t head;   // write end, address in the partition
+  uint32_t tail;   // oldest record that may be live, head when none is
+  uint32_t erases[SPOOL_SECTORS];
+  SpoolStats counters;
+
+  bool attach();
+  bool read(uint32_t at, void *out, uint32_t len);
+  bool program(uint32_t at, const void *data, uint32_t len);
+  bool erase(uint16_t sector);
+  bool record(uint32_t at, SpoolRecord &r);
+  bool intact(uint32_t at, const SpoolRecord &r, uint8_t *bytes);
+  bool open();
+  bool recover();
+
+public:
+#ifndef ARDUINO
+  explicit Spool(const char *path = SPOOL_FILE)
+      : path(path), file(nullptr), power(UINT32_MAX), ready(false) {}
+  ~Spool();
+  /* a power loss after `bytes` more programmed ones, the write under way
+   * is cut short and everything after it fails (a new Spool on the same
+   * file is the next power on) */
+  void cut_power(uint32_t bytes) { power = bytes; }
+#endif
+  /* finds the log again, false without a partition (nothing is spooled) */
+  bool setup();
+  void run(uint16_t dt);
+
+  /* writes the frame behind the newest one, dropping the oldest sector when
+   * the log is full, false if the flash failed */
+  bool append(Frame &frame);
+  /* the oldest frame back into the queue, false when there is none */
+  bool take(Queue &queue);
+  /* writes back the oldest frames while the queue is full, all of them with
+   * `all`, returns how many */
+  uint16_t spill(Queue &queue, bool all = false);
+  /* takes frames back while the queue holds less than SPOOL_REFILL_BYTES,
+   * returns how many */
+  uint16_t refill(Queue &queue);
+
+  uint32_t size() const { return counters.frames; }
+  bool isEmpty() const { return counters.frames == 0; }
+  SpoolStats stats() const;
+};
+
+#endif // SPOOL_H_
@@ -0,0 +1,161 @@
+/**
+ *  @file spsc_ring.h
+ *  @brief Lock-free ring of N (a power of two) elements between one producer
+ *  and one consumer, each of which may run in a task or an interrupt of its
+ *  own, such as the radio callback to loop() handoff of the base station
+ *  (its sketch gets a copy of this file by `make bstation`, `make check`
+ *  fails when that copy drifted). The node queue (queue.h) holds frames of
+ *  any length the same way.
+ *
+ *  The producer fills a slot in place (reserve(), then commit()) or copies
+ *  elements in (push()), the consumer reads them where they are (front(),
+ *  peek(), then release()) or copies them out (pop()). Both counters run
+ *  free and are masked on access, each side only ever stores its own, with
+ *  release order, and loads the other one with acquire order, so a slot is
+ *  written before it is published and read before it is given back.
+ *  */
+
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// NOTE: keeps the two counters apart, a store to one does not invalidate the
+// cache line of the other (32 bytes on the ESP32-S3, 64 on most hosts)
+#ifndef SPSC_CACHE_LINE
+#define SPSC_CACHE_LINE 64
+#endif
+
+template <typename T, uint32_t N> class SpscRing {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N is a power of two");
+  static_assert(N <= 0x80000000u, "the counters tell full from empty");
+
+private:
+  static constexpr uint32_t MASK = N - 1;
+  T slots[N];
+  alignas(SPSC_CACHE_LINE) std::atomic<uint32_t> head; // producer's
+  uint32_t cached_tail; // producer's copy, reloaded when short of room
+  alignas(SPSC_CACHE_LINE) std::atomic<uint32_t> tail; // consumer's
+  uint32_t cached_head; // consumer's copy, reloaded when short of elements
+
+  /* NOTE: free slots as far as the producer knows, the consumer counter is
+   * only loaded again once fewer than `want` are left */
+  uint32_t room(uint32_t h, uint32_t want) {
+    if (N - (h - cached_tail) < want) {
+      cached_tail = tail.load(std::memory_order_acquire);
+    }
+    return N - (h - cached_tail);
+  }
+
+  /* NOTE: queued elements as far as the consumer knows, likewise */
+  uint32_t queued(uint32_t t, uint32_t want) {
+    if (cached_head - t < want) {
+      cached_head = head.load(std::memory_order_acquire);
+    }
+    return cached_head - t;
+  }
+
+public:
+  SpscRing() { clear(); }
+
+  /* empties the ring, neither side may be in it */
+  void clear() {
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    cached_tail = 0;
+    cached_head = 0;
+  }
+
+  /* producer: the next free slot to fill in place, nullptr when full. It
+   * is only published by commit() */
+  T *reserve() {
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    return room(h, 1) ? &slots[h & MASK] : nullptr;
+  }
+
+  /* producer: publishes the slot reserve() gave out */
+  void commit() {
+    head.store(head.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  /* producer: false when full */
+  bool push(const T &item) {
+    T *slot = reserve();
+    if (!slot) {
+      return false;
+    }
+    *slot = item;
+    commit();
+    return true;
+  }
+
+  /* producer: as many of `count` items as fit, published at once, returns
+   * how many */
+  uint32_t push(const T *items, uint32_t count) {
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    const uint32_t free = room(h, count);
+    const uint32_t n = count < free ? count : free;
+    for (uint32_t i = 0; i < n; i++) {
+      slots[(h + i) & MASK] = items[i];
+    }
+    head.store(h + n, std::memory_order_release);
+    return n;
+  }
+
+  /* consumer: oldest element, in place until release(), nullptr when
+   * empty */
+  T *front() { return peek(0); }
+
+  /* consumer: i-th oldest element, nullptr past the last one */
+  T *peek(uint32_t i) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    return i < queued(t, i + 1) ? &slots[(t + i) & MASK] : nullptr;
+  }
+
+  /* consumer: gives the `count` oldest elements back to the producer (no
+   * more than are queued) */
+  void release(uint32_t count = 1) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    queued(t, count); // NOTE: the copy must not fall behind the tail
+    tail.store(t + count, std::memory_order_release);
+  }
+
+  /* consumer: false when empty */
+  bool pop(T &item) {
+    const T *slot = front();
+    if (!slot) {
+      return false;
+    }
+    item = *slot;
+    release();
+    return true;
+  }
+
+  /* consumer: up to `count` items copied out and released at once, returns
+   * how many */
+  uint32_t pop(T *items, uint32_t count) {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    const uint32_t available = queued(t, count);
+    const uint32_t n = count < available ? count : available;
+    for (uint32_t i = 0; i < n; i++) {
+      items[i] = slots[(t + i) & MASK];
+    }
+    tail.store(t + n, std::memory_order_release);
+    return n;
+  }
+
+  /* exact from either side while the other one is idle, a snapshot
+   * otherwise */
+  uint32_t size() const {
+    return head.load(std::memory_order_acquire) -
+           tail.load(std::memory_order_acquire);
+  }
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() == N; }
+  static constexpr uint32_t capacity() { return N; }
+};
+
+#endif // SPSC_RING_H_
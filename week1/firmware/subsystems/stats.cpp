@@ -0,0 +1,54 @@
+#include "stats.h"
+#include <Arduino.h>
+
+namespace stats {
+
+static const char *const NAMES[] = {
+#define X(id, ...) #id,
+    SENSOR_FIELDS(X)
+#undef X
+};
+
+/* NOTE: a histogram with nothing in it is left out */
+static void print_histogram(const char *name, const uint32_t *len,
+                            uint8_t buckets, uint16_t step) {
+  uint32_t frames = 0;
+  for (uint8_t b = 0; b < buckets; b++) {
+    frames += len[b];
+  }
+  if (frames == 0) {
+    return;
+  }
+  Serial.print(name);
+  for (uint8_t b = 0; b < buckets; b++) {
+    if (len[b]) {
+      Serial.printf(" %u%s=%u", (unsigned)(b * step),
+                    b == buckets - 1 ? "+" : "", (unsigned)len[b]);
+    }
+  }
+  Serial.println();
+}
+
+void print(const EncoderStats &s) {
+  Serial.printf("stats: frames=%u key=%u held=%u samples=%u\n",
+                (unsigned)s.frames, (unsigned)s.keyframes, (unsigned)s.held,
+                (unsigned)s.samples);
+  print_histogram("len:", s.len, STATS_LEN_BUCKETS, STATS_LEN_STEP);
+  print_histogram("batch len:", s.batch_len, STATS_BATCH_LEN_BUCKETS,
+                  STATS_BATCH_LEN_STEP);
+  Serial.println("field     zero   narrow     wide    flips  bits/s");
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    if (!schema::present(i)) {
+      continue;
+    }
+    const FieldStats &f = s.field[i];
+    // NOTE: hundredths in integers, no float formatting needed
+    const uint32_t bits = s.samples ? (uint32_t)(100ull * f.bits / s.samples) : 0;
+    Serial.printf("%-5s %8u %8u %8u %8u %4u.%02u\n", NAMES[i],
+                  (unsigned)f.zero, (unsigned)f.narrow, (unsigned)f.wide,
+                  (unsigned)f.flips, (unsigned)(bits / 100),
+                  (unsigned)(bits % 100));
+  }
+}
+
+} // namespace stats
@@ -0,0 +1,175 @@
+/**
+ *  @file stats.h
+ *  @brief Per field counters of what the Encoder put on the air, to tune
+ *  the dead bands and the predictors of a site from its own data. A frame
+ *  is tallied from the residuals the encoder just coded, the payload is
+ *  never parsed back.
+ *  */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "entropy.h"
+#include "frame_len.h"
+#include "lora.h"
+#include "schema.h"
+
+/* 0 compiles the counters out of the encoder */
+#ifndef ENCODER_STATS
+#define ENCODER_STATS 1
+#endif
+
+/* payload length histograms, the last bucket takes every longer payload.
+ * Frames of a single sample are a few bytes to a few tens of them, batches
+ * go up to what a radio packet carries (see BATCH_MAX_LEN) */
+#define STATS_LEN_STEP 4
+#define STATS_LEN_BUCKETS 16
+#define STATS_BATCH_LEN_BUCKETS 16
+#define STATS_BATCH_LEN_STEP                                                   \
+  ((frame_payload_room(LORA_MAX_PAYLOAD) + STATS_BATCH_LEN_BUCKETS - 1) /      \
+   STATS_BATCH_LEN_BUCKETS)
+
+struct FieldStats {
+  uint32_t zero;   // residual 0, ie. left out of varint and entropy frames
+  uint32_t narrow; // residual in one byte (or less)
+  uint32_t wide;   // more than a byte (keyframe fields at their width)
+  uint32_t flips;  // residual of the other sign than the last one
+  uint32_t bits;   // on the air, bits / samples is the average
+};
+
+struct EncoderStats {
+  uint32_t frames; // ENCODER_OK frames
+  uint32_t keyframes;
+  uint32_t held;    // ENCODER_HOLD
+  uint32_t samples; // tallied in field[] (every record of a batch counts)
+  uint32_t len[STATS_LEN_BUCKETS]; // of the frames of a single sample
+  uint32_t batch_len[STATS_BATCH_LEN_BUCKETS];
+  FieldStats field[FIELD_COUNT];
+  schema::changed_t negative; // sign of the last non zero residual
+};
+
+namespace stats {
+
+enum Coding : uint8_t { CODING_DELTA, CODING_VARINT, CODING_ENTROPY };
+
+static inline uint8_t varint_bytes(uint32_t v) {
+  uint8_t n = 1;
+  for (; v >= 0x80; v >>= 7) {
+    n++;
+  }
+  return n;
+}
+
+/* bits the coding spent on one residual (as from schema::residual_value) */
+template <size_t I>
+static inline uint8_t residual_bits(uint32_t v, bool xored, Coding coding) {
+  typedef schema::Field<I> F;
+  // NOTE: entropy frames code every field as a residual, the others send
+  // the changed raw fields at full width
+  if (!F::delta && coding != CODING_ENTROPY) {
+    return v || coding == CODING_DELTA ? 8 * F::width : 0;
+  }
+  switch (coding) {
+  case CODING_VARINT:
+    return v ? 8 * varint_bytes(v) : 0;
+  case CODING_ENTROPY: {
+    if (!v) {
+      return 0;
+    }
+    const uint8_t n = entropy::bit_length(v);
+    return entropy::RESIDUAL_CODE.field[I].len[n - 1] + n - 1;
+  }
+  default: {
+    // NOTE: one byte of magnitude when it fits, the sign is in the flags
+    const uint32_t mag = xored ? v : (v + 1) >> 1;
+    return mag <= 0xFF ? 8 : 8 * F::width;
+  }
+  }
+}
+
+template <size_t I>
+static inline void tally_residual(const uint32_t *values,
+                                  const schema::PredictorMap &map,
+                                  Coding coding, EncoderStats &s) {
+  typedef schema::Field<I> F;
+  FieldStats &f = s.field[I];
+  const uint32_t v = values[I];
+  const bool xored = F::delta && map.field[I] == schema::PRED_XOR;
+  const uint8_t bits = residual_bits<I>(v, xored, coding);
+  f.bits += bits;
+  if (v == 0) {
+    f.zero++;
+    return;
+  }
+  (bits <= 8 ? f.narrow : f.wide)++;
+  // NOTE: zigzag puts the sign in the lowest bit, xor residuals have none
+  if (F::delta && !xored) {
+    const schema::changed_t bit = (schema::changed_t)1 << I;
+    const schema::changed_t negative = (v & 1) ? bit : 0;
+    f.flips += (s.negative & bit) != negative;
+    s.negative = (schema::changed_t)((s.negative & ~bit) | negative);
+  }
+}
+
+/* NOTE: a packed field takes the bits of its range, a flag only one */
+template <size_t I>
+static inline void tally_raw(bool packed, EncoderStats &s) {
+  typedef schema::Field<I> F;
+  const uint8_t bits = packed ? F::bits : 8 * F::width;
+  (bits <= 8 ? s.field[I].narrow : s.field[I].wide)++;
+  s.field[I].bits += bits;
+}
+
+/* one record of a delta frame, the same history the encoder coded from */
+template <size_t... I>
+static inline void tally(const SensorData &prev2, const SensorData &prev,
+                         const SensorData &next,
+                         const schema::PredictorMap &map, Coding coding,
+                         EncoderStats &s, std::index_sequence<I...> fields) {
+  if (!ENCODER_STATS) {
+    return;
+  }
+  uint32_t values[FIELD_COUNT];
+  schema::residual_values(prev2, prev, next, map, values, fields);
+  (tally_residual<I>(values, map, coding, s), ...);
+  s.samples++;
+}
+
+template <size_t... I>
+static inline void tally_keyframe(bool packed, EncoderStats &s,
+                                  std::index_sequence<I...>) {
+  if (!ENCODER_STATS) {
+    return;
+  }
+  (tally_raw<I>(packed, s), ...);
+  s.samples++;
+  s.keyframes++;
+}
+
+static inline void tally_frame(uint8_t held, uint16_t len, bool batch,
+                               EncoderStats &s) {
+  if (!ENCODER_STATS) {
+    return;
+  }
+  if (held) {
+    s.held++;
+    return;
+  }
+  s.frames++;
+  if (batch) {
+    const uint16_t bucket = len / STATS_BATCH_LEN_STEP;
+    s.batch_len[bucket < STATS_BATCH_LEN_BUCKETS
+                    ? bucket
+                    : STATS_BATCH_LEN_BUCKETS - 1]++;
+  } else {
+    const uint16_t bucket = len / STATS_LEN_STEP;
+    s.len[bucket < STATS_LEN_BUCKETS ? bucket : STATS_LEN_BUCKETS - 1]++;
+  }
+}
+
+/* compact dump on the serial port, one line per field of the profile */
+void print(const EncoderStats &s);
+
+} // namespace stats
+
+#endif // STATS_H_
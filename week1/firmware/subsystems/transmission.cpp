@@ -4,6 +4,7 @@ Transmission *Transmission::instance = nullptr;
 
 bool Transmission::setup() {
   instance = this;
+  sending = false;
   radio_events.TxDone = on_tx_done;
   radio_events.TxTimeout = on_tx_timeout;
   radio_events.RxDone = on_rx_done;
@@ -13,20 +14,23 @@ bool Transmission::setup() {
   Radio.SetChannel(RF_FREQUENCY);
   Radio.SetTxConfig(MODEM_LORA, TX_OUTPUT_POWER, 0, LORA_BANDWIDTH,
                     LORA_SPREADING_FACTOR, LORA_CODINGRATE,
-                    LORA_PREAMBLE_LENGTH, LORA_FIX_LENGTH_PAYLOAD_ON, true, 0,
-                    0, LORA_IQ_INVERSION_ON, 3000);
+                    LORA_PREAMBLE_LENGTH, LORA_FIX_LENGTH_PAYLOAD_ON,
+                    LORA_CRC_ON, 0, 0, LORA_IQ_INVERSION_ON, 3000);
   Radio.SetRxConfig(MODEM_LORA, LORA_BANDWIDTH, LORA_SPREADING_FACTOR,
                     LORA_CODINGRATE, 0, LORA_PREAMBLE_LENGTH,
-                    LORA_FIX_LENGTH_PAYLOAD_ON, 0, true, 0, 0,
+                    LORA_FIX_LENGTH_PAYLOAD_ON, 0, LORA_CRC_ON, 0, 0,
                     LORA_IQ_INVERSION_ON, true, RX_TIMEOUT_VALUE);
   Radio.Rx(0);
   return true;
 }
 
 void Transmission::transmit(uint8_t *buffer, uint16_t len) {
+  sending = true;
   Radio.Send(buffer, len);
 }
 
+bool Transmission::busy() const { return sending; }
+
 void Transmission::run(uint16_t dt) {
   (void)dt;
   Radio.IrqProcess();
@@ -34,6 +38,7 @@ void Transmission::run(uint16_t dt) {
 
 void Transmission::on_tx_done() {
   if (instance) {
+    instance->sending = false;
     Radio.Rx(0);
   }
 }
@@ -49,6 +54,7 @@ void Transmission::on_rx_done(uint8_t *payload, uint16_t size, int16_t rssi,
 
 void Transmission::on_tx_timeout() {
   if (instance) {
+    instance->sending = false;
     Radio.Rx(0);
   }
 }
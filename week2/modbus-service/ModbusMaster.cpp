@@ -618,10 +618,7 @@ uint8_t ModbusMaster::ModbusMasterTransaction(uint8_t u8MBFunction) {
   }
 
   // append CRC
-  u16CRC = 0xFFFF;
-  for (i = 0; i < u8ModbusADUSize; i++) {
-    u16CRC = crc16_update(u16CRC, u8ModbusADU[i]);
-  }
+  u16CRC = crc::Modbus::compute(u8ModbusADU, u8ModbusADUSize);
   u8ModbusADU[u8ModbusADUSize++] = lowByte(u16CRC);
   u8ModbusADU[u8ModbusADUSize++] = highByte(u16CRC);
   u8ModbusADU[u8ModbusADUSize] = 0;
@@ -723,10 +720,7 @@ uint8_t ModbusMaster::ModbusMasterTransaction(uint8_t u8MBFunction) {
   // verify response is large enough to inspect further
   if (!u8MBStatus && u8ModbusADUSize >= 5) {
     // calculate CRC
-    u16CRC = 0xFFFF;
-    for (i = 0; i < (u8ModbusADUSize - 2); i++) {
-      u16CRC = crc16_update(u16CRC, u8ModbusADU[i]);
-    }
+    u16CRC = crc::Modbus::compute(u8ModbusADU, u8ModbusADUSize - 2);
 
     // verify CRC
     if (!u8MBStatus && (lowByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 2] ||
@@ -55,6 +55,8 @@ obtain a copy.
 #ifndef _UTIL_CRC16_H_
 #define _UTIL_CRC16_H_
 
+#include "crc.h"
+
 
 /** @ingroup util_crc16
     Processor-independent CRC-16 calculation.
@@ -62,26 +64,16 @@ obtain a copy.
     Polynomial: x^16 + x^15 + x^2 + 1 (0xA001)<br>
     Initial value: 0xFFFF
 
-    This CRC is normally used in disk-drive controllers.
+    This CRC is normally used in disk-drive controllers. One table lookup
+    per byte, see crc::Modbus in crc.h for whole buffers.
 
     @param uint16_t crc (0x0000..0xFFFF)
     @param uint8_t a (0x00..0xFF)
     @return calculated CRC (0x0000..0xFFFF)
 */
-static uint16_t crc16_update(uint16_t crc, uint8_t a)
+static inline uint16_t crc16_update(uint16_t crc, uint8_t a)
 {
-  int i;
-
-  crc ^= a;
-  for (i = 0; i < 8; ++i)
-  {
-    if (crc & 1)
-      crc = (crc >> 1) ^ 0xA001;
-    else
-      crc = (crc >> 1);
-  }
-
-  return crc;
+  return crc::Modbus::update<crc::TABLE>(crc, &a, 1);
 }
 
 